@@ -0,0 +1,113 @@
+require 'json'
+
+# Minimal harness for the microbenchmarks of the C extensions. It runs each
+# case a few times to warm up, then measures a fixed number of repetitions,
+# and reports per-call timings as JSON so that runs can be compared across
+# native changes.
+module NativeBenchmark
+    # The benchmark groups, as name => block. See NativeBenchmark.group
+    def self.groups
+        @groups ||= Hash.new
+    end
+
+    # Defines a group of benchmarks. The block is called with the Suite
+    # object when the group is run
+    def self.group(name, &block)
+        groups[name.to_s] = block
+    end
+
+    class Suite
+        # The number of unmeasured runs before the measurements
+        attr_reader :warmup
+        # The number of measured runs
+        attr_reader :repetitions
+        # The problem sizes the groups should use
+        attr_reader :sizes
+        # The results so far, as an array of hashes
+        attr_reader :results
+
+        def initialize(options = {})
+            @warmup      = options[:warmup] || 3
+            @repetitions = options[:repetitions] || 20
+            @sizes       = options[:sizes] || [100, 1_000, 10_000]
+            @results     = Array.new
+            @group       = nil
+        end
+
+        # Runs the groups whose names are listed in +names+, or all of them
+        # if +names+ is empty
+        def run(names = [])
+            names = NativeBenchmark.groups.keys if names.empty?
+            names.each do |name|
+                if !(block = NativeBenchmark.groups[name])
+                    raise ArgumentError, "no benchmark group called #{name}, known groups are #{NativeBenchmark.groups.keys.sort.join(", ")}"
+                end
+
+                @group = name
+                begin
+                    block.call(self)
+                rescue LoadError => e
+                    skip(name, e.message)
+                end
+            end
+            self
+        end
+
+        # Measures the block. It is called +iterations+ times (with the
+        # iteration index) in each repetition, and the reported timings are
+        # per call.
+        def measure(name, params = {}, iterations = 1)
+            warmup.times do
+                iterations.times { |i| yield(i) }
+            end
+
+            samples = (1..repetitions).map do
+                GC.start
+                start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+                iterations.times { |i| yield(i) }
+                (Process.clock_gettime(Process::CLOCK_MONOTONIC) - start) / iterations
+            end
+            results << result_entry(name, params, iterations, samples)
+        end
+
+        # Records that a benchmark (or a whole group) could not run
+        def skip(name, reason)
+            results << Hash['name' => qualified_name(name), 'skipped' => reason]
+        end
+
+        def qualified_name(name)
+            if @group && name != @group then "#{@group}/#{name}"
+            else name.to_s
+            end
+        end
+
+        def result_entry(name, params, iterations, samples)
+            sorted = samples.sort
+            Hash['name' => qualified_name(name),
+                'params' => params,
+                'iterations' => iterations,
+                'warmup' => warmup,
+                'repetitions' => repetitions,
+                'unit' => 's',
+                'min' => sorted.first,
+                'mean' => sorted.inject(0, :+) / sorted.size,
+                'p50' => NativeBenchmark.percentile(sorted, 50),
+                'p90' => NativeBenchmark.percentile(sorted, 90),
+                'p99' => NativeBenchmark.percentile(sorted, 99),
+                'max' => sorted.last,
+                'samples' => samples]
+        end
+
+        def to_json(*args)
+            Hash['ruby' => RUBY_DESCRIPTION,
+                'time' => Time.now.utc.strftime("%Y-%m-%dT%H:%M:%SZ"),
+                'results' => results].to_json(*args)
+        end
+    end
+
+    # Nearest-rank percentile of an already sorted array
+    def self.percentile(sorted, p)
+        rank = (p / 100.0 * sorted.size).ceil - 1
+        sorted[[[rank, 0].max, sorted.size - 1].min]
+    end
+end
@@ -0,0 +1,52 @@
+NativeBenchmark.group 'roby_bgl' do |suite|
+    require 'value_set'
+    require 'roby/graph'
+    vertex_class = Class.new { include BGL::Vertex }
+
+    suite.sizes.each do |size|
+        # A random DAG with about two edges per vertex. Edges go from lower to
+        # higher indexes, so vertices.first is a good root for the traversals
+        random   = Random.new(42)
+        vertices = (1..size).map { vertex_class.new }
+        graph    = BGL::Graph.new
+        vertices.each { |v| graph.insert(v) }
+        (2 * size).times do
+            a, b = random.rand(size), random.rand(size)
+            a, b = b, a if a > b
+            if a != b && !graph.linked?(vertices[a], vertices[b])
+                graph.link(vertices[a], vertices[b], nil)
+            end
+        end
+        edge_count = 0
+        graph.each_edge { edge_count += 1 }
+        params = Hash['vertices' => size, 'edges' => edge_count]
+
+        extra = vertex_class.new
+        graph.insert(extra)
+        suite.measure('link_unlink', params, 100) do |i|
+            target = vertices[i % size]
+            graph.link(extra, target, nil)
+            graph.unlink(extra, target)
+        end
+        suite.measure('reachable?', params, 100) do |i|
+            graph.reachable?(vertices[i % size], vertices[-1 - i % size])
+        end
+        root_set = [vertices.first].to_value_set
+        suite.measure('generated_subgraphs', params, 10) do
+            graph.generated_subgraphs(root_set, false)
+        end
+        suite.measure('topological_sort', params, 10) do
+            graph.topological_sort
+        end
+
+        # A queue of deadlines with one entry per vertex, as
+        # EventDeadlines has on plans with many temporal constraints
+        queue = Roby::TimerQueue.new
+        vertices.each_with_index { |v, i| queue.push(random.rand * size, v, i) }
+        suite.measure('timer_queue_push_delete', Hash['entries' => size], 100) do |i|
+            v = vertices[i % size]
+            queue.push(random.rand * size, v, i)
+            queue.delete_first_for(v, -1)
+        end
+    end
+end
@@ -0,0 +1,22 @@
+NativeBenchmark.group 'roby_marshalling' do |suite|
+    require 'drb'
+    require 'set'
+    require 'value_set'
+    require 'roby_marshalling'
+
+    # Payloads shaped like the ones of the log and of the distributed
+    # protocol: flat arrays of immediates and strings, the argument hashes of
+    # tasks, and nested containers
+    suite.sizes.each do |size|
+        params = Hash['size' => size]
+        array  = (1..size).map { |i| i.even? ? i : "value#{i}" }
+        hash   = Hash[*(1..size).map { |i| [:"key#{i}", i.to_f] }.flatten]
+        nested = (1..(size / 10)).map { |i| [i, [:symbol, "string", { :a => i }]] }
+        value_set = (1..size).map { |i| :"symbol#{i}" }.to_value_set
+
+        suite.measure('array', params, 10) { array.droby_dump(nil) }
+        suite.measure('hash', params, 10) { hash.droby_dump(nil) }
+        suite.measure('nested', params, 10) { nested.droby_dump(nil) }
+        suite.measure('value_set', params, 10) { value_set.droby_dump(nil) }
+    end
+end
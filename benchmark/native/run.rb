@@ -0,0 +1,38 @@
+#! /usr/bin/env ruby
+#
+# Runs the microbenchmarks of the C extensions and outputs the results as
+# JSON. Run it with no arguments to run all groups (roby_bgl, value_set and
+# roby_marshalling), or give the names of the groups to run.
+require 'optparse'
+$LOAD_PATH.unshift File.expand_path('../../lib', File.dirname(__FILE__))
+require File.expand_path('harness', File.dirname(__FILE__))
+%w{roby_bgl value_set roby_marshalling}.each do |group|
+    require File.expand_path(group, File.dirname(__FILE__))
+end
+
+options = Hash.new
+output  = nil
+parser = OptionParser.new do |opt|
+    opt.banner = "run.rb [options] [group ...]"
+    opt.on('--warmup=COUNT', Integer, 'unmeasured runs before the measurements (default: 3)') do |count|
+        options[:warmup] = count
+    end
+    opt.on('--repetitions=COUNT', Integer, 'measured runs (default: 20)') do |count|
+        options[:repetitions] = count
+    end
+    opt.on('--sizes=LIST', Array, 'comma-separated problem sizes (default: 100,1000,10000)') do |sizes|
+        options[:sizes] = sizes.map { |s| Integer(s) }
+    end
+    opt.on('--output=FILE', 'write the JSON results to FILE instead of the standard output') do |file|
+        output = file
+    end
+end
+groups = parser.parse(ARGV)
+
+suite = NativeBenchmark::Suite.new(options).run(groups)
+json  = JSON.pretty_generate(suite)
+if output
+    File.open(output, 'w') { |io| io.puts json }
+else
+    puts json
+end
@@ -0,0 +1,18 @@
+NativeBenchmark.group 'value_set' do |suite|
+    require 'value_set'
+
+    suite.sizes.each do |size|
+        # Two sets that overlap by half
+        values = (1..(size + size / 2)).map { Object.new }
+        a = values[0, size].to_value_set
+        b = values[size / 2, size].to_value_set
+        params = Hash['size' => size]
+
+        suite.measure('to_value_set', params, 10) { values.to_value_set }
+        suite.measure('union', params, 10) { a.union(b) }
+        suite.measure('intersection', params, 10) { a.intersection(b) }
+        suite.measure('difference', params, 10) { a.difference(b) }
+        suite.measure('include?', params, 1000) { |i| a.include?(values[i % values.size]) }
+        suite.measure('merge', params, 10) { a.dup.merge(b) }
+    end
+end
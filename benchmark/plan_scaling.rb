@@ -0,0 +1,118 @@
+#! /usr/bin/env ruby
+#
+# Measures how the execution cycle scales with the plan size. For each plan
+# shape and size, it generates a plan with SyntheticPlans, then runs a few
+# cycles of ExecutionEngine#process_events (event propagation, structure
+# checks, garbage collection) and reports, per cycle, the time spent in each
+# phase and the count of allocated objects.
+#
+# The results are output as JSON: one entry per (shape, size) pair, so that
+# each shape gives a curve of the phase durations against the plan size. A
+# summary table is printed on the standard error.
+require 'optparse'
+require 'json'
+require_relative 'synthetic_plans'
+
+# The stats hash given to process_events. ExecutionEngine#add_timepoint
+# stores in it the time elapsed since the start of the cycle. This records
+# instead the time spent since the previous timepoint, summed per timepoint
+# name, which is the duration of the phase that ends at the timepoint
+class PhaseTimes < Hash
+    attr_reader :durations
+
+    def initialize(start)
+        super()
+        self[:start] = start
+        @durations = Hash.new(0)
+        @last = 0
+    end
+
+    def []=(key, value)
+        if key != :end && value.kind_of?(Float)
+            durations[key] += value - @last
+            @last = value
+        end
+        super
+    end
+end
+
+sizes  = [100, 1_000, 10_000, 100_000]
+shapes = SyntheticPlans::SHAPES
+cycles = 10
+output = nil
+progress = nil
+parser = OptionParser.new do |opt|
+    opt.banner = "plan_scaling.rb [options]"
+    opt.on('--sizes=LIST', Array, "comma-separated plan sizes (default: #{sizes.join(",")})") do |list|
+        sizes = list.map { |s| Integer(s) }
+    end
+    opt.on('--shapes=LIST', Array, "comma-separated plan shapes (default: #{shapes.join(",")})") do |list|
+        shapes = list.map(&:to_sym)
+    end
+    opt.on('--cycles=COUNT', Integer, "measured cycles per plan (default: #{cycles})") do |count|
+        cycles = count
+    end
+    opt.on('--progress=COUNT', Integer, "progress events emitted per cycle (default: 1% of the plan)") do |count|
+        progress = count
+    end
+    opt.on('--output=FILE', 'write the JSON results to FILE instead of the standard output') do |file|
+        output = file
+    end
+end
+parser.parse(ARGV)
+
+results = Array.new
+shapes.each do |shape|
+    sizes.each do |size|
+        plan   = Roby::Plan.new
+        engine = Roby::ExecutionEngine.new(plan)
+        random = Random.new(0)
+
+        start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        tasks = SyntheticPlans.generate(plan, size, :shape => shape)
+        generation_time = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+        progress_count = progress || [size / 100, 1].max
+
+        samples = (1..cycles).map do
+            engine.once { SyntheticPlans.emit_progress(tasks, progress_count, random) }
+            stats = PhaseTimes.new(Time.now)
+            allocated = GC.stat(:total_allocated_objects)
+            start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+            engine.process_events(stats)
+            Hash['total' => Process.clock_gettime(Process::CLOCK_MONOTONIC) - start,
+                'allocations' => GC.stat(:total_allocated_objects) - allocated,
+                'phases' => stats.durations]
+        end
+
+        phases = samples.inject(Hash.new(0)) do |sum, s|
+            s['phases'].each { |name, duration| sum[name.to_s] += duration / cycles }
+            sum
+        end
+        totals = samples.map { |s| s['total'] }.sort
+        results << Hash[
+            'shape' => shape.to_s,
+            'tasks' => size,
+            'plan_tasks' => plan.known_tasks.size,
+            'running_tasks' => tasks.count { |t| t.running? },
+            'generation_time' => generation_time,
+            'cycles' => cycles,
+            'cycle_mean' => totals.inject(0, :+) / cycles,
+            'cycle_max' => totals.last,
+            'allocations_mean' => samples.inject(0) { |sum, s| sum + s['allocations'] } / cycles,
+            'phases_mean' => phases]
+
+        r = results.last
+        STDERR.puts format("%-6s %8d tasks: cycle %9.3f ms (max %9.3f ms), %9d allocations/cycle, %s",
+            shape, size, r['cycle_mean'] * 1000, r['cycle_max'] * 1000, r['allocations_mean'],
+            phases.map { |name, d| format("%s=%.3fms", name, d * 1000) }.join(" "))
+
+        plan.clear
+    end
+end
+
+json = JSON.pretty_generate(Hash['ruby' => RUBY_DESCRIPTION, 'results' => results])
+if output
+    File.open(output, 'w') { |io| io.puts json }
+else
+    puts json
+end
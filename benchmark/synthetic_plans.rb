@@ -0,0 +1,115 @@
+require 'roby'
+
+# Generators of synthetic plans of controlled size and shape, for the
+# benchmarks that need plans that look like the ones of real applications
+module SyntheticPlans
+    # The task model of the generated plans. The progress event is forwarded
+    # from children to parents to give work to the event propagation
+    class Task < Roby::Tasks::Simple
+        event :progress, :command => true
+    end
+
+    # The shapes of the dependency structure:
+    # deep:: long chains of tasks, with a new chain starting every
+    #   +chain_length+ tasks from a random task of the plan
+    # wide:: a few hubs with a very large fan-out
+    # tree:: a complete tree whose branching factor is +fanout+
+    SHAPES = [:deep, :wide, :tree]
+
+    DEFAULTS = Hash[
+        :shape => :tree,
+        :fanout => 4,
+        :chain_length => 50,
+        :forwardings => 0.5,
+        :temporal_constraints => 0.1,
+        :running => 0.3,
+        :finished => 0.2,
+        :seed => 42]
+
+    # Returns the index of the parent of the task +i+ for the given shape
+    def self.parent_index(i, options, random)
+        case options[:shape]
+        when :deep
+            if i % options[:chain_length] == 0 then random.rand(i)
+            else i - 1
+            end
+        when :wide
+            random.rand([i, 8].min)
+        when :tree
+            (i - 1) / options[:fanout]
+        else
+            raise ArgumentError, "unknown plan shape #{options[:shape]}, known shapes are #{SHAPES.join(", ")}"
+        end
+    end
+
+    # Adds +task_count+ tasks to +plan+, which must have an execution engine.
+    # The first task is a mission and all the others depend on it
+    # (indirectly). The options are:
+    #
+    # shape:: the shape of the dependency structure, see SHAPES
+    # fanout:: the branching factor of the tree shape
+    # chain_length:: the length of the chains in the deep shape
+    # forwardings:: the ratio of the dependency edges along which the progress
+    #   event is forwarded
+    # temporal_constraints:: the ratio of pending tasks whose start is
+    #   temporally constrained by the start of their pending parent
+    # running:: the probability that a task whose parent runs gets started
+    # finished:: the probability that a started leaf gets finished
+    # seed:: the seed of the random generator, so that the generated plans
+    #   are reproducible
+    #
+    # Returns the tasks, in creation order
+    def self.generate(plan, task_count, options = Hash.new)
+        options = DEFAULTS.merge(options)
+        random  = Random.new(options[:seed])
+
+        tasks = (1..task_count).map { Task.new }
+        plan.add_mission(tasks.first)
+        parents = Array.new(task_count)
+        tasks.each_with_index do |task, i|
+            next if i == 0
+            parent = tasks[parents[i] = parent_index(i, options, random)]
+            # The children have no success or failure conditions, so that
+            # the finished ones stay in the plan and do not generate errors
+            parent.depends_on task, :success => nil, :failure => nil, :remove_when_done => false
+            if random.rand < options[:forwardings]
+                task.progress_event.forward_to parent.progress_event
+            end
+        end
+
+        # Decide on the states. A task can only run if its parent runs, and
+        # only leaves get finished so that no running task has a finished
+        # parent
+        is_running = Array.new(task_count, false)
+        is_running[0] = true
+        finished = Array.new
+        tasks.each_with_index do |task, i|
+            next if i == 0 || !is_running[parents[i]] || random.rand >= options[:running]
+            is_running[i] = true
+            if task.leaf?(Roby::TaskStructure::Dependency) && random.rand < options[:finished]
+                finished << task
+            end
+        end
+
+        tasks.each_with_index do |task, i|
+            next if i == 0 || is_running[i] || is_running[parents[i]]
+            if random.rand < options[:temporal_constraints]
+                task.start_event.should_emit_after tasks[parents[i]].start_event, :min_t => 0, :max_t => 3600
+            end
+        end
+
+        running = tasks.find_all.with_index { |_, i| is_running[i] }
+        engine = plan.engine
+        engine.process_events_synchronous { running.each { |t| t.start_event.call } }
+        engine.process_events_synchronous { finished.each { |t| t.success_event.call } }
+        tasks
+    end
+
+    # Calls the progress command of +count+ running tasks, chosen at random
+    def self.emit_progress(tasks, count, random)
+        running = tasks.find_all { |t| t.running? }
+        running.sample(count, :random => random).each do |t|
+            t.progress_event.call
+        end
+    end
+end
@@ -6,11 +6,15 @@
 #include <boost/iterator/filter_iterator.hpp>
 #include <boost/graph/connected_components.hpp>
 #include <boost/graph/topological_sort.hpp>
+#include <boost/graph/strong_components.hpp>
 #include <boost/bind.hpp>
 #include <boost/graph/reverse_graph.hpp>
 #include "undirected_graph.hh"
 #include "undirected_dfs.hh"
+#include "thread_pool.hh"
 #include <queue>
+#include <stack>
+#include <deque>
 #include <functional>
 
 #include "reverse_graph_bug_boost148_workaround.inl"
@@ -117,16 +121,18 @@ public:
 
 typedef list<vertex_descriptor> vertex_list;
 
+/* Records the discovered vertices. It does not access Ruby so that it can be
+ * used without the GVL */
 struct vertex_recorder : public default_dfs_visitor
 {
 public:
-    ValueSet&  component;
-    vertex_recorder( ValueSet& component )
+    std::vector<vertex_descriptor>&  component;
+    vertex_recorder( std::vector<vertex_descriptor>& component )
 	: component(component) { }
 
     template<typename G>
     void discover_vertex(vertex_descriptor u, G const& g)
-    { component.insert(g[u]); }
+    { component.push_back(u); }
 };
 
 
@@ -140,6 +146,19 @@ static ValueSet& rb_to_set(VALUE object)
     return *result_set;
 }
 
+/** Converts an array of BGL::Graph objects into a list of VALUE */
+static void rb_to_graph_list(std::vector<VALUE>& result, VALUE graphs)
+{
+    graphs = rb_convert_type(graphs, T_ARRAY, "Array", "to_ary");
+    for (long i = 0; i < RARRAY_LEN(graphs); ++i)
+    {
+	VALUE g = rb_ary_entry(graphs, i);
+	if (!RTEST(rb_obj_is_kind_of(g, bglGraph)))
+	    rb_raise(rb_eArgError, "expected a list of BGL::Graph objects");
+	result.push_back(g);
+    }
+}
+
 /** Converts a std::set<VALUE> into a ValueSet object 
  * After this method, +source+ is empty */
 static VALUE set_to_rb(ValueSet& source)
@@ -152,52 +171,49 @@ static VALUE set_to_rb(ValueSet& source)
     return result;
 }
 
-/* Adds in +result+ all components generated by the items in [it, end). We 
- * assume that there is no component which includes more than one item in
- * [it, end) */
-template<typename Graph, typename Iterator>
-static void graph_components_i(std::list<ValueSet>& result, Graph const& g, Iterator it, Iterator end, bool include_singletons)
+/* The traversal phase of Graph#generated_subgraphs. It computes the
+ * components generated by each seed that has not been reached from a
+ * previous seed, and is run without the GVL */
+template<typename Graph>
+struct GeneratedSubgraphsTraversal
 {
-    ColorMap   colors;
+    typedef std::vector<vertex_descriptor> Component;
 
-    result.push_front(ValueSet());
-    for (; it != end; ++it)
-    {
-	if (0 == *it) // elements not in +g+  are handled by graph_result_root_descriptor
-	    continue;
-	if (colors[*it] != color_traits<default_color_type>::white())
-	    continue;
+    Graph const& graph;
+    bool use_roots;
+    bool include_singletons;
+    std::vector<vertex_descriptor> seeds;
+    std::list<Component> components;
 
-	ValueSet& component(*result.begin());
-	depth_first_visit(g, *it, vertex_recorder(component), make_assoc_property_map(colors));
-	if (component.size() > 1 || include_singletons)
-	    result.push_front(ValueSet());
-	else
-	    component.clear();
-    }
-    result.pop_front();
-}
+    GeneratedSubgraphsTraversal(Graph const& graph, bool include_singletons)
+	: graph(graph), use_roots(false), include_singletons(include_singletons) {}
 
-/** If +v+ is found in +g+, returns the corresponding vertex_descriptor. Otherwise,
- * add a singleton component to +result+ and return NULL.
- */
-static vertex_descriptor graph_components_root_descriptor(std::list<ValueSet>& result, VALUE v, VALUE g, bool include_singletons)
-{
-    vertex_descriptor d;
-    bool exists;
-    tie(d, exists) = rb_to_vertex(v, g);
-    if (! exists)
+    void operator()()
     {
-	if (include_singletons)
+	if (use_roots)
+	{
+	    typename graph_traits<Graph>::vertex_iterator it, end;
+	    for (tie(it, end) = vertices(graph); it != end; ++it)
+	    {
+		if (vertex_has_adjacent_i<Graph, false>(*it, graph))
+		    seeds.push_back(*it);
+	    }
+	}
+
+	ColorMap colors;
+	for (std::vector<vertex_descriptor>::const_iterator it = seeds.begin(); it != seeds.end(); ++it)
 	{
-	    ValueSet component;
-	    component.insert(v);
-	    result.push_back(component);
+	    if (colors[*it] != color_traits<default_color_type>::white())
+		continue;
+
+	    components.push_front(Component());
+	    depth_first_visit(graph, *it, vertex_recorder(components.front()), make_assoc_property_map(colors));
+	    if (components.front().size() == 1 && !include_singletons)
+		components.pop_front();
 	}
-	return NULL;
     }
-    return d;
-}
+};
+
 template<typename Graph>
 static VALUE graph_do_generated_subgraphs(int argc, VALUE* argv, Graph const& g, VALUE self)
 {
@@ -206,51 +222,68 @@ static VALUE graph_do_generated_subgraphs(int argc, VALUE* argv, Graph const& g,
 	include_singletons = Qtrue;
 
     bool with_singletons = RTEST(include_singletons) ? true : false;
-    std::list<ValueSet> result;
+    GeneratedSubgraphsTraversal<Graph> traversal(g, with_singletons);
+
+    // The seeds that are not in the graph are singleton components
+    std::list<VALUE> singletons;
     if (NIL_P(roots))
-    {
-	RubyGraph::vertex_iterator it, end;
-	tie(it, end) = vertices(g);
-	// call graph_components_i with all root vertices
-	// in +graph+
-	graph_components_i(result, g, 
-		make_filter_iterator(
-		    bind(
-			vertex_has_adjacent_i<Graph, false>, 
-			_1, boost::ref(g)
-		    ), it, end
-		),
-		make_filter_iterator(
-		    bind(
-			vertex_has_adjacent_i<Graph, false>, 
-			_1, boost::ref(g)
-		    ), end, end
-		), with_singletons
-	    );
-    }
+	traversal.use_roots = true;
     else
     {
 	ValueSet& root_set = rb_to_set(roots);
-	ValueSet::const_iterator 
-	    begin = root_set.begin(),
-	    end   = root_set.end();
-
-	// call graph_components_i with all vertices given in as argument
-	graph_components_i(result, g, 
-		make_transform_iterator(begin, 
-		    bind(graph_components_root_descriptor, boost::ref(result), _1, self, with_singletons)
-		),
-		make_transform_iterator(end,
-		    bind(graph_components_root_descriptor, boost::ref(result), _1, self, with_singletons)
-		), with_singletons);
+	for (ValueSet::const_iterator it = root_set.begin(); it != root_set.end(); ++it)
+	{
+	    vertex_descriptor d; bool exists;
+	    tie(d, exists) = rb_to_vertex(*it, self);
+	    if (exists)
+		traversal.seeds.push_back(d);
+	    else if (with_singletons)
+		singletons.push_back(*it);
+	}
     }
 
+    graph_call_without_gvl(graph_wrapped(self), traversal);
+
     // Now convert the result into a Ruby array
     VALUE rb_result = rb_ary_new();
-    for (std::list<ValueSet>::iterator it = result.begin(); it != result.end(); ++it)
-	rb_ary_push(rb_result, set_to_rb(*it));
+    typedef typename GeneratedSubgraphsTraversal<Graph>::Component Component;
+    for (typename std::list<Component>::const_iterator it = traversal.components.begin(); it != traversal.components.end(); ++it)
+    {
+	ValueSet component;
+	for (typename Component::const_iterator v = it->begin(); v != it->end(); ++v)
+	    component.insert(g[*v]);
+	rb_ary_push(rb_result, set_to_rb(component));
+    }
+    for (std::list<VALUE>::const_iterator it = singletons.begin(); it != singletons.end(); ++it)
+    {
+	ValueSet component;
+	component.insert(*it);
+	rb_ary_push(rb_result, set_to_rb(component));
+    }
     return rb_result;
 }
+
+/* The traversal phase of Graph#components, run without the GVL */
+struct ConnectedComponentsTraversal
+{
+    typedef std::map<vertex_descriptor, int> ComponentMap;
+
+    RubyGraph const& graph;
+    ComponentMap component_map;
+    int count;
+
+    ConnectedComponentsTraversal(RubyGraph const& graph)
+	: graph(graph), count(0) {}
+
+    void operator()()
+    {
+	ColorMap color_map;
+	count = connected_components(utilmm::make_undirected_graph(graph),
+		make_assoc_property_map(component_map), 
+		boost::color_map( make_assoc_property_map(color_map) ));
+    }
+};
+
 /*
  * call-seq:
  *   graph.components(seeds = nil, include_singletons = true)	=> components
@@ -271,14 +304,13 @@ static VALUE graph_components(int argc, VALUE* argv, VALUE self)
 	include_singletons = Qtrue;
 
     // Compute the connected components
-    RubyGraph const& g = graph_wrapped(self);
+    RubyGraph& g = graph_wrapped(self);
+    ConnectedComponentsTraversal traversal(g);
+    graph_call_without_gvl(g, traversal);
 
-    typedef std::map<vertex_descriptor, int> ComponentMap;
-    ComponentMap component_map;
-    ColorMap	 color_map;
-    int count = connected_components(utilmm::make_undirected_graph(g),
-	    make_assoc_property_map(component_map), 
-	    boost::color_map( make_assoc_property_map(color_map) ));
+    typedef ConnectedComponentsTraversal::ComponentMap ComponentMap;
+    ComponentMap& component_map = traversal.component_map;
+    int count = traversal.count;
 
     VALUE ret = rb_ary_new2(count);
     std::vector<bool>  enabled_components;
@@ -374,6 +406,119 @@ static VALUE graph_reverse_generated_subgraphs(int argc, VALUE* argv, VALUE self
     return graph_do_generated_subgraphs(argc, argv, make_reverse_graph(graph_wrapped(real_graph)), real_graph); 
 }
 
+typedef std::map<VALUE, VALUE> shadow_map;
+
+/* The traversal of Graph#overlay_generated_subgraphs. +shadows+ maps the
+ * shadowed base vertices to their overlay vertex, and +shadowed+ is the
+ * reverse mapping */
+static void overlay_generated_subgraphs_i(VALUE self, RubyGraph const& graph,
+	ValueSet const& base_seeds, ValueSet const& overlay_seeds,
+	shadow_map const& shadows, shadow_map const& shadowed,
+	ValueSet& base_set, ValueSet& overlay_set)
+{
+    // The boolean is true for the overlay vertices
+    std::vector< std::pair<VALUE, bool> > stack;
+    for (ValueSet::const_iterator it = base_seeds.begin(); it != base_seeds.end(); ++it)
+	stack.push_back(make_pair(*it, false));
+    for (ValueSet::const_iterator it = overlay_seeds.begin(); it != overlay_seeds.end(); ++it)
+	stack.push_back(make_pair(*it, true));
+
+    while (!stack.empty())
+    {
+	VALUE vertex = stack.back().first;
+	bool overlay = stack.back().second;
+	stack.pop_back();
+	if (!(overlay ? overlay_set : base_set).insert(vertex).second)
+	    continue;
+
+	vertex_descriptor v; bool exists;
+	tie(v, exists) = rb_to_vertex(vertex, self);
+	if (exists)
+	{
+	    RubyGraph::adjacency_iterator it, end;
+	    for (tie(it, end) = adjacent_vertices(v, graph); it != end; ++it)
+	    {
+		VALUE child = graph[*it];
+		if (overlay)
+		    stack.push_back(make_pair(child, true));
+		else
+		{
+		    // The base branches that are shadowed must be developed in
+		    // the overlay
+		    shadow_map::const_iterator shadow = shadows.find(child);
+		    if (shadow == shadows.end())
+			stack.push_back(make_pair(child, false));
+		    else
+			stack.push_back(make_pair(shadow->second, true));
+		}
+	    }
+	}
+
+	if (!overlay)
+	    continue;
+
+	// Follow the base edges of the vertex the overlay vertex shadows, to
+	// the base vertices that are not shadowed. The edges between two
+	// shadowed vertices are defined by the overlay.
+	shadow_map::const_iterator base = shadowed.find(vertex);
+	if (base == shadowed.end())
+	    continue;
+	tie(v, exists) = rb_to_vertex(base->second, self);
+	if (!exists)
+	    continue;
+	RubyGraph::adjacency_iterator it, end;
+	for (tie(it, end) = adjacent_vertices(v, graph); it != end; ++it)
+	{
+	    VALUE child = graph[*it];
+	    if (shadows.find(child) == shadows.end())
+		stack.push_back(make_pair(child, false));
+	}
+    }
+}
+
+/* call-seq:
+ *   graph.overlay_generated_subgraphs(base_seeds, overlay_seeds, shadows) => [base_set, overlay_set]
+ *
+ * Computes in one traversal the component generated by +base_seeds+ and
+ * +overlay_seeds+ in the merged view of a base graph and an overlay that
+ * lives in the same graph. +shadows+ is a hash that maps the base vertices
+ * that are represented in the overlay to their overlay vertex (for
+ * instance, the proxies of a transaction):
+ *
+ * * the edges of the overlay vertices are followed in the overlay
+ * * the edges of the base vertices are followed in the base, but the
+ *   traversal switches to the overlay when it reaches a shadowed vertex
+ * * the base edges of the vertex an overlay vertex shadows are followed to
+ *   the base vertices that are not shadowed.
+ *
+ * +base_seeds+ and +overlay_seeds+ are ValueSet objects. The method returns
+ * the base and overlay vertices of the component as two ValueSet objects.
+ */
+static VALUE graph_overlay_generated_subgraphs(VALUE self, VALUE base_seeds, VALUE overlay_seeds, VALUE rb_shadows)
+{
+    RubyGraph& graph = graph_wrapped(self);
+    ValueSet const& base_seed_set    = rb_to_set(base_seeds);
+    ValueSet const& overlay_seed_set = rb_to_set(overlay_seeds);
+    VALUE pairs = rb_funcall(rb_shadows, rb_intern("to_a"), 0);
+    VALUE result = rb_ary_new();
+
+    shadow_map shadows, shadowed;
+    for (long i = 0; i < RARRAY_LEN(pairs); ++i)
+    {
+	VALUE pair = rb_ary_entry(pairs, i);
+	VALUE base = rb_ary_entry(pair, 0), overlay = rb_ary_entry(pair, 1);
+	shadows[base] = overlay;
+	shadowed[overlay] = base;
+    }
+
+    ValueSet base_set, overlay_set;
+    overlay_generated_subgraphs_i(self, graph, base_seed_set, overlay_seed_set,
+	    shadows, shadowed, base_set, overlay_set);
+    rb_ary_push(result, set_to_rb(base_set));
+    rb_ary_push(result, set_to_rb(overlay_set));
+    return result;
+}
+
 static const int VISIT_TREE_EDGES = 1;
 static const int VISIT_BACK_EDGES = 2;
 static const int VISIT_FORWARD_OR_CROSS_EDGES = 4;
@@ -554,6 +699,24 @@ struct ruby_reachable_terminator
     bool operator()(vertex_descriptor u, G const& g) const { return found; }
 };
 
+/* The traversal phase of Graph#reachable?, run without the GVL */
+struct ReachabilityTraversal
+{
+    RubyGraph& graph;
+    vertex_descriptor source, target;
+    bool found;
+
+    ReachabilityTraversal(RubyGraph& graph, vertex_descriptor source, vertex_descriptor target)
+	: graph(graph), source(source), target(target), found(false) {}
+
+    void operator()()
+    {
+	map<vertex_descriptor, default_color_type> colors;
+	depth_first_visit(graph, source, ruby_reachable_visitor(found, target), 
+		make_assoc_property_map(colors), ruby_reachable_terminator(found));
+    }
+};
+
 /* call-seq:
  *  graph.reachable?(v1, v2)
  *
@@ -570,12 +733,9 @@ VALUE graph_reachable_p(VALUE self, VALUE source, VALUE target)
     if (! exists)
 	return Qfalse;
 
-    map<vertex_descriptor, default_color_type> colors;
-    bool found;
-    depth_first_visit(graph, s, ruby_reachable_visitor(found, t), 
-	    make_assoc_property_map(colors), ruby_reachable_terminator(found));
-
-    return found;
+    ReachabilityTraversal traversal(graph, s, t);
+    graph_call_without_gvl(graph, traversal);
+    return traversal.found ? Qtrue : Qfalse;
 }
 
 
@@ -666,6 +826,28 @@ static VALUE graph_undirected_each_bfs(VALUE self, VALUE root, VALUE mode)
     return graph_each_bfs(real_graph, utilmm::make_undirected_graph(graph), root, mode);
 }
 
+/* The sorting phase of Graph#topological_sort, run without the GVL */
+struct TopologicalSortTraversal
+{
+    RubyGraph& graph;
+    std::vector<vertex_descriptor> result;
+    bool is_dag;
+
+    TopologicalSortTraversal(RubyGraph& graph)
+	: graph(graph), is_dag(true) {}
+
+    void operator()()
+    {
+	map<vertex_descriptor, default_color_type> colors;
+	try
+	{
+	    topological_sort(graph, std::back_inserter(result), 
+		    boost::color_map(make_assoc_property_map(colors)));
+	}
+	catch(boost::not_a_dag const&) { is_dag = false; }
+    }
+};
+
 /* call-seq:
  *  graph.topological_sort => array
  *
@@ -681,21 +863,603 @@ static VALUE graph_topological_sort(int argc, VALUE* argv, VALUE self)
 	rb_ary_clear(rb_result);
 
     RubyGraph& graph = graph_wrapped(self);
-    typedef std::vector<RubyGraph::vertex_descriptor> Result;
-    Result result;
+    bool is_dag;
+    {
+	TopologicalSortTraversal traversal(graph);
+	graph_call_without_gvl(graph, traversal);
+	is_dag = traversal.is_dag;
+	if (is_dag)
+	{
+	    for (int i = traversal.result.size() - 1; i >= 0; --i)
+		rb_ary_push(rb_result, graph[traversal.result[i]]);
+	}
+    }
 
-    map<vertex_descriptor, default_color_type> colors;
-    try
+    if (!is_dag)
+	rb_raise(rb_eArgError, "the graph is not a DAG");
+    return rb_result;
+}
+
+/* call-seq:
+ *   graph.strongly_connected_components(include_singletons = true) => components
+ *
+ * Returns an array of vertex arrays. Each array is a strongly connected
+ * component of +graph+, i.e. a maximal set of vertices in which each vertex
+ * can be reached from all the others. If +include_singletons+ is false, the
+ * components made of only one vertex (i.e. the vertices that are not part of
+ * any cycle) are not returned.
+ */
+static VALUE graph_strongly_connected_components(int argc, VALUE* argv, VALUE self)
+{
+    VALUE include_singletons = Qtrue;
+    rb_scan_args(argc, argv, "01", &include_singletons);
+    if (argc == 0)
+	include_singletons = Qtrue;
+
+    RubyGraph& graph = graph_wrapped(self);
+
+    typedef std::map<vertex_descriptor, int> ComponentMap;
+    typedef std::map<vertex_descriptor, vertex_descriptor> RootMap;
+    typedef std::map<vertex_descriptor, int> TimeMap;
+    ComponentMap component_map;
+    RootMap  roots;
+    TimeMap  discover_times;
+    ColorMap colors;
+    // Run Tarjan's visitor through the positional depth_first_search
+    // overload. The named-parameter form of strong_components goes through
+    // the boost::parameter keywords, whose relocations make the extension
+    // link with warnings
+    typedef std::stack<vertex_descriptor> Stack;
+    typedef detail::tarjan_scc_visitor< associative_property_map<ComponentMap>,
+	    associative_property_map<RootMap>, associative_property_map<TimeMap>,
+	    Stack > SCCVisitor;
+    Stack stack;
+    int count = 0;
+    SCCVisitor visitor(make_assoc_property_map(component_map),
+	    make_assoc_property_map(roots), make_assoc_property_map(discover_times),
+	    count, stack);
+    depth_first_search(graph, visitor, make_assoc_property_map(colors));
+
+    std::vector<VALUE> components(count);
+    for (int i = 0; i < count; ++i)
+	components[i] = rb_ary_new();
+    for (ComponentMap::const_iterator it = component_map.begin(); it != component_map.end(); ++it)
+	rb_ary_push(components[it->second], graph[it->first]);
+
+    VALUE ret = rb_ary_new2(count);
+    for (int i = 0; i < count; ++i)
+    {
+	if (RTEST(include_singletons) || RARRAY_LEN(components[i]) > 1)
+	    rb_ary_push(ret, components[i]);
+    }
+    return ret;
+}
+
+/* One step of the depth-first search done in find_cycle. +out_edges+ is the
+ * list of (target, graph) pairs that still have to be visited from +vertex+,
+ * and +graph+ the graph in which the edge that led to +vertex+ is
+ */
+struct CycleSearchFrame
+{
+    VALUE vertex;
+    VALUE graph;
+    std::vector< std::pair<VALUE, VALUE> > out_edges;
+    size_t next;
+
+    CycleSearchFrame(VALUE vertex, VALUE graph)
+	: vertex(vertex), graph(graph), next(0) {}
+};
+
+/* Fills +frame.out_edges+ with the out-edges of +frame.vertex+ in the union
+ * of +graphs+. If +within+ is non-NULL, only the edges whose target is in
+ * +within+ are considered. The edges whose target has one of the
+ * +ignored_flags+ set are ignored.
+ */
+static void cycle_search_out_edges(CycleSearchFrame& frame, std::vector<VALUE> const& graphs, ValueSet const* within, int ignored_flags)
+{
+    for (std::vector<VALUE>::const_iterator g = graphs.begin(); g != graphs.end(); ++g)
     {
-	topological_sort(graph, std::back_inserter(result), 
-		boost::color_map(make_assoc_property_map(colors)));
+	vertex_descriptor v; bool exists;
+	tie(v, exists) = rb_to_vertex(frame.vertex, *g);
+	if (! exists)
+	    continue;
 
-	for (int i = result.size() - 1; i >= 0; --i)
-	    rb_ary_push(rb_result, graph[result[i]]);
-	return rb_result;
+	RubyGraph& graph = graph_wrapped(*g);
+	RubyGraph::adjacency_iterator it, end;
+	for (tie(it, end) = adjacent_vertices(v, graph); it != end; ++it)
+	{
+	    VALUE target = graph[*it];
+	    if (within && within->find(target) == within->end())
+		continue;
+	    if (ignored_flags && (vertex_flags(target) & ignored_flags))
+		continue;
+	    frame.out_edges.push_back(make_pair(target, *g));
+	}
     }
-    catch(boost::not_a_dag) {}
-    rb_raise(rb_eArgError, "the graph is not a DAG");
+}
+
+/* Does a depth-first search in the union of +graphs+, starting at each of the
+ * vertices in +seeds+, and stops at the first cycle found. The cycle is
+ * returned as an array of [source, target, graph] edges, or nil if there are
+ * none.
+ */
+static VALUE find_cycle_i(std::vector<VALUE> const& graphs, ValueSet const& seeds, ValueSet const* within, int ignored_flags)
+{
+    enum { IN_PATH = 1, DONE = 2 };
+    std::map<VALUE, int> state;
+    std::vector<CycleSearchFrame> path;
+
+    for (ValueSet::const_iterator seed = seeds.begin(); seed != seeds.end(); ++seed)
+    {
+	if (state[*seed] != 0)
+	    continue;
+	if (within && within->find(*seed) == within->end())
+	    continue;
+	if (ignored_flags && (vertex_flags(*seed) & ignored_flags))
+	    continue;
+
+	path.push_back(CycleSearchFrame(*seed, Qnil));
+	cycle_search_out_edges(path.back(), graphs, within, ignored_flags);
+	state[*seed] = IN_PATH;
+	while (! path.empty())
+	{
+	    CycleSearchFrame& frame = path.back();
+	    if (frame.next == frame.out_edges.size())
+	    {
+		state[frame.vertex] = DONE;
+		path.pop_back();
+		continue;
+	    }
+
+	    VALUE target, graph;
+	    tie(target, graph) = frame.out_edges[frame.next++];
+	    int& target_state = state[target];
+	    if (target_state == DONE)
+		continue;
+	    else if (target_state == IN_PATH)
+	    {
+		// Found a back edge, the cycle is the part of the path that
+		// starts at +target+
+		size_t start = path.size() - 1;
+		while (path[start].vertex != target)
+		    --start;
+
+		VALUE result = rb_ary_new();
+		for (size_t i = start + 1; i < path.size(); ++i)
+		    rb_ary_push(result, rb_ary_new3(3, path[i - 1].vertex, path[i].vertex, path[i].graph));
+		rb_ary_push(result, rb_ary_new3(3, path.back().vertex, target, graph));
+		return result;
+	    }
+
+	    target_state = IN_PATH;
+	    path.push_back(CycleSearchFrame(target, graph));
+	    cycle_search_out_edges(path.back(), graphs, within, ignored_flags);
+	}
+    }
+    return Qnil;
+}
+
+/* call-seq:
+ *   graph.find_cycle(seeds, within = nil, ignored_flags = 0) => [[source, target, graph], ...] or nil
+ *
+ * Looks for a cycle that can be reached from the vertices in +seeds+. If
+ * +within+ is given, only the vertices in this set are considered (i.e. the
+ * search is done in the subgraph of +graph+ induced by +within+). The
+ * vertices that have one of +ignored_flags+ set are ignored as well.
+ *
+ * Returns the cycle as an array of edges, or nil if there are none
+ */
+static VALUE graph_find_cycle(int argc, VALUE* argv, VALUE self)
+{
+    VALUE seeds, within = Qnil, ignored_flags = Qnil;
+    rb_scan_args(argc, argv, "12", &seeds, &within, &ignored_flags);
+
+    std::vector<VALUE> graphs(1, self);
+    return find_cycle_i(graphs, rb_to_set(seeds), NIL_P(within) ? NULL : &rb_to_set(within),
+	    NIL_P(ignored_flags) ? 0 : NUM2INT(ignored_flags));
+}
+
+/* call-seq:
+ *   BGL::Graph.find_cycle(graphs, seeds, within = nil, ignored_flags = 0) => [[source, target, graph], ...] or nil
+ *
+ * Like Graph#find_cycle, but looks for a cycle in the union of all the graphs
+ * listed in +graphs+. The graph in which each edge of the cycle is can be
+ * found in the third element of each edge.
+ */
+static VALUE graph_s_find_cycle(int argc, VALUE* argv, VALUE self)
+{
+    VALUE rb_graphs, seeds, within = Qnil, ignored_flags = Qnil;
+    rb_scan_args(argc, argv, "22", &rb_graphs, &seeds, &within, &ignored_flags);
+
+    std::vector<VALUE> graphs;
+    rb_to_graph_list(graphs, rb_graphs);
+    return find_cycle_i(graphs, rb_to_set(seeds), NIL_P(within) ? NULL : &rb_to_set(within),
+	    NIL_P(ignored_flags) ? 0 : NUM2INT(ignored_flags));
+}
+
+/* call-seq:
+ *   BGL::Graph.roots(graphs, seeds, ignored_parent_flags = 0) => root_set
+ *
+ * Returns the set of vertices of +seeds+ that have no parents in any of
+ * +graphs+. The parents that have one of +ignored_parent_flags+ set are not
+ * taken into account. For instance,
+ *
+ *   BGL::Graph.roots(graphs, tasks, BGL::Vertex::FINISHED_FLAG)
+ *
+ * returns the tasks that have no unfinished parents.
+ */
+static VALUE graph_s_roots(int argc, VALUE* argv, VALUE self)
+{
+    VALUE rb_graphs, seeds, ignored_flags = Qnil;
+    rb_scan_args(argc, argv, "21", &rb_graphs, &seeds, &ignored_flags);
+    int ignored = NIL_P(ignored_flags) ? 0 : NUM2INT(ignored_flags);
+
+    std::vector<VALUE> graphs;
+    rb_to_graph_list(graphs, rb_graphs);
+
+    ValueSet const& seed_set = rb_to_set(seeds);
+    ValueSet result;
+    for (ValueSet::const_iterator it = seed_set.begin(); it != seed_set.end(); ++it)
+    {
+	bool is_root = true;
+	for (std::vector<VALUE>::const_iterator g = graphs.begin(); is_root && g != graphs.end(); ++g)
+	{
+	    vertex_descriptor v; bool exists;
+	    tie(v, exists) = rb_to_vertex(*it, *g);
+	    if (! exists)
+		continue;
+
+	    RubyGraph& graph = graph_wrapped(*g);
+	    RubyGraph::inv_adjacency_iterator parent, end;
+	    for (tie(parent, end) = inv_adjacent_vertices(v, graph); parent != end; ++parent)
+	    {
+		if (! (vertex_flags(graph[*parent]) & ignored))
+		{
+		    is_root = false;
+		    break;
+		}
+	    }
+	}
+	if (is_root)
+	    result.insert(result.end(), *it);
+    }
+    return set_to_rb(result);
+}
+
+/* The traversal phase of Graph#roots_within, run without the GVL
+ *
+ * It is a single traversal from all the seeds at once. Each vertex that is
+ * reached gets labelled with the index of the seed it has been reached from,
+ * or with MULTIPLE_SEEDS if it can be reached from more than one seed. A
+ * vertex is therefore expanded at most twice: when it gets its first label,
+ * and when it gets MULTIPLE_SEEDS. A seed is a root if it is not reached, or
+ * only reached from itself (i.e. through a cycle).
+ */
+struct RootsWithinTraversal
+{
+    static const size_t MULTIPLE_SEEDS = static_cast<size_t>(-1);
+    typedef std::map<vertex_descriptor, size_t> LabelMap;
+
+    RubyGraph const& graph;
+    std::vector<vertex_descriptor> seeds;
+    std::vector<bool> is_root;
+    LabelMap labels;
+    std::deque<vertex_descriptor> queue;
+
+    RootsWithinTraversal(RubyGraph const& graph)
+	: graph(graph) {}
+
+    void relax(vertex_descriptor v, size_t origin)
+    {
+	LabelMap::iterator it = labels.find(v);
+	if (it == labels.end())
+	    labels.insert(make_pair(v, origin));
+	else if (it->second != origin && it->second != MULTIPLE_SEEDS)
+	    it->second = MULTIPLE_SEEDS;
+	else return;
+	queue.push_back(v);
+    }
+
+    void expand(vertex_descriptor v, size_t origin)
+    {
+	RubyGraph::adjacency_iterator child, end;
+	for (tie(child, end) = adjacent_vertices(v, graph); child != end; ++child)
+	    relax(*child, origin);
+    }
+
+    void operator()()
+    {
+	for (size_t i = 0; i < seeds.size(); ++i)
+	    expand(seeds[i], i);
+
+	while (!queue.empty())
+	{
+	    vertex_descriptor v = queue.front();
+	    queue.pop_front();
+	    expand(v, labels[v]);
+	}
+
+	is_root.resize(seeds.size());
+	for (size_t i = 0; i < seeds.size(); ++i)
+	{
+	    LabelMap::const_iterator it = labels.find(seeds[i]);
+	    is_root[i] = (it == labels.end() || it->second == i);
+	}
+    }
+};
+
+/* call-seq:
+ *   graph.roots_within(seeds) => root_set
+ *
+ * Returns the vertices of +seeds+ that cannot be reached from another vertex
+ * of +seeds+, i.e. the roots of the subgraph generated by +seeds+. The
+ * vertices of +seeds+ that are not in +graph+ are roots.
+ *
+ * Unlike calling Vertex#generated_subgraph on each seed, it is done in a
+ * single traversal of the graph, whose cost is linear in the size of the
+ * generated subgraph.
+ */
+static VALUE graph_roots_within(VALUE self, VALUE seeds)
+{
+    ValueSet const& seed_set = rb_to_set(seeds);
+    RubyGraph& graph = graph_wrapped(self);
+
+    RootsWithinTraversal traversal(graph);
+    std::vector<VALUE> seed_values;
+    ValueSet result;
+    for (ValueSet::const_iterator it = seed_set.begin(); it != seed_set.end(); ++it)
+    {
+	vertex_descriptor v; bool exists;
+	tie(v, exists) = rb_to_vertex(*it, self);
+	if (exists)
+	{
+	    traversal.seeds.push_back(v);
+	    seed_values.push_back(*it);
+	}
+	else
+	    result.insert(result.end(), *it);
+    }
+
+    graph_call_without_gvl(graph, traversal);
+
+    for (size_t i = 0; i < seed_values.size(); ++i)
+    {
+	if (traversal.is_root[i])
+	    result.insert(seed_values[i]);
+    }
+    return set_to_rb(result);
+}
+
+static const int SEARCH_DIRECT  = 1;
+static const int SEARCH_REVERSE = 2;
+
+/* The state of a multi-graph reachability search (BGL::Graph.reachable_vertices).
+ * The vertices that each worker thread has already explored are kept per
+ * graph and direction, so that no worker explores twice the same part of a
+ * graph */
+struct ReachabilitySearch
+{
+    struct WorkerState
+    {
+	// Indexed by 2 * graph_index + reverse
+	std::vector< std::set<vertex_descriptor> > visited;
+	// The vertices discovered in the current round
+	std::vector<VALUE> discovered;
+    };
+
+    std::vector<RubyGraph*> graphs;
+    std::vector<WorkerState> workers;
+
+    ReachabilitySearch(std::vector<RubyGraph*> const& graphs, size_t worker_count)
+	: graphs(graphs), workers(worker_count)
+    {
+	for (size_t i = 0; i < worker_count; ++i)
+	    workers[i].visited.resize(graphs.size() * 2);
+    }
+};
+
+/* Explores a graph in one direction from a set of seeds */
+struct ReachabilityJob : public ThreadPool::Job
+{
+    ReachabilitySearch& search;
+    size_t graph_index;
+    bool reverse;
+    std::vector<vertex_descriptor> seeds;
+
+    ReachabilityJob(ReachabilitySearch& search, size_t graph_index, bool reverse)
+	: search(search), graph_index(graph_index), reverse(reverse) {}
+
+    template<typename Range>
+    static void push_adjacent(Range range, std::set<vertex_descriptor>& visited,
+	    std::vector<vertex_descriptor>& stack, std::vector<VALUE>& discovered, RubyGraph const& graph)
+    {
+	for (; range.first != range.second; ++range.first)
+	{
+	    if (visited.insert(*range.first).second)
+	    {
+		stack.push_back(*range.first);
+		discovered.push_back(graph[*range.first]);
+	    }
+	}
+    }
+
+    void run(size_t worker)
+    {
+	RubyGraph const& graph = *search.graphs[graph_index];
+	ReachabilitySearch::WorkerState& state = search.workers[worker];
+	std::set<vertex_descriptor>& visited = state.visited[2 * graph_index + (reverse ? 1 : 0)];
+
+	std::vector<vertex_descriptor> stack;
+	for (std::vector<vertex_descriptor>::const_iterator it = seeds.begin(); it != seeds.end(); ++it)
+	{
+	    if (visited.insert(*it).second)
+		stack.push_back(*it);
+	}
+
+	while (!stack.empty())
+	{
+	    vertex_descriptor v = stack.back();
+	    stack.pop_back();
+	    if (reverse)
+		push_adjacent(inv_adjacent_vertices(v, graph), visited, stack, state.discovered, graph);
+	    else
+		push_adjacent(adjacent_vertices(v, graph), visited, stack, state.discovered, graph);
+	}
+    }
+};
+
+/* Runs the jobs of one round of a reachability search, either on the thread
+ * pool or serially in the calling thread (as worker 0). The round owns its
+ * jobs */
+struct ReachabilityRound
+{
+    ThreadPool* pool;
+    std::vector<ThreadPool::Job*> jobs;
+
+    explicit ReachabilityRound(ThreadPool* pool)
+	: pool(pool) {}
+    ~ReachabilityRound()
+    {
+	for (std::vector<ThreadPool::Job*>::const_iterator it = jobs.begin(); it != jobs.end(); ++it)
+	    delete *it;
+    }
+
+    void operator()()
+    {
+	if (pool)
+	    pool->run(jobs);
+	else
+	{
+	    for (std::vector<ThreadPool::Job*>::const_iterator it = jobs.begin(); it != jobs.end(); ++it)
+		(*it)->run(0);
+	}
+    }
+};
+
+/* The number of seeds that are explored by a single job */
+static const size_t REACHABILITY_JOB_SIZE = 64;
+
+/* Creates the jobs that explore +graphs+ from +seeds+ */
+static void reachability_jobs(std::vector<ThreadPool::Job*>& jobs, ReachabilitySearch& search,
+	std::vector<VALUE> const& graphs, ValueSet const& seeds, int directions)
+{
+    for (size_t graph_index = 0; graph_index < graphs.size(); ++graph_index)
+    {
+	for (int reverse = 0; reverse < 2; ++reverse)
+	{
+	    if (!(directions & (reverse ? SEARCH_REVERSE : SEARCH_DIRECT)))
+		continue;
+
+	    ReachabilityJob* job = 0;
+	    for (ValueSet::const_iterator it = seeds.begin(); it != seeds.end(); ++it)
+	    {
+		vertex_descriptor v; bool exists;
+		tie(v, exists) = rb_to_vertex(*it, graphs[graph_index]);
+		if (!exists)
+		    continue;
+
+		if (!job || job->seeds.size() == REACHABILITY_JOB_SIZE)
+		{
+		    job = new ReachabilityJob(search, graph_index, reverse);
+		    jobs.push_back(job);
+		}
+		job->seeds.push_back(v);
+	    }
+	}
+    }
+}
+
+/* call-seq:
+ *   BGL::Graph.reachable_vertices(graphs, seeds, directions = DIRECT, within = nil, known = nil) => vertex_set
+ *
+ * Returns the vertices that can be reached from the vertices of +seeds+ by
+ * following the edges of the graphs listed in +graphs+. +directions+ is
+ * DIRECT to follow the edges from source to target, REVERSE to follow them
+ * from target to source, or DIRECT | REVERSE for both.
+ *
+ * The search is done in rounds: each round explores all the graphs from the
+ * vertices discovered in the previous round. If +within+ is given, only the
+ * vertices in +within+ are considered as discovered, and if +known+ is given,
+ * the vertices in +known+ are not. The result includes +seeds+.
+ *
+ * On graphs large enough, the exploration of each round runs without the GVL,
+ * on a pool of native threads (see BGL.thread_count). It runs serially in the
+ * calling thread otherwise.
+ */
+static VALUE graph_s_reachable_vertices(int argc, VALUE* argv, VALUE self)
+{
+    VALUE rb_graphs, rb_seeds, rb_directions, rb_within, rb_known;
+    rb_scan_args(argc, argv, "23", &rb_graphs, &rb_seeds, &rb_directions, &rb_within, &rb_known);
+    int directions = NIL_P(rb_directions) ? SEARCH_DIRECT : NUM2INT(rb_directions);
+    ValueSet const* within = NIL_P(rb_within) ? 0 : &rb_to_set(rb_within);
+    ValueSet const* known  = NIL_P(rb_known)  ? 0 : &rb_to_set(rb_known);
+
+    std::vector<VALUE> graphs;
+    rb_to_graph_list(graphs, rb_graphs);
+    std::vector<RubyGraph*> wrapped_graphs;
+    for (std::vector<VALUE>::const_iterator it = graphs.begin(); it != graphs.end(); ++it)
+	wrapped_graphs.push_back(&graph_wrapped(*it));
+
+    ValueSet result(rb_to_set(rb_seeds));
+
+    // Nothing in this scope can raise, so that the pool usage count gets
+    // decremented
+    {
+	ThreadPool::Use pool_use;
+	ThreadPool* pool = 0;
+	if (graphs_release_gvl_p(wrapped_graphs))
+	    pool = &ThreadPool::instance();
+
+	ReachabilitySearch search(wrapped_graphs, pool ? pool->size() : 1);
+	ValueSet seeds(result);
+	while (!seeds.empty())
+	{
+	    ReachabilityRound round(pool);
+	    reachability_jobs(round.jobs, search, graphs, seeds, directions);
+	    graphs_call_without_gvl(wrapped_graphs, round);
+
+	    // Merge the per-thread results
+	    seeds.clear();
+	    for (size_t i = 0; i < search.workers.size(); ++i)
+	    {
+		std::vector<VALUE>& discovered = search.workers[i].discovered;
+		for (std::vector<VALUE>::const_iterator it = discovered.begin(); it != discovered.end(); ++it)
+		{
+		    if (within && within->find(*it) == within->end())
+			continue;
+		    if (known && known->find(*it) != known->end())
+			continue;
+		    if (result.insert(*it).second)
+			seeds.insert(*it);
+		}
+		discovered.clear();
+	    }
+	}
+    }
+    return set_to_rb(result);
+}
+
+/* call-seq:
+ *   BGL.thread_count => integer
+ *
+ * The number of threads used by the parallel graph algorithms, including the
+ * calling thread. It defaults to the number of CPUs.
+ */
+static VALUE bgl_thread_count(VALUE self)
+{ return ULONG2NUM(ThreadPool::instance().size()); }
+
+/* call-seq:
+ *   BGL.thread_count = count
+ *
+ * Changes the number of threads used by the parallel graph algorithms. Set
+ * it to 1 to disable the parallelization, and to 0 to use the number of CPUs.
+ * Raises ThreadError if another thread is running a parallel graph algorithm.
+ */
+static VALUE bgl_set_thread_count(VALUE self, VALUE count)
+{
+    if (!ThreadPool::resize(NUM2ULONG(count)))
+	rb_raise(rb_eThreadError, "cannot change the thread count while a graph algorithm is using the threads");
+    return count;
 }
 
 /**********************************************************************
@@ -747,13 +1511,24 @@ void Init_graph_algorithms()
 
     rb_define_method(bglGraph, "components",   RUBY_METHOD_FUNC(graph_components), -1);
     rb_define_method(bglGraph, "generated_subgraphs",   RUBY_METHOD_FUNC(graph_generated_subgraphs), -1);
+    rb_define_method(bglGraph, "overlay_generated_subgraphs",   RUBY_METHOD_FUNC(graph_overlay_generated_subgraphs), 3);
     rb_define_method(bglGraph, "each_dfs",	RUBY_METHOD_FUNC(graph_direct_each_dfs), 2);
     rb_define_method(bglGraph, "each_bfs",	RUBY_METHOD_FUNC(graph_direct_each_bfs), 2);
     rb_define_method(bglGraph, "reachable?", RUBY_METHOD_FUNC(graph_reachable_p), 2);
+    rb_define_method(bglGraph, "roots_within", RUBY_METHOD_FUNC(graph_roots_within), 1);
     rb_define_method(bglGraph, "prune",		RUBY_METHOD_FUNC(graph_prune), 0);
     rb_define_method(bglGraph, "pruned?",       RUBY_METHOD_FUNC(graph_pruned_p), 0);
     rb_define_method(bglGraph, "reset_prune",       RUBY_METHOD_FUNC(graph_reset_prune_flag), 0);
     rb_define_method(bglGraph, "topological_sort",		RUBY_METHOD_FUNC(graph_topological_sort), -1);
+    rb_define_method(bglGraph, "strongly_connected_components",	RUBY_METHOD_FUNC(graph_strongly_connected_components), -1);
+    rb_define_method(bglGraph, "find_cycle",	RUBY_METHOD_FUNC(graph_find_cycle), -1);
+    rb_define_singleton_method(bglGraph, "find_cycle",	RUBY_METHOD_FUNC(graph_s_find_cycle), -1);
+    rb_define_singleton_method(bglGraph, "roots",	RUBY_METHOD_FUNC(graph_s_roots), -1);
+    rb_define_singleton_method(bglGraph, "reachable_vertices",	RUBY_METHOD_FUNC(graph_s_reachable_vertices), -1);
+    rb_define_const(bglGraph, "DIRECT",		INT2FIX(SEARCH_DIRECT));
+    rb_define_const(bglGraph, "REVERSE",	INT2FIX(SEARCH_REVERSE));
+    rb_define_singleton_method(bglModule, "thread_count",	RUBY_METHOD_FUNC(bgl_thread_count), 0);
+    rb_define_singleton_method(bglModule, "thread_count=",	RUBY_METHOD_FUNC(bgl_set_thread_count), 1);
 
     bglReverseGraph = rb_define_class_under(bglGraph, "Reverse", rb_cObject);
     rb_define_method(bglReverseGraph, "generated_subgraphs",RUBY_METHOD_FUNC(graph_reverse_generated_subgraphs), -1);
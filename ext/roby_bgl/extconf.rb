@@ -2,6 +2,12 @@
 CONFIG['CC'] = "g++"
 dir_config 'boost'
 $CFLAGS += " -O3"
+
+# Used to release the GVL in the long graph algorithms
+have_header('ruby/thread.h')
+have_func('rb_thread_call_without_gvl2', 'ruby/thread.h')
+# The thread pool of the parallel graph algorithms
+have_library('pthread', 'pthread_create')
 #$LDFLAGS += " -module"
 
 create_makefile("roby_bgl")
@@ -17,6 +17,9 @@ VALUE bglGraph;
 VALUE bglReverseGraph;
 VALUE bglUndirectedGraph;
 VALUE bglVertex;
+VALUE bglCycleFoundError;
+
+unsigned long journal_stamp = 0;
 
 /**********************************************************************
  *  BGL::Graph
@@ -46,6 +49,21 @@ void graph_mark(RubyGraph* graph) {
 		rb_gc_mark(value); 
 	}
     }
+
+    if (graph->journal)
+    {
+	Journal const& journal = *graph->journal;
+	for (size_t i = 0; i < journal.size; ++i)
+	{
+	    JournalEntry const& entry = journal.at(i);
+	    rb_gc_mark(entry.source);
+	    rb_gc_mark(entry.target);
+	    rb_gc_mark(entry.info);
+	}
+    }
+
+    rb_gc_mark(graph->projection);
+    rb_gc_mark(graph->parent);
 }
 
 static void graph_free(RubyGraph* graph) { delete graph; }
@@ -56,6 +74,9 @@ static VALUE graph_alloc(VALUE klass)
     return rb_graph;
 }
 
+static void graph_project_edge(RubyGraph& graph, VALUE source, VALUE target, bool added);
+static void graph_release_owner(RubyGraph& graph, VALUE vertex);
+
 /* @overload vertices
  *
  * @return [Array<Object>] all vertices contained in +graph+
@@ -141,13 +162,17 @@ static
 VALUE graph_insert(VALUE self, VALUE vertex)
 {
     RubyGraph&	graph = graph_wrapped(self);
+    graph_check_mutable(graph);
     graph_map&  vertex_graphs = *vertex_descriptor_map(vertex, true);
 
     graph_map::iterator it;
     bool inserted;
     tie(it, inserted) = vertex_graphs.insert( make_pair(self, static_cast<void*>(0)) );
     if (inserted)
+    {
 	it->second = add_vertex(vertex, graph);
+	graph.record(JOURNAL_INSERT, vertex);
+    }
 
     return self;
 }
@@ -164,6 +189,7 @@ static
 VALUE graph_remove(VALUE self, VALUE vertex)
 {
     RubyGraph&	graph = graph_wrapped(self);
+    graph_check_mutable(graph);
     graph_map*  vertex_graphs = vertex_descriptor_map(vertex, false);
     if (!vertex_graphs)
         return self;
@@ -172,9 +198,22 @@ VALUE graph_remove(VALUE self, VALUE vertex)
     if (it == vertex_graphs->end())
 	return self;
 
-    clear_vertex(it->second, graph);
-    remove_vertex(it->second, graph);
+    vertex_descriptor v = it->second;
+    if (!NIL_P(graph.projection))
+    {
+	RubyGraph::out_edge_iterator out_it, out_end;
+	for (tie(out_it, out_end) = out_edges(v, graph); out_it != out_end; ++out_it)
+	    graph_project_edge(graph, vertex, graph[target(*out_it, graph)], false);
+	RubyGraph::in_edge_iterator in_it, in_end;
+	for (tie(in_it, in_end) = in_edges(v, graph); in_it != in_end; ++in_it)
+	    graph_project_edge(graph, graph[source(*in_it, graph)], vertex, false);
+    }
+
+    clear_vertex(v, graph);
+    remove_vertex(v, graph);
     vertex_graphs->erase(it);
+    graph.record(JOURNAL_REMOVE, vertex);
+    graph_release_owner(graph, vertex);
     return self;
 }
 
@@ -188,6 +227,15 @@ static
 VALUE graph_clear(VALUE self)
 {
     RubyGraph&	graph = graph_wrapped(self);
+    graph_check_mutable(graph);
+
+    vector<VALUE> removed;
+    if (!NIL_P(graph.projection))
+    {
+	edge_iterator edge_it, edge_end;
+	for (tie(edge_it, edge_end) = edges(graph); edge_it != edge_end; ++edge_it)
+	    graph_project_edge(graph, graph[source(*edge_it, graph)], graph[target(*edge_it, graph)], false);
+    }
 
     vertex_iterator begin, end;
     tie(begin, end) = vertices(graph);
@@ -198,8 +246,14 @@ VALUE graph_clear(VALUE self)
 
         graph_map::iterator it2 = vertex_graphs.find(self);
         vertex_graphs.erase(it2);
+	if (!NIL_P(graph.projection))
+	    removed.push_back(vertex_value);
     }
     graph.clear();
+    graph.record(JOURNAL_CLEAR, Qnil);
+
+    for (vector<VALUE>::const_iterator it = removed.begin(); it != removed.end(); ++it)
+	graph_release_owner(graph, *it);
     return self;
 }
 
@@ -246,6 +300,7 @@ static
 VALUE graph_link(VALUE self, VALUE source, VALUE target, VALUE info)
 {
     RubyGraph& graph = graph_wrapped(self);
+    graph_check_mutable(graph);
 
     if (source == target)
         rb_raise(rb_eArgError, "cannot add self-edges");
@@ -258,6 +313,8 @@ VALUE graph_link(VALUE self, VALUE source, VALUE target, VALUE info)
     if (! inserted)
 	rb_raise(rb_eArgError, "edge already exists");
 
+    graph.record(JOURNAL_LINK, source, target, info);
+    graph_project_edge(graph, source, target, true);
     return self;
 }
 
@@ -273,6 +330,7 @@ static
 VALUE graph_unlink(VALUE self, VALUE source, VALUE target)
 {
     RubyGraph& graph = graph_wrapped(self);
+    graph_check_mutable(graph);
 
     vertex_descriptor s, t; bool exists;
     tie(s, exists) = rb_to_vertex(source, self);
@@ -280,7 +338,11 @@ VALUE graph_unlink(VALUE self, VALUE source, VALUE target)
     tie(t, exists) = rb_to_vertex(target, self);
     if (! exists) return self;
     if (edge(s, t, graph).second)
+    {
         remove_edge(s, t, graph);
+	graph.record(JOURNAL_UNLINK, source, target);
+	graph_project_edge(graph, source, target, false);
+    }
     return self;
 }
 
@@ -305,6 +367,518 @@ VALUE graph_linked_p(VALUE self, VALUE source, VALUE target)
     return edge(s, t, graph).second ? Qtrue : Qfalse;
 }
 
+/* Returns the owner of +vertex+ (see BGL::Vertex#vertex_owner=) */
+static VALUE vertex_owner_of(VALUE vertex)
+{
+    VertexData* data = vertex_data(vertex, false);
+    return data ? data->owner : Qnil;
+}
+
+/* Updates the projection of +graph+ after the source -> target edge got
+ * added (+added+ is true) or removed (+added+ is false) from it. It does
+ * nothing if the two vertices do not have an owner, or have the same one.
+ */
+static void graph_project_edge(RubyGraph& graph, VALUE source, VALUE target, bool added)
+{
+    if (NIL_P(graph.projection))
+	return;
+
+    VALUE source_owner = vertex_owner_of(source);
+    VALUE target_owner = vertex_owner_of(target);
+    if (NIL_P(source_owner) || NIL_P(target_owner) || source_owner == target_owner)
+	return;
+
+    RubyGraph& projection = graph_wrapped(graph.projection);
+    vertex_descriptor s, t; edge_descriptor e;
+    bool exists;
+    tie(s, exists) = rb_to_vertex(source_owner, graph.projection);
+    if (exists)
+	tie(t, exists) = rb_to_vertex(target_owner, graph.projection);
+    if (exists)
+	tie(e, exists) = edge(s, t, projection);
+
+    if (added)
+    {
+	if (exists)
+	    ++projection[e].multiplicity;
+	else
+	    graph_link(graph.projection, source_owner, target_owner, Qnil);
+    }
+    else if (exists && --projection[e].multiplicity == 0)
+	graph_unlink(graph.projection, source_owner, target_owner);
+}
+
+/* Called when +vertex+ has been removed from +graph+. It removes the owner
+ * of +vertex+ from the projection of +graph+ if it is not linked to anything
+ * there anymore */
+static void graph_release_owner(RubyGraph& graph, VALUE vertex)
+{
+    if (NIL_P(graph.projection))
+	return;
+    VALUE owner = vertex_owner_of(vertex);
+    if (NIL_P(owner))
+	return;
+
+    vertex_descriptor v; bool exists;
+    tie(v, exists) = rb_to_vertex(owner, graph.projection);
+    if (!exists)
+	return;
+
+    RubyGraph& projection = graph_wrapped(graph.projection);
+    if (in_degree(v, projection) == 0 && out_degree(v, projection) == 0)
+	graph_remove(graph.projection, owner);
+}
+
+/* @overload projection=(graph)
+ *
+ * Makes +graph+ the projection of this graph: for each edge a -> b of this
+ * graph where a and b have different owners (see
+ * {BGL::Vertex#vertex_owner=}), +graph+ has an edge a.vertex_owner ->
+ * b.vertex_owner. The projected edges are reference-counted (see
+ * {#edge_multiplicity}), so that they are removed only when the last of the
+ * edges they represent is. The owners are removed from +graph+ when one of
+ * their vertices gets removed from this graph, if they do not have any edge
+ * left.
+ *
+ * +graph+ must be empty, and should not be modified directly afterwards.
+ * Pass nil to stop maintaining the projection.
+ *
+ * @param [BGL::Graph,nil] graph
+ * @return [BGL::Graph,nil]
+ * @raise ArgumentError if +graph+ is not empty, or if the projections would
+ *   form a cycle
+ */
+static
+VALUE graph_set_projection(VALUE self, VALUE rb_projection)
+{
+    RubyGraph& graph = graph_wrapped(self);
+    if (NIL_P(rb_projection))
+    {
+	graph.projection = Qnil;
+	return Qnil;
+    }
+
+    if (!rb_obj_is_kind_of(rb_projection, bglGraph))
+	rb_raise(rb_eTypeError, "expected a BGL::Graph");
+    for (VALUE p = rb_projection; !NIL_P(p); p = graph_wrapped(p).projection)
+    {
+	if (p == self)
+	    rb_raise(rb_eArgError, "a graph cannot be its own projection");
+    }
+    RubyGraph& projection = graph_wrapped(rb_projection);
+    if (num_vertices(projection) != 0)
+	rb_raise(rb_eArgError, "the projection graph must be empty");
+    graph_check_mutable(projection);
+
+    graph.projection = rb_projection;
+    edge_iterator it, end;
+    for (tie(it, end) = edges(graph); it != end; ++it)
+	graph_project_edge(graph, graph[source(*it, graph)], graph[target(*it, graph)], true);
+    return rb_projection;
+}
+
+/* @overload projection
+ *
+ * @return [BGL::Graph,nil] the graph set with {#projection=}
+ */
+static
+VALUE graph_projection(VALUE self)
+{ return graph_wrapped(self).projection; }
+
+/* @overload edge_multiplicity(source, target)
+ *
+ * Returns how many edges of the graph of which this graph is the projection
+ * map to the source -> target edge. It is 1 for the edges of graphs that are
+ * not projections.
+ *
+ * @return [Integer] the multiplicity, zero if there is no such edge
+ */
+static
+VALUE graph_edge_multiplicity(VALUE self, VALUE source, VALUE target)
+{
+    RubyGraph& graph = graph_wrapped(self);
+
+    vertex_descriptor s, t; bool exists;
+    tie(s, exists) = rb_to_vertex(source, self);
+    if (! exists) return INT2FIX(0);
+    tie(t, exists) = rb_to_vertex(target, self);
+    if (! exists) return INT2FIX(0);
+    edge_descriptor e;
+    tie(e, exists) = edge(s, t, graph);
+    return exists ? ULONG2NUM(graph[e].multiplicity) : INT2FIX(0);
+}
+
+static VALUE graph_link_in_hierarchy_i(VALUE self, VALUE source, VALUE target, VALUE info, bool yield);
+
+/* @overload parent=(graph)
+ *
+ * Declares that this graph is a subset of +graph+: the edges of this graph
+ * are copied in +graph+ and its own parents (with their info in +graph+ and
+ * nil above), and {#link_in_hierarchy} and {#unlink_in_hierarchy} will
+ * maintain the edges along the whole parent chain.
+ *
+ * @param [BGL::Graph,nil] graph
+ * @return [BGL::Graph,nil]
+ * @raise ArgumentError if the parent chain would form a cycle
+ * @raise CycleFoundError if one of the copied edges creates a cycle in a DAG
+ *   of the hierarchy (see {#dag=})
+ */
+static
+VALUE graph_set_parent(VALUE self, VALUE rb_parent)
+{
+    RubyGraph& graph = graph_wrapped(self);
+    if (NIL_P(rb_parent))
+    {
+	graph.parent = Qnil;
+	return Qnil;
+    }
+
+    if (!rb_obj_is_kind_of(rb_parent, bglGraph))
+	rb_raise(rb_eTypeError, "expected a BGL::Graph");
+    for (VALUE p = rb_parent; !NIL_P(p); p = graph_wrapped(p).parent)
+    {
+	if (p == self)
+	    rb_raise(rb_eArgError, "a graph cannot be its own parent");
+    }
+
+    graph.parent = rb_parent;
+    edge_iterator it, end;
+    for (tie(it, end) = edges(graph); it != end; ++it)
+    {
+	graph_link_in_hierarchy_i(rb_parent, graph[source(*it, graph)],
+		graph[target(*it, graph)], graph[*it].info, false);
+    }
+    return rb_parent;
+}
+
+/* @overload parent
+ *
+ * @return [BGL::Graph,nil] the graph set with {#parent=}
+ */
+static
+VALUE graph_parent(VALUE self)
+{ return graph_wrapped(self).parent; }
+
+/* @overload dag=(flag)
+ *
+ * Sets whether this graph must stay acyclic. It is only enforced by
+ * {#link_in_hierarchy}, and only on the topmost DAG of the hierarchy as it
+ * is a superset of the others.
+ */
+static
+VALUE graph_set_dag(VALUE self, VALUE flag)
+{
+    graph_wrapped(self).dag = RTEST(flag);
+    return flag;
+}
+
+/* @overload dag?
+ *
+ * @return [Boolean] the flag set with {#dag=}
+ */
+static
+VALUE graph_dag_p(VALUE self)
+{ return graph_wrapped(self).dag ? Qtrue : Qfalse; }
+
+/* True if there is a path from +from+ to +to+ in +graph+ */
+static bool graph_path_exists(RubyGraph const& graph, vertex_descriptor from, vertex_descriptor to)
+{
+    vector<vertex_descriptor> stack(1, from);
+    set<vertex_descriptor> visited;
+    visited.insert(from);
+    while (!stack.empty())
+    {
+	vertex_descriptor v = stack.back();
+	stack.pop_back();
+	if (v == to)
+	    return true;
+
+	RubyGraph::adjacency_iterator it, end;
+	for (tie(it, end) = adjacent_vertices(v, graph); it != end; ++it)
+	{
+	    if (visited.insert(*it).second)
+		stack.push_back(*it);
+	}
+    }
+    return false;
+}
+
+static VALUE graph_link_in_hierarchy_i(VALUE self, VALUE source, VALUE target, VALUE info, bool yield)
+{
+    // Collect the levels that do not have the edge, and find the topmost
+    // DAG. It is the only one that needs to be checked for cycles, as it is
+    // the union of all the DAGs below it
+    VALUE relations = rb_ary_new();
+    VALUE top_dag = Qnil;
+    for (VALUE rel = self; !NIL_P(rel); rel = graph_wrapped(rel).parent)
+    {
+	if (graph_wrapped(rel).dag)
+	    top_dag = rel;
+	if (!RTEST(graph_linked_p(rel, source, target)))
+	    rb_ary_push(relations, rel);
+    }
+    if (RARRAY_LEN(relations) == 0)
+	return relations;
+
+    if (!NIL_P(top_dag) && !RTEST(graph_linked_p(top_dag, source, target)))
+    {
+	vertex_descriptor s, t; bool s_exists, t_exists;
+	tie(s, s_exists) = rb_to_vertex(source, top_dag);
+	tie(t, t_exists) = rb_to_vertex(target, top_dag);
+	if (s_exists && t_exists && graph_path_exists(graph_wrapped(top_dag), t, s))
+	{
+	    VALUE source_name = rb_obj_as_string(source);
+	    VALUE target_name = rb_obj_as_string(target);
+	    rb_raise(bglCycleFoundError, "cannot add a %s -> %s relation since it would create a cycle",
+		    StringValueCStr(source_name), StringValueCStr(target_name));
+	}
+    }
+
+    if (yield && rb_block_given_p())
+	rb_yield(relations);
+
+    for (long i = 0; i < RARRAY_LEN(relations); ++i)
+    {
+	VALUE rel = rb_ary_entry(relations, i);
+	// The block may have added the edge already
+	if (!RTEST(graph_linked_p(rel, source, target)))
+	    graph_link(rel, source, target, rel == self ? info : Qnil);
+    }
+    return relations;
+}
+
+/* @overload link_in_hierarchy(source, target, info) { |relations| ... }
+ *
+ * Adds the source -> target edge in this graph and in all its parents (see
+ * {#parent=}) that do not have it yet. +info+ is used in this graph, the
+ * edge info is nil in the parents.
+ *
+ * If a block is given, it is called with the graphs that are going to get
+ * the new edge before they are modified. Nothing is done if it raises.
+ *
+ * @return [Array<BGL::Graph>] the graphs in which the edge got added, from
+ *   self to the root of the hierarchy. It is empty if the edge existed in
+ *   all of them, in which case the block is not called.
+ * @raise CycleFoundError if the edge would create a cycle in the topmost
+ *   DAG of the hierarchy (see {#dag=})
+ */
+static
+VALUE graph_link_in_hierarchy(VALUE self, VALUE source, VALUE target, VALUE info)
+{ return graph_link_in_hierarchy_i(self, source, target, info, true); }
+
+/* @overload unlink_in_hierarchy(source, target) { |relations| ... }
+ *
+ * Removes the source -> target edge from this graph and from all its
+ * parents (see {#parent=}). It does nothing if the edge does not exist in
+ * this graph.
+ *
+ * If a block is given, it is called with this graph and its parents before
+ * the edge gets removed. Nothing is done if it raises.
+ *
+ * @return [Array<BGL::Graph>] this graph and its parents, or an empty array
+ *   if the edge did not exist in this graph
+ */
+static
+VALUE graph_unlink_in_hierarchy(VALUE self, VALUE source, VALUE target)
+{
+    VALUE relations = rb_ary_new();
+    if (!RTEST(graph_linked_p(self, source, target)))
+	return relations;
+
+    for (VALUE rel = self; !NIL_P(rel); rel = graph_wrapped(rel).parent)
+	rb_ary_push(relations, rel);
+    if (rb_block_given_p())
+	rb_yield(relations);
+
+    for (long i = 0; i < RARRAY_LEN(relations); ++i)
+	graph_unlink(rb_ary_entry(relations, i), source, target);
+    return relations;
+}
+
+/* Returns the descriptor of the source -> target edge, raising ArgumentError
+ * if it does not exist */
+static edge_descriptor graph_get_edge(VALUE self, VALUE source, VALUE target)
+{
+    RubyGraph& graph = graph_wrapped(self);
+
+    vertex_descriptor s, t; bool exists;
+    tie(s, exists) = rb_to_vertex(source, self);
+    if (exists)
+    {
+	tie(t, exists) = rb_to_vertex(target, self);
+	if (exists)
+	{
+	    edge_descriptor e;
+	    tie(e, exists) = edge(s, t, graph);
+	    if (exists)
+		return e;
+	}
+    }
+    rb_raise(rb_eArgError, "no such edge in graph");
+}
+
+/* @overload set_edge_bounds(source, target, min, max)
+ *
+ * Sets the bounds on the delay between the emission of +source+ and the
+ * emission of +target+. Use -Infinity and Infinity for unbounded values.
+ *
+ * @param [BGL::Vertex] source the edge source
+ * @param [BGL::Vertex] target the edge target
+ * @param [Numeric] min the minimum delay
+ * @param [Numeric] max the maximum delay
+ * @return [self]
+ * @raise ArgumentError if the edge does not exist
+ */
+static
+VALUE graph_set_edge_bounds(VALUE self, VALUE source, VALUE target, VALUE min, VALUE max)
+{
+    RubyGraph& graph = graph_wrapped(self);
+    EdgeProperty& property = graph[graph_get_edge(self, source, target)];
+    property.min_delay = NUM2DBL(min);
+    property.max_delay = NUM2DBL(max);
+    return self;
+}
+
+/* @overload edge_bounds(source, target)
+ *
+ * @return [(Float,Float)] the delay bounds set with {#set_edge_bounds}
+ * @raise ArgumentError if the edge does not exist
+ */
+static
+VALUE graph_edge_bounds(VALUE self, VALUE source, VALUE target)
+{
+    RubyGraph& graph = graph_wrapped(self);
+    EdgeProperty const& property = graph[graph_get_edge(self, source, target)];
+    return rb_ary_new3(2, rb_float_new(property.min_delay), rb_float_new(property.max_delay));
+}
+
+/* @overload enable_journal(capacity = 1024)
+ *
+ * Starts recording the modifications of this graph in a journal, which can
+ * be read with {#drain_journal}. The journal keeps at most +capacity+
+ * entries: when it is full, the oldest ones are dropped (see
+ * {#journal_dropped}).
+ *
+ * Calling it on a graph whose journal is already enabled changes the
+ * capacity and discards the current entries
+ *
+ * @return [self]
+ */
+static
+VALUE graph_enable_journal(int argc, VALUE* argv, VALUE self)
+{
+    VALUE rb_capacity;
+    rb_scan_args(argc, argv, "01", &rb_capacity);
+    long capacity = NIL_P(rb_capacity) ? 1024 : NUM2LONG(rb_capacity);
+    if (capacity <= 0)
+	rb_raise(rb_eArgError, "the journal capacity must be strictly positive");
+
+    RubyGraph& graph = graph_wrapped(self);
+    delete graph.journal;
+    graph.journal = new Journal(capacity);
+    return self;
+}
+
+/* @overload disable_journal
+ *
+ * Stops recording the modifications of this graph, and discards the entries
+ * that have not been drained yet
+ *
+ * @return [self]
+ */
+static
+VALUE graph_disable_journal(VALUE self)
+{
+    RubyGraph& graph = graph_wrapped(self);
+    delete graph.journal;
+    graph.journal = 0;
+    return self;
+}
+
+/* @overload journal_enabled?
+ *
+ * @return [Boolean] true if the modifications of this graph are recorded in
+ *   a journal
+ */
+static
+VALUE graph_journal_enabled_p(VALUE self)
+{ return graph_wrapped(self).journal ? Qtrue : Qfalse; }
+
+/* @overload journal_dropped
+ *
+ * @return [Integer] the count of journal entries that got overwritten before
+ *   they could be drained since the journal has been enabled. If it changed
+ *   between two calls to {#drain_journal}, the journal is not a complete
+ *   record of the modifications anymore.
+ */
+static
+VALUE graph_journal_dropped(VALUE self)
+{
+    RubyGraph& graph = graph_wrapped(self);
+    return ULONG2NUM(graph.journal ? graph.journal->dropped : 0);
+}
+
+/* @overload drain_journal(max = nil)
+ *
+ * Removes and returns the oldest entries of the journal, up to +max+ entries
+ * if it is given. Each entry is an array
+ *
+ *   [operation, stamp, source, target, info]
+ *
+ * where +operation+ is one of the JOURNAL_ constants and +stamp+ the value of
+ * {BGL::Graph.journal_stamp} at the time of the modification. +source+ is the
+ * vertex for JOURNAL_INSERT and JOURNAL_REMOVE. +target+ and +info+ are nil
+ * when they do not apply to the operation.
+ *
+ * @return [Array] the entries, oldest first. It is empty if the journal is
+ *   not enabled.
+ */
+static
+VALUE graph_drain_journal(int argc, VALUE* argv, VALUE self)
+{
+    VALUE rb_max;
+    rb_scan_args(argc, argv, "01", &rb_max);
+
+    RubyGraph& graph = graph_wrapped(self);
+    VALUE result = rb_ary_new();
+    if (!graph.journal)
+	return result;
+
+    Journal& journal = *graph.journal;
+    size_t count = journal.size;
+    if (!NIL_P(rb_max) && NUM2ULONG(rb_max) < count)
+	count = NUM2ULONG(rb_max);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+	JournalEntry const& entry = journal.at(i);
+	rb_ary_push(result, rb_ary_new3(5, INT2FIX(entry.operation), ULONG2NUM(entry.stamp),
+		    entry.source, entry.target, entry.info));
+    }
+    journal.pop(count);
+    return result;
+}
+
+/* @overload journal_stamp
+ *
+ * @return [Integer] the stamp that is recorded in the journal entries
+ */
+static
+VALUE graph_s_journal_stamp(VALUE self)
+{ return ULONG2NUM(journal_stamp); }
+
+/* @overload journal_stamp=(stamp)
+ *
+ * Sets the stamp that is recorded in the journal entries of all graphs. The
+ * execution engine sets it to the current cycle index
+ */
+static
+VALUE graph_s_set_journal_stamp(VALUE self, VALUE stamp)
+{
+    journal_stamp = NUM2ULONG(stamp);
+    return stamp;
+}
+
 /* @overload each_edge { |source, target, info| ... }
  *
  * Iterates on all edges in this graph.
@@ -341,30 +915,114 @@ VALUE graph_each_edge(VALUE self)
  *  BGL::Vertex
  */
 
-static void vertex_free(graph_map* map) { delete map; }
-static void vertex_mark(graph_map* map)
+static void vertex_free(VertexData* data) { delete data; }
+static void vertex_mark(VertexData* data)
 {
-    for (graph_map::iterator it = map->begin(); it != map->end(); ++it)
+    graph_map& map = data->graphs;
+    for (graph_map::iterator it = map.begin(); it != map.end(); ++it)
 	rb_gc_mark(it->first);
+    rb_gc_mark(data->owner);
 }
 
-/* Returns the graph => descriptor map for +self+ */
-graph_map* vertex_descriptor_map(VALUE self, bool create)
+/* Returns the native data of +self+ */
+VertexData* vertex_data(VALUE self, bool create)
 {
-    graph_map* map = 0;
-    VALUE descriptors = rb_ivar_get(self, id_rb_graph_map);
-    if (RTEST(descriptors))
+    VertexData* data = 0;
+    VALUE rb_data = rb_ivar_get(self, id_rb_graph_map);
+    if (RTEST(rb_data))
     {
-	Data_Get_Struct(descriptors, graph_map, map);
+	Data_Get_Struct(rb_data, VertexData, data);
     }
     else if (create)
     {
-	map = new graph_map;
-	VALUE rb_map = Data_Wrap_Struct(rb_cObject, vertex_mark, vertex_free, map);
-	rb_ivar_set(self, id_rb_graph_map, rb_map);
+	data = new VertexData;
+	rb_data = Data_Wrap_Struct(rb_cObject, vertex_mark, vertex_free, data);
+	rb_ivar_set(self, id_rb_graph_map, rb_data);
     }
 
-    return map;
+    return data;
+}
+
+/* Returns the graph => descriptor map for +self+ */
+graph_map* vertex_descriptor_map(VALUE self, bool create)
+{
+    VertexData* data = vertex_data(self, create);
+    return data ? &data->graphs : 0;
+}
+
+/* @overload vertex_flags
+ *
+ * @return [Integer] the flags of this vertex. See the *_FLAG constants
+ */
+static VALUE vertex_get_flags(VALUE self)
+{ return INT2FIX(vertex_flags(self)); }
+
+/* @overload update_vertex_flags(mask, value)
+ *
+ * Sets the flags selected by +mask+ to their value in +value+, and leaves
+ * the other flags unchanged
+ *
+ * @param [Integer] mask
+ * @param [Integer] value
+ * @return [Integer] the new flags
+ */
+static VALUE vertex_update_flags(VALUE self, VALUE mask, VALUE value)
+{
+    VertexData& data = *vertex_data(self, true);
+    int int_mask = NUM2INT(mask);
+    data.flags = (data.flags & ~int_mask) | (NUM2INT(value) & int_mask);
+    return INT2FIX(data.flags);
+}
+
+/* @overload set_vertex_flags(mask)
+ *
+ * Sets the flags that are set in +mask+
+ *
+ * @param [Integer] mask
+ * @return [Integer] the new flags
+ */
+static VALUE vertex_set_flags(VALUE self, VALUE mask)
+{ return vertex_update_flags(self, mask, mask); }
+
+/* @overload clear_vertex_flags(mask)
+ *
+ * Clears the flags that are set in +mask+
+ *
+ * @param [Integer] mask
+ * @return [Integer] the new flags
+ */
+static VALUE vertex_clear_flags(VALUE self, VALUE mask)
+{ return vertex_update_flags(self, mask, INT2FIX(0)); }
+
+/* @overload vertex_flags?(mask)
+ *
+ * @return [Boolean] true if at least one of the flags in +mask+ is set
+ */
+static VALUE vertex_flags_p(VALUE self, VALUE mask)
+{ return (vertex_flags(self) & NUM2INT(mask)) ? Qtrue : Qfalse; }
+
+/* @overload vertex_owner
+ *
+ * @return [Object,nil] the object this vertex belongs to in the projection
+ *   graphs (see {BGL::Graph#projection=})
+ */
+static VALUE vertex_get_owner(VALUE self)
+{ return vertex_owner_of(self); }
+
+/* @overload vertex_owner=(owner)
+ *
+ * Sets the object this vertex belongs to in the projection graphs (see
+ * {BGL::Graph#projection=}). It must be set before the vertex gets linked in
+ * a graph that has a projection, as the projected edges are not updated
+ * when the owner changes.
+ *
+ * @param [BGL::Vertex,nil] owner
+ * @return [Object,nil]
+ */
+static VALUE vertex_set_owner(VALUE self, VALUE owner)
+{
+    vertex_data(self, true)->owner = owner;
+    return owner;
 }
 
 /* @overload vertex.each_graph { |graph| ... }
@@ -633,6 +1291,7 @@ static VALUE vertex_set_info(VALUE self, VALUE child, VALUE rb_graph, VALUE new_
     if (! exists)
 	rb_raise(rb_eArgError, "no such edge in graph");
 
+    graph.record(JOURNAL_UPDATE, self, child, new_value);
     return (graph[e].info = new_value);
 }
 
@@ -711,6 +1370,30 @@ extern "C" void Init_roby_bgl()
     rb_define_method(bglGraph, "link",	    RUBY_METHOD_FUNC(graph_link), 3);
     rb_define_method(bglGraph, "unlink",    RUBY_METHOD_FUNC(graph_unlink), 2);
     rb_define_method(bglGraph, "linked?",   RUBY_METHOD_FUNC(graph_linked_p), 2);
+    rb_define_method(bglGraph, "set_edge_bounds",   RUBY_METHOD_FUNC(graph_set_edge_bounds), 4);
+    rb_define_method(bglGraph, "edge_bounds",   RUBY_METHOD_FUNC(graph_edge_bounds), 2);
+    rb_define_method(bglGraph, "projection=",   RUBY_METHOD_FUNC(graph_set_projection), 1);
+    rb_define_method(bglGraph, "projection",   RUBY_METHOD_FUNC(graph_projection), 0);
+    rb_define_method(bglGraph, "edge_multiplicity",   RUBY_METHOD_FUNC(graph_edge_multiplicity), 2);
+    rb_define_method(bglGraph, "parent=",   RUBY_METHOD_FUNC(graph_set_parent), 1);
+    rb_define_method(bglGraph, "parent",   RUBY_METHOD_FUNC(graph_parent), 0);
+    rb_define_method(bglGraph, "dag=",   RUBY_METHOD_FUNC(graph_set_dag), 1);
+    rb_define_method(bglGraph, "dag?",   RUBY_METHOD_FUNC(graph_dag_p), 0);
+    rb_define_method(bglGraph, "link_in_hierarchy",   RUBY_METHOD_FUNC(graph_link_in_hierarchy), 3);
+    rb_define_method(bglGraph, "unlink_in_hierarchy",   RUBY_METHOD_FUNC(graph_unlink_in_hierarchy), 2);
+    rb_define_method(bglGraph, "enable_journal",   RUBY_METHOD_FUNC(graph_enable_journal), -1);
+    rb_define_method(bglGraph, "disable_journal",   RUBY_METHOD_FUNC(graph_disable_journal), 0);
+    rb_define_method(bglGraph, "journal_enabled?",   RUBY_METHOD_FUNC(graph_journal_enabled_p), 0);
+    rb_define_method(bglGraph, "journal_dropped",   RUBY_METHOD_FUNC(graph_journal_dropped), 0);
+    rb_define_method(bglGraph, "drain_journal",   RUBY_METHOD_FUNC(graph_drain_journal), -1);
+    rb_define_singleton_method(bglGraph, "journal_stamp",   RUBY_METHOD_FUNC(graph_s_journal_stamp), 0);
+    rb_define_singleton_method(bglGraph, "journal_stamp=",   RUBY_METHOD_FUNC(graph_s_set_journal_stamp), 1);
+    rb_define_const(bglGraph, "JOURNAL_INSERT",	INT2FIX(JOURNAL_INSERT));
+    rb_define_const(bglGraph, "JOURNAL_REMOVE",	INT2FIX(JOURNAL_REMOVE));
+    rb_define_const(bglGraph, "JOURNAL_LINK",	INT2FIX(JOURNAL_LINK));
+    rb_define_const(bglGraph, "JOURNAL_UNLINK",	INT2FIX(JOURNAL_UNLINK));
+    rb_define_const(bglGraph, "JOURNAL_UPDATE",	INT2FIX(JOURNAL_UPDATE));
+    rb_define_const(bglGraph, "JOURNAL_CLEAR",	INT2FIX(JOURNAL_CLEAR));
     rb_define_method(bglGraph, "vertices",	RUBY_METHOD_FUNC(graph_vertices), 0);
     rb_define_method(bglGraph, "empty?",	RUBY_METHOD_FUNC(graph_empty_p), 0);
     rb_define_method(bglGraph, "each_vertex",	RUBY_METHOD_FUNC(graph_each_vertex), 0);
@@ -734,6 +1417,18 @@ extern "C" void Init_roby_bgl()
     rb_define_method(bglVertex, "[]",			RUBY_METHOD_FUNC(vertex_get_info), 2);
     rb_define_method(bglVertex, "[]=",			RUBY_METHOD_FUNC(vertex_set_info), 3);
     rb_define_method(bglVertex, "singleton_vertex?",	RUBY_METHOD_FUNC(vertex_singleton_p), 0);
+    rb_define_method(bglVertex, "vertex_flags",		RUBY_METHOD_FUNC(vertex_get_flags), 0);
+    rb_define_method(bglVertex, "vertex_flags?",	RUBY_METHOD_FUNC(vertex_flags_p), 1);
+    rb_define_method(bglVertex, "update_vertex_flags",	RUBY_METHOD_FUNC(vertex_update_flags), 2);
+    rb_define_method(bglVertex, "set_vertex_flags",	RUBY_METHOD_FUNC(vertex_set_flags), 1);
+    rb_define_method(bglVertex, "clear_vertex_flags",	RUBY_METHOD_FUNC(vertex_clear_flags), 1);
+    rb_define_method(bglVertex, "vertex_owner",		RUBY_METHOD_FUNC(vertex_get_owner), 0);
+    rb_define_method(bglVertex, "vertex_owner=",	RUBY_METHOD_FUNC(vertex_set_owner), 1);
+    rb_define_const(bglVertex, "PENDING_FLAG",		INT2FIX(VERTEX_PENDING));
+    rb_define_const(bglVertex, "RUNNING_FLAG",		INT2FIX(VERTEX_RUNNING));
+    rb_define_const(bglVertex, "FINISHED_FLAG",		INT2FIX(VERTEX_FINISHED));
+
+    bglCycleFoundError = rb_define_class_under(bglModule, "CycleFoundError", rb_eRuntimeError);
 
     bglReverseGraph    = rb_define_class_under(bglGraph, "Reverse", rb_cObject);
     bglUndirectedGraph = rb_define_class_under(bglGraph, "Undirected", rb_cObject);
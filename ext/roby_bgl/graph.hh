@@ -2,8 +2,13 @@
 #define RUBY_BGL_GRAPH_HH
 
 #include <ruby.h>
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
 #include <boost/graph/adjacency_list.hpp>
 #include <set>
+#include <vector>
+#include <limits>
 #include <boost/tuple/tuple.hpp>
 
 extern VALUE bglModule;
@@ -11,6 +16,7 @@ extern VALUE bglGraph;
 extern VALUE bglReverseGraph;
 extern VALUE bglUndirectedGraph;
 extern VALUE bglVertex;
+extern VALUE bglCycleFoundError;
 
 /**********************************************************************
  * Definition of base C++ types
@@ -20,18 +26,146 @@ struct EdgeProperty
 {
     VALUE info;
     boost::default_color_type color; // needed by some algorithms
+    /* The bounds on the delay between the emission of the source and the
+     * emission of the target. They are unbounded unless set with
+     * Graph#set_edge_bounds */
+    double min_delay, max_delay;
+    /* In a projection graph (see Graph#projection=), the count of edges of
+     * the source graph that map to this edge. It is 1 in the other graphs */
+    size_t multiplicity;
 
     EdgeProperty(VALUE info)
-	: info(info) { }
+	: info(info)
+	, min_delay(-std::numeric_limits<double>::infinity())
+	, max_delay(std::numeric_limits<double>::infinity())
+	, multiplicity(1) { }
+};
+
+/* The operations recorded in the graph journals */
+enum JournalOperation
+{
+    JOURNAL_INSERT = 1,
+    JOURNAL_REMOVE = 2,
+    JOURNAL_LINK   = 3,
+    JOURNAL_UNLINK = 4,
+    JOURNAL_UPDATE = 5,
+    JOURNAL_CLEAR  = 6
+};
+
+struct JournalEntry
+{
+    int operation;
+    unsigned long stamp;
+    VALUE source, target, info;
+};
+
+/* An opt-in record of the modifications of a graph (see
+ * Graph#enable_journal). It is a fixed-size ring buffer: when it is full, the
+ * oldest entries get overwritten and are counted in +dropped+
+ */
+struct Journal
+{
+    std::vector<JournalEntry> entries;
+    size_t start, size;
+    unsigned long dropped;
+
+    Journal(size_t capacity)
+	: entries(capacity), start(0), size(0), dropped(0) {}
+
+    void record(int operation, unsigned long stamp, VALUE source, VALUE target, VALUE info)
+    {
+	size_t index = (start + size) % entries.size();
+	if (size == entries.size())
+	{
+	    start = (start + 1) % entries.size();
+	    ++dropped;
+	}
+	else
+	    ++size;
+
+	JournalEntry& entry = entries[index];
+	entry.operation = operation;
+	entry.stamp  = stamp;
+	entry.source = source;
+	entry.target = target;
+	entry.info   = info;
+    }
+
+    JournalEntry const& at(size_t i) const
+    { return entries[(start + i) % entries.size()]; }
+
+    /* Removes the +count+ oldest entries */
+    void pop(size_t count)
+    {
+	start = (start + count) % entries.size();
+	size -= count;
+    }
 };
 
+/* The stamp that is recorded in the journal entries. It is set with
+ * BGL::Graph.journal_stamp= (the execution engine uses the cycle index) */
+extern unsigned long journal_stamp;
+
 struct RubyGraph : public boost::adjacency_list< boost::setS, boost::setS
 		      , boost::bidirectionalS, VALUE, EdgeProperty>
 {
     std::string name;
+    /** The count of algorithms that are currently traversing the graph
+     * without holding the GVL (see graph_call_without_gvl) */
+    int traversals;
+    /** The journal of the modifications, NULL unless it has been enabled
+     * with Graph#enable_journal */
+    Journal* journal;
+    /** The graph in which the edges of this graph are projected through the
+     * vertex owners, or nil (see Graph#projection=) */
+    VALUE projection;
+    /** The graph this graph is a subset of, or nil (see Graph#parent=) */
+    VALUE parent;
+    /** If true, Graph#link_in_hierarchy refuses to create cycles in this
+     * graph (see Graph#dag=) */
+    bool dag;
+
+    RubyGraph()
+	: traversals(0), journal(0), projection(Qnil)
+	, parent(Qnil), dag(false) {}
+    ~RubyGraph() { delete journal; }
+
+    void record(int operation, VALUE source, VALUE target = Qnil, VALUE info = Qnil)
+    {
+	if (journal)
+	    journal->record(operation, journal_stamp, source, target, info);
+    }
+
+private:
+    RubyGraph(RubyGraph const&);
 };
 typedef std::map<VALUE, RubyGraph::vertex_descriptor>	graph_map;
 
+/* The vertex flags. They are maintained by the users of BGL::Vertex (e.g.
+ * Roby::Task), BGL itself only uses them as filters */
+enum VertexFlags
+{
+    VERTEX_PENDING     = 1,
+    VERTEX_RUNNING     = 2,
+    VERTEX_FINISHED    = 4
+};
+
+/* The native data attached to each vertex: the graph => descriptor map, a
+ * flag word that can be used by the algorithms to filter vertices without
+ * calling back into Ruby (see the BGL::Vertex::*_FLAG constants), and the
+ * object the vertex belongs to in the projection graphs (see
+ * BGL::Vertex#vertex_owner=)
+ */
+struct VertexData
+{
+    graph_map graphs;
+    int flags;
+    VALUE owner;
+
+    VertexData()
+	: flags(0), owner(Qnil) {}
+};
+
 inline RubyGraph& graph_wrapped(VALUE self)
 {
     RubyGraph* object = 0;
@@ -39,8 +173,106 @@ inline RubyGraph& graph_wrapped(VALUE self)
     return *object;
 }
 
+/* Raises if an algorithm is traversing +graph+ without the GVL, in which
+ * case the graph cannot be modified. The modifications of +graph+ are
+ * propagated to its projection, which is therefore checked as well */
+inline void graph_check_mutable(RubyGraph const& graph)
+{
+    if (graph.traversals > 0)
+	rb_raise(rb_eThreadError, "cannot modify a graph while it is being traversed by another thread");
+    if (!NIL_P(graph.projection))
+	graph_check_mutable(graph_wrapped(graph.projection));
+}
+
+/* Below this number of vertices, the algorithms do not bother releasing the
+ * GVL as the cost of releasing it would dominate */
+static const size_t GVL_RELEASE_THRESHOLD = 256;
+
+namespace details
+{
+    template<typename F>
+    struct CallWithoutGVL
+    {
+	F& f;
+	bool called;
+    };
+
+    template<typename F>
+    void* call_functor(void* arg)
+    {
+	CallWithoutGVL<F>& call = *static_cast<CallWithoutGVL<F>*>(arg);
+	call.called = true;
+	call.f();
+	return 0;
+    }
+}
+
+/* True if the graphs are large enough for graphs_call_without_gvl to release
+ * the GVL */
+inline bool graphs_release_gvl_p(std::vector<RubyGraph*> const& graphs)
+{
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+    size_t size = 0;
+    for (std::vector<RubyGraph*>::const_iterator it = graphs.begin(); it != graphs.end(); ++it)
+	size += num_vertices(**it);
+    return size >= GVL_RELEASE_THRESHOLD;
+#else
+    return false;
+#endif
+}
+
+/* Calls +f+ while not holding the GVL, so that the other Ruby threads (the
+ * logger, the shell server, ...) can run while +f+ is traversing +graphs+.
+ *
+ * +f+ must not access any Ruby object nor allocate memory through Ruby (in
+ * particular, it cannot create ValueSet objects), and must not throw. The
+ * graphs are protected against modifications for the duration of the call.
+ *
+ * This function never raises. The interrupts (Thread#raise, signals) that
+ * arrive in the meantime are left pending, and are processed by the
+ * interpreter after the calling method returned, i.e. once its C++ objects
+ * are destroyed.
+ */
+template<typename F>
+void graphs_call_without_gvl(std::vector<RubyGraph*> const& graphs, F& f)
+{
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+    if (graphs_release_gvl_p(graphs))
+    {
+	details::CallWithoutGVL<F> call = { f, false };
+	for (std::vector<RubyGraph*>::const_iterator it = graphs.begin(); it != graphs.end(); ++it)
+	    ++(*it)->traversals;
+	rb_thread_call_without_gvl2(details::call_functor<F>, &call, RUBY_UBF_IO, 0);
+	for (std::vector<RubyGraph*>::const_iterator it = graphs.begin(); it != graphs.end(); ++it)
+	    --(*it)->traversals;
+
+	// rb_thread_call_without_gvl2 does not call +f+ at all if an
+	// interrupt is already pending
+	if (call.called)
+	    return;
+    }
+#endif
+    f();
+}
+
+/* Single-graph version of graphs_call_without_gvl */
+template<typename F>
+void graph_call_without_gvl(RubyGraph& graph, F& f)
+{
+    std::vector<RubyGraph*> graphs(1, &graph);
+    graphs_call_without_gvl(graphs, f);
+}
+
+extern VertexData* vertex_data(VALUE self, bool create);
 extern graph_map* vertex_descriptor_map(VALUE self, bool create);
 
+/* Returns the flags of +vertex+ */
+inline int vertex_flags(VALUE vertex)
+{
+    VertexData* data = vertex_data(vertex, false);
+    return data ? data->flags : 0;
+}
+
 /* Return the vertex_descriptor of +self+ in +graph+. The boolean is true if
  * +self+ is in graph, and false otherwise.
  */
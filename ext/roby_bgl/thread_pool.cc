@@ -0,0 +1,206 @@
+#include "thread_pool.hh"
+#include <unistd.h>
+
+ThreadPool* ThreadPool::global = 0;
+pid_t ThreadPool::global_pid = 0;
+size_t ThreadPool::users = 0;
+
+ThreadPool& ThreadPool::instance()
+{
+    // The threads do not survive a fork. The pool of the parent process is
+    // leaked in the child, as it cannot be cleanly destroyed there
+    if (!global || global_pid != getpid())
+    {
+	global = new ThreadPool(default_size());
+	global_pid = getpid();
+    }
+    return *global;
+}
+
+bool ThreadPool::resize(size_t size)
+{
+    if (size == 0)
+	size = default_size();
+    if (global && global_pid == getpid())
+    {
+	if (global->size() == size)
+	    return true;
+	if (users > 0)
+	    return false;
+	delete global;
+    }
+    else if (global)
+    {
+	// The users of the parent process do not exist in a forked child
+	users = 0;
+    }
+    global = new ThreadPool(size);
+    global_pid = getpid();
+    return true;
+}
+
+size_t ThreadPool::default_size()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+}
+
+ThreadPool::ThreadPool(size_t size)
+    : generation(0), remaining(0), quit(false)
+{
+    if (size == 0)
+	size = 1;
+
+    pthread_mutex_init(&run_lock, 0);
+    pthread_mutex_init(&lock, 0);
+    pthread_cond_init(&wakeup, 0);
+    pthread_cond_init(&finished, 0);
+
+    for (size_t i = 0; i < size; ++i)
+    {
+	Queue* queue = new Queue;
+	pthread_mutex_init(&queue->lock, 0);
+	queues.push_back(queue);
+    }
+
+    // Worker 0 is the thread that calls run()
+    for (size_t i = 1; i < size; ++i)
+    {
+	Thread* thread = new Thread;
+	thread->pool   = this;
+	thread->worker = i;
+	if (pthread_create(&thread->id, 0, &ThreadPool::thread_main, thread) != 0)
+	{
+	    delete thread;
+	    break;
+	}
+	threads.push_back(thread);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    pthread_mutex_lock(&lock);
+    quit = true;
+    pthread_cond_broadcast(&wakeup);
+    pthread_mutex_unlock(&lock);
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+	pthread_join(threads[i]->id, 0);
+	delete threads[i];
+    }
+    for (size_t i = 0; i < queues.size(); ++i)
+    {
+	pthread_mutex_destroy(&queues[i]->lock);
+	delete queues[i];
+    }
+
+    pthread_cond_destroy(&finished);
+    pthread_cond_destroy(&wakeup);
+    pthread_mutex_destroy(&lock);
+    pthread_mutex_destroy(&run_lock);
+}
+
+void ThreadPool::run(std::vector<Job*> const& jobs)
+{
+    if (jobs.empty())
+	return;
+
+    pthread_mutex_lock(&run_lock);
+
+    // This must be set before the jobs are queued, as threads that are
+    // still looking for work from the previous run might pick them up
+    pthread_mutex_lock(&lock);
+    remaining = jobs.size();
+    pthread_mutex_unlock(&lock);
+
+    // Spread the jobs on the queues. The threads that have less work steal
+    // it from the others
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+	Queue& queue = *queues[i % queues.size()];
+	pthread_mutex_lock(&queue.lock);
+	queue.jobs.push_back(jobs[i]);
+	pthread_mutex_unlock(&queue.lock);
+    }
+
+    pthread_mutex_lock(&lock);
+    ++generation;
+    pthread_cond_broadcast(&wakeup);
+    pthread_mutex_unlock(&lock);
+
+    work(0);
+
+    pthread_mutex_lock(&lock);
+    while (remaining > 0)
+	pthread_cond_wait(&finished, &lock);
+    pthread_mutex_unlock(&lock);
+
+    pthread_mutex_unlock(&run_lock);
+}
+
+bool ThreadPool::next_job(size_t worker, Job*& job)
+{
+    // Take the most recent job of our own queue first, and the oldest ones
+    // of the others
+    for (size_t i = 0; i < queues.size(); ++i)
+    {
+	Queue& queue = *queues[(worker + i) % queues.size()];
+	pthread_mutex_lock(&queue.lock);
+	bool found = !queue.jobs.empty();
+	if (found)
+	{
+	    if (i == 0)
+	    {
+		job = queue.jobs.back();
+		queue.jobs.pop_back();
+	    }
+	    else
+	    {
+		job = queue.jobs.front();
+		queue.jobs.pop_front();
+	    }
+	}
+	pthread_mutex_unlock(&queue.lock);
+	if (found)
+	    return true;
+    }
+    return false;
+}
+
+void ThreadPool::work(size_t worker)
+{
+    Job* job;
+    while (next_job(worker, job))
+    {
+	job->run(worker);
+
+	pthread_mutex_lock(&lock);
+	if (--remaining == 0)
+	    pthread_cond_broadcast(&finished);
+	pthread_mutex_unlock(&lock);
+    }
+}
+
+void* ThreadPool::thread_main(void* arg)
+{
+    Thread& thread = *static_cast<Thread*>(arg);
+    ThreadPool& pool = *thread.pool;
+
+    unsigned long seen_generation = 0;
+    while (true)
+    {
+	pthread_mutex_lock(&pool.lock);
+	while (!pool.quit && pool.generation == seen_generation)
+	    pthread_cond_wait(&pool.wakeup, &pool.lock);
+	bool quit = pool.quit;
+	seen_generation = pool.generation;
+	pthread_mutex_unlock(&pool.lock);
+
+	if (quit)
+	    return 0;
+	pool.work(thread.worker);
+    }
+}
+
@@ -0,0 +1,95 @@
+#ifndef RUBY_BGL_THREAD_POOL_HH
+#define RUBY_BGL_THREAD_POOL_HH
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <deque>
+#include <vector>
+
+/* A fixed-size pool of native threads used to parallelize the read-only
+ * graph algorithms. Each thread has its own job queue, and idle threads steal
+ * jobs from the other queues.
+ *
+ * The pool knows nothing about Ruby: the jobs must not call the Ruby API, and
+ * ThreadPool::run is meant to be called without the GVL.
+ */
+class ThreadPool
+{
+public:
+    struct Job
+    {
+	virtual ~Job() {}
+	/* Runs the job. +worker+ is the index of the thread that runs it, in
+	 * [0, size()), and can be used to access per-thread data */
+	virtual void run(size_t worker) = 0;
+    };
+
+    /* Marks the process-wide pool as being in use for the lifetime of the
+     * object, so that it does not get resized. Like #resize, it must only be
+     * created and destroyed by one thread at a time (i.e. with the GVL held)
+     */
+    struct Use
+    {
+	Use() { ++users; }
+	~Use() { --users; }
+    };
+
+    /* Returns the process-wide pool, creating it if needed */
+    static ThreadPool& instance();
+    /* Changes the size of the process-wide pool. Returns false, and leaves
+     * the pool unchanged, if it is in use (see Use) */
+    static bool resize(size_t size);
+    /* The number of online CPUs */
+    static size_t default_size();
+
+    explicit ThreadPool(size_t size);
+    ~ThreadPool();
+
+    /* The number of threads that run the jobs, including the calling thread */
+    size_t size() const { return queues.size(); }
+
+    /* Runs all the jobs of +jobs+ and returns once they are all finished.
+     * The calling thread runs jobs as well, as worker 0 */
+    void run(std::vector<Job*> const& jobs);
+
+private:
+    struct Queue
+    {
+	pthread_mutex_t lock;
+	std::deque<Job*> jobs;
+    };
+
+    struct Thread
+    {
+	ThreadPool* pool;
+	size_t worker;
+	pthread_t id;
+    };
+
+    std::vector<Queue*> queues;
+    std::vector<Thread*> threads;
+    /* Serializes the calls to run() */
+    pthread_mutex_t run_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t  wakeup;
+    pthread_cond_t  finished;
+    /* Incremented by run() to wake the threads up */
+    unsigned long   generation;
+    /* The count of jobs of the current run that are not finished yet */
+    size_t          remaining;
+    bool            quit;
+
+    static ThreadPool* global;
+    static pid_t global_pid;
+    static size_t users;
+
+    bool next_job(size_t worker, Job*& job);
+    void work(size_t worker);
+    static void* thread_main(void* arg);
+
+    ThreadPool(ThreadPool const&);
+    ThreadPool& operator = (ThreadPool const&);
+};
+
+#endif
+
@@ -0,0 +1,714 @@
+#include <ruby.h>
+#include <ruby/encoding.h>
+#include <climits>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <unordered_map>
+
+static VALUE mRoby;
+static VALUE mRobyDistributed;
+static VALUE mBinaryFormat;
+static VALUE mMarshal;
+static VALUE cRemoteID = Qnil;
+static ID id_RemoteID;
+static ID id_name;
+static ID id_utc_p;
+static ID id_utc_offset;
+static ID id_compare_by_identity_p;
+static ID id_default;
+static ID id_default_proc;
+static ID id_marshal_dump;
+static ID id__dump;
+static ID id_at_uri;
+static ID id_at_ref;
+static ID id_load_with_missing_constants;
+
+/* The first byte of a buffer encoded by BinaryFormat.dump. Marshal buffers
+ * start with the Marshal major version (4), which is how BinaryFormat.load
+ * tells them apart
+ */
+static const unsigned char BINARY_FORMAT_MAGIC = 0xDB;
+/* The version of the encoding, written right after the magic byte */
+static const unsigned char BINARY_FORMAT_VERSION = 1;
+
+enum BinaryTag
+{
+    TAG_NIL        = 0,
+    TAG_TRUE       = 1,
+    TAG_FALSE      = 2,
+    TAG_INT        = 3,  // zigzag-encoded varint
+    TAG_FLOAT      = 4,  // 8 bytes, host order
+    TAG_SYMBOL     = 5,  // varint size + bytes, added to the symbol table
+    TAG_SYMBOL_REF = 6,  // varint index in the symbol table
+    TAG_STRING     = 7,  // encoding byte, varint size + bytes
+    TAG_ARRAY      = 8,  // varint size + elements
+    TAG_HASH       = 9,  // varint size + key/value pairs
+    TAG_TIME       = 10, // utc flag, seconds, nanoseconds and UTC offset
+    TAG_OBJECT     = 11, // class path (as a symbol), varint size + ivar name/value pairs
+    TAG_REMOTE_ID  = 12, // URI and reference of a Roby::Distributed::RemoteID
+    TAG_LINK       = 13, // varint index in the object table
+    TAG_MARSHAL    = 14, // varint size + Marshal.dump of the object
+    TAG_MARSHAL_VALUE = 15 // same as TAG_MARSHAL, but not added to the object table
+};
+
+enum StringEncoding
+{
+    STRING_BINARY   = 0,
+    STRING_UTF8     = 1,
+    STRING_US_ASCII = 2
+};
+
+static VALUE remote_id_class()
+{
+    if (NIL_P(cRemoteID) && rb_const_defined_at(mRobyDistributed, id_RemoteID))
+        cRemoteID = rb_const_get_at(mRobyDistributed, id_RemoteID);
+    return cRemoteID;
+}
+
+/* State of one encoding
+ *
+ * It is wrapped in a Ruby object so that the tables get freed by the GC if one
+ * of the Ruby calls made during encoding raises.
+ *
+ * The encoding is appended to +out+, which points either to +data+ or to a
+ * buffer provided by the caller (see binary_format_encode).
+ *
+ * +objects+ maps the heap objects that have already been encoded to their
+ * index in the object table, so that later occurrences are encoded as links
+ * (as Marshal does). +symbols+ does the same for symbols, and +plain_classes+
+ * caches whether the instances of a class can be encoded ivar by ivar.
+ */
+struct BinaryEncoder
+{
+    std::string* out;
+    std::string data;
+    std::unordered_map<VALUE, long> objects;
+    std::unordered_map<VALUE, long> symbols;
+    std::unordered_map<VALUE, bool> plain_classes;
+};
+
+static void binary_encoder_mark(BinaryEncoder* encoder)
+{
+    typedef std::unordered_map<VALUE, long> Table;
+    for (Table::const_iterator it = encoder->objects.begin(); it != encoder->objects.end(); ++it)
+        rb_gc_mark(it->first);
+    for (Table::const_iterator it = encoder->symbols.begin(); it != encoder->symbols.end(); ++it)
+        rb_gc_mark(it->first);
+}
+
+static void binary_encoder_free(BinaryEncoder* encoder)
+{ delete encoder; }
+
+static void write_bytes(BinaryEncoder& encoder, void const* data, long size)
+{ encoder.out->append(reinterpret_cast<char const*>(data), size); }
+
+static void write_byte(BinaryEncoder& encoder, unsigned char byte)
+{ write_bytes(encoder, &byte, 1); }
+
+static void write_varint(BinaryEncoder& encoder, unsigned long long value)
+{
+    unsigned char bytes[10];
+    int size = 0;
+    do
+    {
+        unsigned char byte = value & 0x7F;
+        value >>= 7;
+        bytes[size++] = value ? (byte | 0x80) : byte;
+    }
+    while (value);
+    write_bytes(encoder, bytes, size);
+}
+
+static void write_signed_varint(BinaryEncoder& encoder, long long value)
+{ write_varint(encoder, (static_cast<unsigned long long>(value) << 1) ^ static_cast<unsigned long long>(value >> 63)); }
+
+static void encode_value(BinaryEncoder& encoder, VALUE object);
+
+static void encode_symbol(BinaryEncoder& encoder, VALUE symbol)
+{
+    std::unordered_map<VALUE, long>::const_iterator it = encoder.symbols.find(symbol);
+    if (it != encoder.symbols.end())
+    {
+        write_byte(encoder, TAG_SYMBOL_REF);
+        write_varint(encoder, it->second);
+        return;
+    }
+
+    VALUE name = rb_sym2str(symbol);
+    long index = encoder.symbols.size();
+    encoder.symbols[symbol] = index;
+    write_byte(encoder, TAG_SYMBOL);
+    write_varint(encoder, RSTRING_LEN(name));
+    write_bytes(encoder, RSTRING_PTR(name), RSTRING_LEN(name));
+}
+
+/* Returns true if +symbol+ can be encoded as a UTF-8 byte sequence */
+static bool encodable_symbol_p(VALUE symbol)
+{
+    VALUE name = rb_sym2str(symbol);
+    int encoding = rb_enc_get_index(name);
+    return encoding == rb_utf8_encindex() || encoding == rb_usascii_encindex();
+}
+
+static bool encodable_string_p(VALUE string, StringEncoding& encoding)
+{
+    if (rb_obj_class(string) != rb_cString || rb_ivar_count(string) != 0)
+        return false;
+
+    int index = rb_enc_get_index(string);
+    if (index == rb_utf8_encindex())
+        encoding = STRING_UTF8;
+    else if (index == rb_ascii8bit_encindex())
+        encoding = STRING_BINARY;
+    else if (index == rb_usascii_encindex())
+        encoding = STRING_US_ASCII;
+    else
+        return false;
+    return true;
+}
+
+/* Returns true if +object+ is a plain object that can be encoded ivar by ivar,
+ * i.e. an instance of a named class that does not customize its marshalling
+ */
+static bool plain_object_p(BinaryEncoder& encoder, VALUE object)
+{
+    VALUE klass = rb_class_of(object);
+    std::unordered_map<VALUE, bool>::const_iterator it = encoder.plain_classes.find(klass);
+    if (it != encoder.plain_classes.end())
+        return it->second;
+
+    bool plain = !FL_TEST(klass, FL_SINGLETON) &&
+        !NIL_P(rb_funcall(klass, id_name, 0)) &&
+        !rb_obj_respond_to(object, id_marshal_dump, TRUE) &&
+        !rb_obj_respond_to(object, id__dump, TRUE);
+    encoder.plain_classes[klass] = plain;
+    return plain;
+}
+
+/* Returns true if +hash+ is a Hash without default value nor custom
+ * comparison, i.e. one that can be rebuilt only from its key/value pairs
+ */
+static bool plain_hash_p(VALUE hash)
+{
+    return rb_obj_class(hash) == rb_cHash && rb_ivar_count(hash) == 0 &&
+        NIL_P(rb_funcall(hash, id_default_proc, 0)) &&
+        NIL_P(rb_funcall(hash, id_default, 0)) &&
+        !RTEST(rb_funcall(hash, id_compare_by_identity_p, 0));
+}
+
+static int collect_ivar(ID name, VALUE value, VALUE ivars)
+{
+    rb_ary_push(ivars, ID2SYM(name));
+    rb_ary_push(ivars, value);
+    return ST_CONTINUE;
+}
+
+static int encode_hash_element(VALUE key, VALUE value, VALUE encoder_ptr)
+{
+    BinaryEncoder& encoder = *reinterpret_cast<BinaryEncoder*>(encoder_ptr);
+    encode_value(encoder, key);
+    encode_value(encoder, value);
+    return ST_CONTINUE;
+}
+
+static void encode_time(BinaryEncoder& encoder, VALUE time)
+{
+    struct timespec ts = rb_time_timespec(time);
+    bool utc = RTEST(rb_funcall(time, id_utc_p, 0));
+    write_byte(encoder, TAG_TIME);
+    write_byte(encoder, utc ? 1 : 0);
+    write_signed_varint(encoder, ts.tv_sec);
+    write_varint(encoder, ts.tv_nsec);
+    if (!utc)
+        write_signed_varint(encoder, NUM2LONG(rb_funcall(time, id_utc_offset, 0)));
+}
+
+static void encode_marshal(BinaryEncoder& encoder, VALUE object, unsigned char tag = TAG_MARSHAL)
+{
+    VALUE marshalled = rb_marshal_dump(object, Qnil);
+    write_byte(encoder, tag);
+    write_varint(encoder, RSTRING_LEN(marshalled));
+    write_bytes(encoder, RSTRING_PTR(marshalled), RSTRING_LEN(marshalled));
+}
+
+static void encode_value(BinaryEncoder& encoder, VALUE object)
+{
+    if (NIL_P(object))
+        return write_byte(encoder, TAG_NIL);
+    else if (object == Qtrue)
+        return write_byte(encoder, TAG_TRUE);
+    else if (object == Qfalse)
+        return write_byte(encoder, TAG_FALSE);
+    else if (FIXNUM_P(object))
+    {
+        write_byte(encoder, TAG_INT);
+        return write_signed_varint(encoder, FIX2LONG(object));
+    }
+    else if (RB_FLOAT_TYPE_P(object))
+    {
+        double value = RFLOAT_VALUE(object);
+        write_byte(encoder, TAG_FLOAT);
+        return write_bytes(encoder, &value, sizeof(value));
+    }
+    else if (SYMBOL_P(object))
+    {
+        if (encoder.symbols.count(object) || encodable_symbol_p(object))
+            return encode_symbol(encoder, object);
+        return encode_marshal(encoder, object, TAG_MARSHAL_VALUE);
+    }
+    else if (SPECIAL_CONST_P(object))
+        return encode_marshal(encoder, object, TAG_MARSHAL_VALUE);
+
+    std::unordered_map<VALUE, long>::const_iterator it = encoder.objects.find(object);
+    if (it != encoder.objects.end())
+    {
+        write_byte(encoder, TAG_LINK);
+        return write_varint(encoder, it->second);
+    }
+    // Objects are registered before their content gets encoded, which is
+    // also the order in which the decoder creates them
+    long index = encoder.objects.size();
+    encoder.objects[object] = index;
+
+    StringEncoding string_encoding;
+    int type = BUILTIN_TYPE(object);
+    if (type == T_STRING && encodable_string_p(object, string_encoding))
+    {
+        write_byte(encoder, TAG_STRING);
+        write_byte(encoder, string_encoding);
+        write_varint(encoder, RSTRING_LEN(object));
+        write_bytes(encoder, RSTRING_PTR(object), RSTRING_LEN(object));
+    }
+    else if (type == T_ARRAY && rb_obj_class(object) == rb_cArray && rb_ivar_count(object) == 0)
+    {
+        long size = RARRAY_LEN(object);
+        write_byte(encoder, TAG_ARRAY);
+        write_varint(encoder, size);
+        for (long i = 0; i < size; ++i)
+            encode_value(encoder, RARRAY_AREF(object, i));
+    }
+    else if (type == T_HASH && plain_hash_p(object))
+    {
+        write_byte(encoder, TAG_HASH);
+        write_varint(encoder, RHASH_SIZE(object));
+        rb_hash_foreach(object, encode_hash_element, reinterpret_cast<VALUE>(&encoder));
+    }
+    else if (rb_obj_class(object) == rb_cTime && rb_ivar_count(object) == 0)
+        encode_time(encoder, object);
+    else if (!NIL_P(remote_id_class()) && rb_obj_class(object) == cRemoteID)
+    {
+        write_byte(encoder, TAG_REMOTE_ID);
+        encode_value(encoder, rb_ivar_get(object, id_at_uri));
+        encode_value(encoder, rb_ivar_get(object, id_at_ref));
+    }
+    else if (type == T_OBJECT && plain_object_p(encoder, object))
+    {
+        VALUE ivars = rb_ary_new();
+        rb_ivar_foreach(object, collect_ivar, ivars);
+
+        write_byte(encoder, TAG_OBJECT);
+        encode_symbol(encoder, rb_str_intern(rb_class_path(rb_obj_class(object))));
+        long size = RARRAY_LEN(ivars) / 2;
+        write_varint(encoder, size);
+        for (long i = 0; i < size; ++i)
+        {
+            encode_symbol(encoder, RARRAY_AREF(ivars, 2 * i));
+            encode_value(encoder, RARRAY_AREF(ivars, 2 * i + 1));
+        }
+    }
+    else
+        encode_marshal(encoder, object);
+}
+
+static void binary_format_encode(VALUE object, BinaryEncoder& encoder)
+{
+    write_byte(encoder, BINARY_FORMAT_MAGIC);
+    write_byte(encoder, BINARY_FORMAT_VERSION);
+    encode_value(encoder, object);
+
+    // Release the tables right away instead of waiting for the GC
+    encoder.objects.clear();
+    encoder.symbols.clear();
+    encoder.plain_classes.clear();
+}
+
+/* Appends the encoding of +object+ to +out+, as BinaryFormat.dump would
+ *
+ * If the encoding raises, +out+ is left with a partial encoding that the
+ * caller has to discard. It must stay allocated until then.
+ */
+void binary_format_encode(VALUE object, std::string& out)
+{
+    BinaryEncoder* encoder = new BinaryEncoder;
+    encoder->out = &out;
+    VALUE encoder_holder = Data_Wrap_Struct(rb_cObject, binary_encoder_mark, binary_encoder_free, encoder);
+    binary_format_encode(object, *encoder);
+    RB_GC_GUARD(encoder_holder);
+}
+
+/* call-seq:
+ *   BinaryFormat.dump(object, buffer = nil) => buffer
+ *
+ * Encodes +object+ and appends the result to +buffer+ (a new String if
+ * +buffer+ is nil). The object should already have been formatted by
+ * Distributed.format.
+ *
+ * The encoding handles the types that make most of the droby traffic (nil,
+ * booleans, fixnums, floats, symbols, strings, arrays, hashes, times, RemoteID
+ * and plain objects) and embeds a Marshal dump for anything else. As Marshal
+ * does, it encodes repeated objects as links to their first occurrence.
+ */
+static VALUE binary_format_dump(int argc, VALUE* argv, VALUE self)
+{
+    VALUE object, buffer;
+    rb_scan_args(argc, argv, "11", &object, &buffer);
+    if (NIL_P(buffer))
+        buffer = rb_str_buf_new(256);
+    else
+        StringValue(buffer);
+    rb_enc_associate_index(buffer, rb_ascii8bit_encindex());
+
+    BinaryEncoder* encoder = new BinaryEncoder;
+    encoder->out = &encoder->data;
+    VALUE encoder_holder = Data_Wrap_Struct(rb_cObject, binary_encoder_mark, binary_encoder_free, encoder);
+    binary_format_encode(object, *encoder);
+
+    rb_str_buf_cat(buffer, encoder->data.data(), encoder->data.size());
+    encoder->data.clear();
+    RB_GC_GUARD(encoder_holder);
+    return buffer;
+}
+
+/* State of one BinaryFormat.load call
+ *
+ * The tables are Ruby objects, so that the decoder can be abandoned at any
+ * point if one of the Ruby calls it makes raises
+ */
+struct BinaryDecoder
+{
+    char const* ptr;
+    char const* end;
+    VALUE objects;
+    VALUE symbols;
+    VALUE classes;
+    bool missing_constants;
+};
+
+static void truncated_buffer()
+{ rb_raise(rb_eArgError, "truncated BinaryFormat buffer"); }
+
+static unsigned char read_byte(BinaryDecoder& decoder)
+{
+    if (decoder.ptr == decoder.end)
+        truncated_buffer();
+    return *(decoder.ptr++);
+}
+
+static char const* read_bytes(BinaryDecoder& decoder, unsigned long long size)
+{
+    if (static_cast<unsigned long long>(decoder.end - decoder.ptr) < size)
+        truncated_buffer();
+    char const* bytes = decoder.ptr;
+    decoder.ptr += size;
+    return bytes;
+}
+
+static unsigned long long read_varint(BinaryDecoder& decoder)
+{
+    unsigned long long value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        unsigned char byte = read_byte(decoder);
+        value |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+    rb_raise(rb_eArgError, "invalid varint in BinaryFormat buffer");
+    return 0;
+}
+
+static long long read_signed_varint(BinaryDecoder& decoder)
+{
+    unsigned long long value = read_varint(decoder);
+    return static_cast<long long>(value >> 1) ^ -static_cast<long long>(value & 1);
+}
+
+static VALUE decode_value(BinaryDecoder& decoder);
+
+static VALUE decode_symbol(BinaryDecoder& decoder, unsigned char tag)
+{
+    if (tag == TAG_SYMBOL_REF)
+    {
+        unsigned long long index = read_varint(decoder);
+        if (index >= static_cast<unsigned long long>(RARRAY_LEN(decoder.symbols)))
+            rb_raise(rb_eArgError, "invalid symbol reference in BinaryFormat buffer");
+        return RARRAY_AREF(decoder.symbols, index);
+    }
+    else if (tag == TAG_SYMBOL)
+    {
+        unsigned long long size = read_varint(decoder);
+        char const* name = read_bytes(decoder, size);
+        VALUE symbol = rb_str_intern(rb_utf8_str_new(name, size));
+        rb_ary_push(decoder.symbols, symbol);
+        return symbol;
+    }
+    rb_raise(rb_eArgError, "expected a symbol in BinaryFormat buffer, got tag %i", tag);
+    return Qnil;
+}
+
+/* Builds a Marshal dump of a reference to the class called +path+, which is
+ * loaded with Marshal.load_with_missing_constants to resolve classes that are
+ * not defined in this process
+ */
+static VALUE marshalled_class_reference(VALUE path)
+{
+    VALUE marshalled = rb_str_new("\x04\x08" "c", 3);
+    long size = RSTRING_LEN(path);
+    // Marshal's encoding of positive integers
+    if (size < 123)
+    {
+        char byte = static_cast<char>(size + 5);
+        rb_str_buf_cat(marshalled, &byte, 1);
+    }
+    else
+    {
+        char bytes[9];
+        int count = 0;
+        for (long remaining = size; remaining; remaining >>= 8)
+            bytes[++count] = static_cast<char>(remaining & 0xFF);
+        bytes[0] = static_cast<char>(count);
+        rb_str_buf_cat(marshalled, bytes, count + 1);
+    }
+    rb_str_buf_append(marshalled, path);
+    return marshalled;
+}
+
+static VALUE resolve_class(BinaryDecoder& decoder, VALUE path_symbol)
+{
+    VALUE klass = rb_hash_lookup2(decoder.classes, path_symbol, Qundef);
+    if (klass != Qundef)
+        return klass;
+
+    VALUE path = rb_sym2str(path_symbol);
+    if (decoder.missing_constants)
+        klass = rb_funcall(mMarshal, id_load_with_missing_constants, 1, marshalled_class_reference(path));
+    else
+        klass = rb_path_to_class(path);
+    rb_hash_aset(decoder.classes, path_symbol, klass);
+    return klass;
+}
+
+/* Reserves the next slot in the object table, so that the objects are
+ * registered in the order in which the encoder saw them
+ */
+static long reserve_object(BinaryDecoder& decoder)
+{
+    long index = RARRAY_LEN(decoder.objects);
+    rb_ary_push(decoder.objects, Qnil);
+    return index;
+}
+
+static VALUE register_object(BinaryDecoder& decoder, long index, VALUE object)
+{
+    rb_ary_store(decoder.objects, index, object);
+    return object;
+}
+
+static VALUE decode_time(BinaryDecoder& decoder)
+{
+    bool utc = read_byte(decoder);
+    struct timespec ts;
+    ts.tv_sec  = read_signed_varint(decoder);
+    ts.tv_nsec = read_varint(decoder);
+    if (utc)
+        return rb_time_timespec_new(&ts, INT_MAX - 1);
+
+    long offset = read_signed_varint(decoder);
+    VALUE time = rb_time_timespec_new(&ts, INT_MAX);
+    if (NUM2LONG(rb_funcall(time, id_utc_offset, 0)) != offset)
+        time = rb_time_timespec_new(&ts, offset);
+    return time;
+}
+
+static VALUE decode_marshal(BinaryDecoder& decoder)
+{
+    unsigned long long size = read_varint(decoder);
+    char const* data = read_bytes(decoder, size);
+    VALUE marshalled = rb_str_new(data, size);
+    if (decoder.missing_constants)
+        return rb_funcall(mMarshal, id_load_with_missing_constants, 1, marshalled);
+    else
+        return rb_marshal_load(marshalled);
+}
+
+static VALUE decode_value(BinaryDecoder& decoder)
+{
+    unsigned char tag = read_byte(decoder);
+    switch (tag)
+    {
+        case TAG_NIL:   return Qnil;
+        case TAG_TRUE:  return Qtrue;
+        case TAG_FALSE: return Qfalse;
+        case TAG_INT:   return LL2NUM(read_signed_varint(decoder));
+        case TAG_FLOAT:
+        {
+            double value;
+            memcpy(&value, read_bytes(decoder, sizeof(value)), sizeof(value));
+            return DBL2NUM(value);
+        }
+        case TAG_SYMBOL:
+        case TAG_SYMBOL_REF:
+            return decode_symbol(decoder, tag);
+        case TAG_LINK:
+        {
+            unsigned long long index = read_varint(decoder);
+            if (index >= static_cast<unsigned long long>(RARRAY_LEN(decoder.objects)))
+                rb_raise(rb_eArgError, "invalid object link in BinaryFormat buffer");
+            return RARRAY_AREF(decoder.objects, index);
+        }
+        case TAG_STRING:
+        {
+            long index = reserve_object(decoder);
+            unsigned char encoding = read_byte(decoder);
+            unsigned long long size = read_varint(decoder);
+            VALUE string = rb_str_new(read_bytes(decoder, size), size);
+            if (encoding == STRING_UTF8)
+                rb_enc_associate_index(string, rb_utf8_encindex());
+            else if (encoding == STRING_US_ASCII)
+                rb_enc_associate_index(string, rb_usascii_encindex());
+            return register_object(decoder, index, string);
+        }
+        case TAG_ARRAY:
+        {
+            unsigned long long size = read_varint(decoder);
+            if (size > static_cast<unsigned long long>(decoder.end - decoder.ptr))
+                truncated_buffer();
+            VALUE array = register_object(decoder, reserve_object(decoder), rb_ary_new2(size));
+            for (unsigned long long i = 0; i < size; ++i)
+                rb_ary_push(array, decode_value(decoder));
+            return array;
+        }
+        case TAG_HASH:
+        {
+            unsigned long long size = read_varint(decoder);
+            VALUE hash = register_object(decoder, reserve_object(decoder), rb_hash_new());
+            for (unsigned long long i = 0; i < size; ++i)
+            {
+                VALUE key = decode_value(decoder);
+                rb_hash_aset(hash, key, decode_value(decoder));
+            }
+            return hash;
+        }
+        case TAG_TIME:
+        {
+            long index = reserve_object(decoder);
+            return register_object(decoder, index, decode_time(decoder));
+        }
+        case TAG_REMOTE_ID:
+        {
+            long index = reserve_object(decoder);
+            VALUE args[2];
+            args[0] = decode_value(decoder);
+            args[1] = decode_value(decoder);
+            if (NIL_P(remote_id_class()))
+                rb_raise(rb_eArgError, "cannot decode a RemoteID: Roby::Distributed::RemoteID is not defined");
+            return register_object(decoder, index, rb_class_new_instance(2, args, cRemoteID));
+        }
+        case TAG_OBJECT:
+        {
+            long index = reserve_object(decoder);
+            VALUE klass = resolve_class(decoder, decode_symbol(decoder, read_byte(decoder)));
+            if (TYPE(klass) != T_CLASS)
+                rb_raise(rb_eArgError, "BinaryFormat buffer refers to %s, which is not a class", rb_class2name(klass));
+            VALUE object = register_object(decoder, index, rb_obj_alloc(klass));
+            unsigned long long size = read_varint(decoder);
+            for (unsigned long long i = 0; i < size; ++i)
+            {
+                VALUE name = decode_symbol(decoder, read_byte(decoder));
+                rb_ivar_set(object, SYM2ID(name), decode_value(decoder));
+            }
+            return object;
+        }
+        case TAG_MARSHAL:
+        {
+            long index = reserve_object(decoder);
+            return register_object(decoder, index, decode_marshal(decoder));
+        }
+        case TAG_MARSHAL_VALUE:
+            return decode_marshal(decoder);
+    }
+    rb_raise(rb_eArgError, "invalid tag %i in BinaryFormat buffer", tag);
+    return Qnil;
+}
+
+/* call-seq:
+ *   BinaryFormat.load(buffer, missing_constants = false) => object
+ *
+ * Decodes a buffer generated by BinaryFormat.dump. For backward compatibility,
+ * +buffer+ can also be the output of Marshal.dump.
+ *
+ * If +missing_constants+ is true, the classes that are not defined in this
+ * process are resolved as Marshal.load_with_missing_constants does
+ */
+static VALUE binary_format_load(int argc, VALUE* argv, VALUE self)
+{
+    VALUE buffer, missing_constants;
+    rb_scan_args(argc, argv, "11", &buffer, &missing_constants);
+    StringValue(buffer);
+
+    char const* data = RSTRING_PTR(buffer);
+    long size = RSTRING_LEN(buffer);
+    if (size == 0 || static_cast<unsigned char>(data[0]) != BINARY_FORMAT_MAGIC)
+    {
+        if (RTEST(missing_constants))
+            return rb_funcall(mMarshal, id_load_with_missing_constants, 1, buffer);
+        else
+            return rb_marshal_load(buffer);
+    }
+    if (size < 2 || static_cast<unsigned char>(data[1]) != BINARY_FORMAT_VERSION)
+        rb_raise(rb_eArgError, "unsupported BinaryFormat version");
+
+    // Decode from a frozen copy, so that the pointers stay valid whatever
+    // the Ruby calls made during decoding do with +buffer+
+    VALUE source = rb_str_new_frozen(buffer);
+    BinaryDecoder decoder = { RSTRING_PTR(source) + 2, RSTRING_PTR(source) + RSTRING_LEN(source),
+        rb_ary_new(), rb_ary_new(), rb_hash_new(), RTEST(missing_constants) };
+    VALUE result = decode_value(decoder);
+    if (decoder.ptr != decoder.end)
+        rb_raise(rb_eArgError, "trailing data after BinaryFormat object");
+
+    RB_GC_GUARD(source);
+    return result;
+}
+
+void Init_binary_format()
+{
+    id_RemoteID = rb_intern("RemoteID");
+    id_name = rb_intern("name");
+    id_utc_p = rb_intern("utc?");
+    id_utc_offset = rb_intern("utc_offset");
+    id_compare_by_identity_p = rb_intern("compare_by_identity?");
+    id_default = rb_intern("default");
+    id_default_proc = rb_intern("default_proc");
+    id_marshal_dump = rb_intern("marshal_dump");
+    id__dump = rb_intern("_dump");
+    id_at_uri = rb_intern("@uri");
+    id_at_ref = rb_intern("@ref");
+    id_load_with_missing_constants = rb_intern("load_with_missing_constants");
+
+    mMarshal = rb_const_get(rb_cObject, rb_intern("Marshal"));
+    rb_gc_register_address(&cRemoteID);
+
+    /* */
+    mRoby            = rb_define_module("Roby");
+    /* */
+    mRobyDistributed = rb_define_module_under(mRoby, "Distributed");
+    /* Compact encoding of droby-formatted objects, used by the log files and
+     * by the Roby interface */
+    mBinaryFormat    = rb_define_module_under(mRobyDistributed, "BinaryFormat");
+
+    rb_define_singleton_method(mBinaryFormat, "dump", RUBY_METHOD_FUNC(binary_format_dump), -1);
+    rb_define_singleton_method(mBinaryFormat, "load", RUBY_METHOD_FUNC(binary_format_load), -1);
+}
+
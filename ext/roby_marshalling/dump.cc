@@ -2,127 +2,276 @@
 #include <ruby/intern.h>
 #include <ruby/st.h>
 #include <set>
+#include <unordered_map>
 
 static VALUE mRoby;
 static VALUE mRobyDistributed;
+static VALUE mRobyLog = Qnil;
 static VALUE cDRbObject;
 static VALUE cSet;
 static VALUE cValueSet;
 static ID id_droby_dump;
 static ID id_remote_id;
 static ID id_append;
+static ID id_incremental_dump_p;
+static ID id_respond_to_p;
+static ID id_respond_to_missing_p;
+static ID id_Log;
+static ID id_at_known_objects;
+static ID id_unbind;
+static ID id_instance_method;
+static ID id_droby_format_context;
 
-/* 
- * Document-class: Roby::Distributed
- */
+/* The way droby_format handles the instances of a given class */
+enum DumpStrategy
+{
+    DUMP_AS_IS,
+    DUMP_DROBY,
+    DUMP_ARRAY,
+    DUMP_HASH,
+    DUMP_SET,
+    DUMP_VALUE_SET
+};
 
-/* call-seq:
- *   format(object, peer) => formatted_object
+/* Class-keyed cache of the dump strategies
  *
- * Formats +object+ so that it is ready to be dumped by Marshal.dump for
- * sending to +peer+. This means that if the object has a droby_dump method, it
- * is called to get a marshallable object which represents +object+. Moreover,
- * if +peer+ responds to #incremental_dump?(object), this is called to
- * determine wether a full dump is required or if sending a
- * Roby::Distributed::RemoteID for remote reference is enough.
+ * The keys are marked, so that a class address cannot get reused while
+ * the cache refers to it. The cache is cleared when it grows past
+ * MAX_SIZE entries, which releases the classes it was keeping alive
+ */
+struct DumpStrategyCache
+{
+    static const size_t MAX_SIZE = 4096;
+    typedef std::unordered_map<VALUE, DumpStrategy> Map;
+    Map strategies;
+};
+static DumpStrategyCache* dump_strategy_cache = 0;
+static VALUE dump_strategy_cache_holder = Qnil;
+
+static void dump_strategy_cache_mark(DumpStrategyCache* cache)
+{
+    for (DumpStrategyCache::Map::const_iterator it = cache->strategies.begin(); it != cache->strategies.end(); ++it)
+        rb_gc_mark(it->first);
+}
+
+static void dump_strategy_cache_free(DumpStrategyCache* cache)
+{ delete cache; }
+
+/* The droby_dump methods defined in this file, as UnboundMethod objects
  *
- * If the object is not a DRbObject and does not define a #droby_dump method,
- * it is proxied through a DRbObject if it present in
- * Distributed.allow_remote_access. Otherwise, we will try to dump it as-is.
+ * They are used to detect whether a container still uses the native
+ * droby_dump, in which case it is formatted without going through Ruby
  */
-static VALUE droby_format(int argc, VALUE* argv, VALUE self)
+static VALUE native_droby_dumps = Qnil;
+
+static DumpStrategy native_dump_strategy(VALUE object)
 {
-    VALUE object, destination;
-    rb_scan_args(argc, argv, "11", &object, &destination);
+    static const DumpStrategy strategies[4] = { DUMP_ARRAY, DUMP_HASH, DUMP_SET, DUMP_VALUE_SET };
+    VALUE const containers[4] = { rb_cArray, rb_cHash, cSet, cValueSet };
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!RTEST(rb_obj_is_kind_of(object, containers[i])))
+            continue;
 
+        VALUE method = rb_funcall(rb_obj_method(object, ID2SYM(id_droby_dump)), id_unbind, 0);
+        if (RTEST(rb_equal(method, RARRAY_AREF(native_droby_dumps, i))))
+            return strategies[i];
+        break;
+    }
+    return DUMP_DROBY;
+}
+
+static DumpStrategy compute_dump_strategy(VALUE object)
+{
     if (RTEST(rb_obj_is_kind_of(object, cDRbObject)))
-	return object;
+	return DUMP_AS_IS;
+    else if (RTEST(rb_respond_to(object, id_droby_dump)))
+        return native_dump_strategy(object);
+    else
+        return DUMP_AS_IS;
+}
 
-    if (RTEST(rb_respond_to(object, id_droby_dump)))
+/* Returns true if the dump strategy of the instances of +klass+ depends only
+ * on +klass+. This is not the case for singleton classes, or for classes that
+ * customize respond_to? (e.g. mock objects)
+ */
+static bool dump_strategy_cacheable_p(VALUE klass)
+{
+    return !FL_TEST(klass, FL_SINGLETON) &&
+        rb_method_basic_definition_p(klass, id_respond_to_p) &&
+        rb_method_basic_definition_p(klass, id_respond_to_missing_p);
+}
+
+/* Returns the dump strategy for +object+, resolving it only once per class */
+static DumpStrategy dump_strategy_of(VALUE object)
+{
+    VALUE klass = rb_class_of(object);
+    DumpStrategyCache::Map& strategies = dump_strategy_cache->strategies;
+    DumpStrategyCache::Map::const_iterator it = strategies.find(klass);
+    if (it != strategies.end())
+        return it->second;
+
+    DumpStrategy strategy = compute_dump_strategy(object);
+    if (dump_strategy_cacheable_p(klass))
     {
-	if (!NIL_P(destination) && RTEST(rb_funcall(destination, rb_intern("incremental_dump?"), 1, object)))
-	    return rb_funcall(object, id_remote_id, 0);
-	return rb_funcall(object, id_droby_dump, 1, destination);
+        if (strategies.size() >= DumpStrategyCache::MAX_SIZE)
+            strategies.clear();
+        strategies[klass] = strategy;
     }
+    return strategy;
+}
 
-    return object;
+/* Clears the dump strategy cache. Called whenever a method that can change a
+ * cached strategy is (un)defined, or when a module gets included or
+ * prepended, since it can bring a droby_dump method with it
+ */
+static void clear_dump_strategy_cache()
+{
+    if (dump_strategy_cache)
+        dump_strategy_cache->strategies.clear();
 }
 
-typedef struct DROBY_DUMP_ITERATION_ARG
+static bool dump_strategy_method_p(VALUE name)
 {
-    VALUE result;
-    VALUE dest;
-} DROBY_DUMP_ITERATION_ARG;
+    if (!SYMBOL_P(name))
+        return true;
+    ID id = SYM2ID(name);
+    return id == id_droby_dump || id == id_respond_to_p || id == id_respond_to_missing_p;
+}
 
-static VALUE array_dump_element(VALUE element, DROBY_DUMP_ITERATION_ARG* arg)
-{   
-    VALUE args[2] = { element, arg->dest };
-    rb_ary_push(arg->result, droby_format(2, args, mRobyDistributed));
-    return Qnil; 
+static VALUE module_method_changed(VALUE self, VALUE name)
+{
+    if (dump_strategy_method_p(name))
+        clear_dump_strategy_cache();
+    return rb_call_super(1, &name);
 }
 
-// call-seq:
-//   droby_dump(dest) => dumped_array
-// 
-// Creates a copy of this Array with all its values formatted for marshalling
-// using Distributed.format.
-static VALUE array_droby_dump(VALUE self, VALUE dest)
+static VALUE module_features_changed(VALUE self, VALUE target)
+{
+    clear_dump_strategy_cache();
+    return rb_call_super(1, &target);
+}
+
+/* The incremental dump policy of a droby_format destination
+ *
+ * When the destination is Roby::Log, the policy is resolved to a direct lookup
+ * in Roby::Log.known_objects instead of a call to Log.incremental_dump?
+ */
+struct DumpDestination
+{
+    VALUE object;
+    std::set<VALUE> const* known_objects;
+
+    explicit DumpDestination(VALUE object)
+        : object(object), known_objects(0)
+    {
+        if (NIL_P(object))
+            return;
+
+        if (NIL_P(mRobyLog) && rb_const_defined_at(mRoby, id_Log))
+            mRobyLog = rb_const_get_at(mRoby, id_Log);
+        if (object != mRobyLog)
+            return;
+
+        VALUE known = rb_ivar_get(object, id_at_known_objects);
+        if (rb_obj_class(known) == cValueSet)
+            Data_Get_Struct(known, std::set<VALUE>, known_objects);
+    }
+
+    bool incremental_dump_p(VALUE value) const
+    {
+        if (NIL_P(object))
+            return false;
+        else if (known_objects)
+            return known_objects->find(value) != known_objects->end();
+        else
+            return RTEST(rb_funcall(object, id_incremental_dump_p, 1, value));
+    }
+};
+
+/* State shared by all the formatting done on behalf of one call to
+ * Distributed.format or #droby_dump
+ *
+ * +memo+ maps the objects that have already been formatted to their formatted
+ * version (by identity), so that an object that appears several times is
+ * formatted only once. Since all occurrences then share the same formatted
+ * object, Marshal dumps the later ones as references to the first one.
+ *
+ * It is wrapped in a Ruby object, which marks both the destination and the
+ * memo, and is made the current context of the thread during formatting.
+ */
+struct FormatContext
 {
-    VALUE result = rb_ary_new();
-    struct RArray* array = RARRAY(self);
-    int i;
+    typedef std::unordered_map<VALUE, VALUE> Memo;
 
-    VALUE el[2] = { Qnil, dest };
-    for (i = 0; i < RARRAY_LEN(array); ++i)
+    DumpDestination destination;
+    Memo memo;
+
+    explicit FormatContext(VALUE destination)
+        : destination(destination) {}
+};
+
+static void format_context_mark(FormatContext* context)
+{
+    rb_gc_mark(context->destination.object);
+    for (FormatContext::Memo::const_iterator it = context->memo.begin(); it != context->memo.end(); ++it)
     {
-	el[0] = RARRAY_PTR(array)[i];
-	rb_ary_push(result, droby_format(2, el, mRobyDistributed));
+        rb_gc_mark(it->first);
+        rb_gc_mark(it->second);
     }
+}
+
+static void format_context_free(FormatContext* context)
+{ delete context; }
 
+typedef VALUE (*FormatFunction)(VALUE, FormatContext&);
+
+static VALUE format_value(VALUE object, FormatContext& context);
+
+static VALUE format_array(VALUE self, FormatContext& context)
+{
+    long size = RARRAY_LEN(self);
+    VALUE result = rb_ary_new2(size);
+    for (long i = 0; i < RARRAY_LEN(self); ++i)
+	rb_ary_push(result, format_value(RARRAY_AREF(self, i), context));
     return result;
 }
 
+typedef struct DROBY_DUMP_ITERATION_ARG
+{
+    VALUE result;
+    FormatContext* context;
+} DROBY_DUMP_ITERATION_ARG;
+
 static int hash_dump_element(VALUE key, VALUE value, DROBY_DUMP_ITERATION_ARG* arg)
 {
-    VALUE args_key[2] = { key, arg->dest };
-    key = droby_format(2, args_key, mRobyDistributed);
-    VALUE args_value[2] = { value, arg->dest };
-    value = droby_format(2, args_value, mRobyDistributed);
+    key = format_value(key, *arg->context);
+    value = format_value(value, *arg->context);
     rb_hash_aset(arg->result, key, value);
     return ST_CONTINUE;
 }
 
-// call-seq:
-//   droby_dump => dumped_hash
-// 
-// Creates a copy of this Hash with all its values formatted for marshalling
-// using Distributed.format. The keys are not modified.
-static VALUE hash_droby_dump(VALUE self, VALUE dest)
+static VALUE format_hash(VALUE self, FormatContext& context)
 {
-    DROBY_DUMP_ITERATION_ARG arg = { rb_hash_new(), dest };
+    DROBY_DUMP_ITERATION_ARG arg = { rb_hash_new(), &context };
     rb_hash_foreach(self, (int(*)(ANYARGS)) hash_dump_element, (VALUE)&arg);
     return arg.result;
 }
 
 static VALUE appendable_dump_element(VALUE value, DROBY_DUMP_ITERATION_ARG* arg)
 {
-    VALUE args[2] = { value, arg->dest };
-    rb_funcall(arg->result, id_append, 1, droby_format(2, args, mRobyDistributed));
+    rb_funcall(arg->result, id_append, 1, format_value(value, *arg->context));
     return Qnil;
 }
 
-// Creates a copy of this Set with all its values formatted for marshalling
-// using Distributed.format
-static VALUE set_droby_dump(VALUE self, VALUE dest)
+static VALUE format_set(VALUE self, FormatContext& context)
 {
-    DROBY_DUMP_ITERATION_ARG arg = { rb_class_new_instance(0, 0, cSet), dest };
+    DROBY_DUMP_ITERATION_ARG arg = { rb_class_new_instance(0, 0, cSet), &context };
     rb_iterate(rb_each, self, RUBY_METHOD_FUNC(appendable_dump_element), (VALUE)&arg);
     return arg.result;
 }
 
-// Creates a copy of this ValueSet with all its values formatted for
-// marshalling using Distributed.format
-static VALUE value_set_droby_dump(VALUE self, VALUE dest)
+static VALUE format_value_set(VALUE self, FormatContext& context)
 {
     VALUE result = rb_class_new_instance(0, 0, cValueSet);
     std::set<VALUE>* result_set;
@@ -131,21 +280,176 @@ static VALUE value_set_droby_dump(VALUE self, VALUE dest)
     std::set<VALUE> const * source_set;
     Data_Get_Struct(self, std::set<VALUE>, source_set);
 
-    VALUE el[2] = { Qnil, dest };
     for (std::set<VALUE>::const_iterator it = source_set->begin(); it != source_set->end(); ++it)
+	result_set->insert(format_value(*it, context));
+
+    return result;
+}
+
+/* Formats a single value, recursing natively into the containers whose
+ * droby_dump is the one defined in this file
+ */
+static VALUE format_value(VALUE object, FormatContext& context)
+{
+    DumpStrategy strategy = dump_strategy_of(object);
+    if (strategy == DUMP_AS_IS)
+        return object;
+
+    FormatContext::Memo::const_iterator memoized = context.memo.find(object);
+    if (memoized != context.memo.end())
+        return memoized->second;
+
+    VALUE formatted;
+    if (context.destination.incremental_dump_p(object))
+        formatted = rb_funcall(object, id_remote_id, 0);
+    else
+    {
+        switch (strategy)
+        {
+            case DUMP_ARRAY:     formatted = format_array(object, context); break;
+            case DUMP_HASH:      formatted = format_hash(object, context); break;
+            case DUMP_SET:       formatted = format_set(object, context); break;
+            case DUMP_VALUE_SET: formatted = format_value_set(object, context); break;
+            default:
+                formatted = rb_funcall(object, id_droby_dump, 1, context.destination.object);
+        }
+    }
+
+    context.memo[object] = formatted;
+    return formatted;
+}
+
+struct FormatRoot
+{
+    VALUE object;
+    FormatFunction format;
+    FormatContext* context;
+    VALUE saved_context;
+};
+
+static VALUE format_root_body(VALUE arg)
+{
+    FormatRoot* root = reinterpret_cast<FormatRoot*>(arg);
+    return root->format(root->object, *root->context);
+}
+
+static VALUE format_root_ensure(VALUE arg)
+{
+    FormatRoot* root = reinterpret_cast<FormatRoot*>(arg);
+    rb_thread_local_aset(rb_thread_current(), id_droby_format_context, root->saved_context);
+    // Release the references to the formatted objects right away
+    root->context->memo.clear();
+    return Qnil;
+}
+
+/* Formats +object+ using +format+
+ *
+ * The context of the enclosing formatting call is reused if there is one for
+ * the same destination, so that the Distributed.format calls made by the
+ * #droby_dump methods share the memo of the top-level call. Otherwise, a new
+ * context is created and made current for the duration of the call.
+ */
+static VALUE format_root(VALUE object, VALUE destination, FormatFunction format)
+{
+    VALUE thread = rb_thread_current();
+    VALUE current = rb_thread_local_aref(thread, id_droby_format_context);
+    if (!NIL_P(current))
     {
-	el[0] = *it;
-	result_set->insert(droby_format(2, el, mRobyDistributed));
+        FormatContext* context;
+        Data_Get_Struct(current, FormatContext, context);
+        if (context->destination.object == destination)
+            return format(object, *context);
     }
 
+    FormatContext* context = new FormatContext(destination);
+    VALUE context_holder = Data_Wrap_Struct(rb_cObject, format_context_mark, format_context_free, context);
+    rb_thread_local_aset(thread, id_droby_format_context, context_holder);
+
+    FormatRoot root = { object, format, context, current };
+    // rb_protect, unlike rb_ensure, has a typed VALUE (*)(VALUE) signature on
+    // all Ruby versions
+    int state = 0;
+    VALUE result = rb_protect(format_root_body, reinterpret_cast<VALUE>(&root), &state);
+    format_root_ensure(reinterpret_cast<VALUE>(&root));
+    RB_GC_GUARD(context_holder);
+    if (state)
+        rb_jump_tag(state);
     return result;
 }
 
+/* 
+ * Document-class: Roby::Distributed
+ */
+
+/* call-seq:
+ *   format(object, peer) => formatted_object
+ *
+ * Formats +object+ so that it is ready to be dumped by Marshal.dump for
+ * sending to +peer+. This means that if the object has a droby_dump method, it
+ * is called to get a marshallable object which represents +object+. Moreover,
+ * if +peer+ responds to #incremental_dump?(object), this is called to
+ * determine wether a full dump is required or if sending a
+ * Roby::Distributed::RemoteID for remote reference is enough.
+ *
+ * Arrays, hashes, sets and value sets are formatted recursively in a single
+ * pass. An object that appears more than once is formatted only once, all its
+ * occurrences being replaced by the same formatted object.
+ *
+ * If the object is not a DRbObject and does not define a #droby_dump method,
+ * it is proxied through a DRbObject if it present in
+ * Distributed.allow_remote_access. Otherwise, we will try to dump it as-is.
+ */
+static VALUE droby_format(int argc, VALUE* argv, VALUE self)
+{
+    VALUE object, destination;
+    rb_scan_args(argc, argv, "11", &object, &destination);
+    if (dump_strategy_of(object) == DUMP_AS_IS)
+        return object;
+    return format_root(object, destination, format_value);
+}
+
+// call-seq:
+//   droby_dump(dest) => dumped_array
+// 
+// Creates a copy of this Array with all its values formatted for marshalling
+// using Distributed.format.
+static VALUE array_droby_dump(VALUE self, VALUE dest)
+{ return format_root(self, dest, format_array); }
+
+// call-seq:
+//   droby_dump => dumped_hash
+// 
+// Creates a copy of this Hash with all its keys and values formatted for
+// marshalling using Distributed.format.
+static VALUE hash_droby_dump(VALUE self, VALUE dest)
+{ return format_root(self, dest, format_hash); }
+
+// Creates a copy of this Set with all its values formatted for marshalling
+// using Distributed.format
+static VALUE set_droby_dump(VALUE self, VALUE dest)
+{ return format_root(self, dest, format_set); }
+
+// Creates a copy of this ValueSet with all its values formatted for
+// marshalling using Distributed.format
+static VALUE value_set_droby_dump(VALUE self, VALUE dest)
+{ return format_root(self, dest, format_value_set); }
+
+void Init_binary_format();
+void Init_log_writer();
+
 extern "C" void Init_roby_marshalling()
 {
     id_droby_dump = rb_intern("droby_dump");
     id_remote_id = rb_intern("remote_id");
     id_append = rb_intern("<<");
+    id_incremental_dump_p = rb_intern("incremental_dump?");
+    id_respond_to_p = rb_intern("respond_to?");
+    id_respond_to_missing_p = rb_intern("respond_to_missing?");
+    id_Log = rb_intern("Log");
+    id_at_known_objects = rb_intern("@known_objects");
+    id_unbind = rb_intern("unbind");
+    id_instance_method = rb_intern("instance_method");
+    id_droby_format_context = rb_intern("__droby_format_context__");
     
     cDRbObject = rb_const_get(rb_cObject, rb_intern("DRbObject"));
     cValueSet  = rb_const_get(rb_cObject, rb_intern("ValueSet"));
@@ -163,5 +467,28 @@ extern "C" void Init_roby_marshalling()
 
     rb_define_singleton_method(mRobyDistributed, "format", RUBY_METHOD_FUNC(droby_format), -1);
 
+    native_droby_dumps = rb_ary_new();
+    rb_gc_register_address(&native_droby_dumps);
+    VALUE const containers[4] = { rb_cArray, rb_cHash, cSet, cValueSet };
+    for (int i = 0; i < 4; ++i)
+        rb_ary_push(native_droby_dumps, rb_funcall(containers[i], id_instance_method, 1, ID2SYM(id_droby_dump)));
+
+    dump_strategy_cache = new DumpStrategyCache;
+    dump_strategy_cache_holder = Data_Wrap_Struct(rb_cObject, dump_strategy_cache_mark, dump_strategy_cache_free, dump_strategy_cache);
+    rb_gc_register_address(&dump_strategy_cache_holder);
+    rb_gc_register_address(&mRobyLog);
+
+    /* Hooks that invalidate the dump strategy cache */
+    VALUE mInvalidation = rb_define_module_under(mRobyDistributed, "DumpStrategyInvalidation");
+    rb_define_private_method(mInvalidation, "method_added", RUBY_METHOD_FUNC(module_method_changed), 1);
+    rb_define_private_method(mInvalidation, "method_removed", RUBY_METHOD_FUNC(module_method_changed), 1);
+    rb_define_private_method(mInvalidation, "method_undefined", RUBY_METHOD_FUNC(module_method_changed), 1);
+    rb_define_private_method(mInvalidation, "append_features", RUBY_METHOD_FUNC(module_features_changed), 1);
+    rb_define_private_method(mInvalidation, "prepend_features", RUBY_METHOD_FUNC(module_features_changed), 1);
+    rb_prepend_module(rb_cModule, mInvalidation);
+
+    Init_binary_format();
+    Init_log_writer();
+
 }
 
@@ -1,4 +1,13 @@
 require 'mkmf'
 CONFIG['CC'] = "g++"
-create_makefile("roby_marshalling")
+# The .cc files are built with CXXFLAGS, which do not include the optimization
+# flags of the C compiler
+$CXXFLAGS += " -O3"
+
+# Used to release the GVL while waiting for the log writer
+have_header('ruby/thread.h')
+have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+# The flush thread of the log writer
+have_library('pthread', 'pthread_create')
 
+create_makefile("roby_marshalling")
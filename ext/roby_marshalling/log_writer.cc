@@ -0,0 +1,641 @@
+#include <ruby.h>
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+void binary_format_encode(VALUE object, std::string& out);
+
+static VALUE mRoby;
+static VALUE mRobyLog;
+static VALUE cChunkWriter;
+static ID id_fileno;
+static ID id_flush;
+
+/* Size of the pending data above which the flush thread is woken up without
+ * waiting for the end of the flush interval */
+static const size_t FLUSH_THRESHOLD = 1024 * 1024;
+
+struct ChunkWriter;
+
+/* The flush thread shared by a group of ChunkWriter
+ *
+ * A writer created with a leader (see chunk_writer_initialize) joins the
+ * leader's group. The thread takes the pending data of all the writers of the
+ * group at once, and writes it in the order in which the writers joined the
+ * group. The data that a writer queued after the data of a writer that
+ * precedes it in the group is therefore never written before it.
+ *
+ * The group is freed when its last writer gets closed. A writer that gets
+ * garbage collected while other writers still use the group is left to the
+ * flush thread, which deletes it once its pending data is written (see
+ * chunk_writer_free).
+ */
+struct FlushGroup
+{
+    pthread_t thread;
+    bool thread_started;
+    /** The process that created the group. The thread, and the state of the
+     * lock, are not inherited by forked children */
+    pid_t pid;
+
+    pthread_mutex_t lock;
+    /** Signalled when the flush thread has something to do */
+    pthread_cond_t wakeup;
+    /** Signalled when the flush thread finished writing a batch */
+    pthread_cond_t written_cond;
+
+    /** The writers of the group, in write order */
+    std::vector<ChunkWriter*> writers;
+    bool quit;
+    double flush_interval;
+    struct timeval last_flush;
+
+    FlushGroup()
+        : thread_started(false), pid(getpid()), quit(false), flush_interval(0.1)
+    {
+        pthread_mutex_init(&lock, 0);
+        pthread_cond_init(&wakeup, 0);
+        pthread_cond_init(&written_cond, 0);
+        gettimeofday(&last_flush, 0);
+    }
+    ~FlushGroup()
+    {
+        pthread_cond_destroy(&written_cond);
+        pthread_cond_destroy(&wakeup);
+        pthread_mutex_destroy(&lock);
+    }
+};
+
+/* Native state of Roby::Log::ChunkWriter
+ *
+ * The chunks are encoded by the Ruby thread in +front+, and written by the
+ * group's flush thread from +back+, the two buffers being swapped under the
+ * group's lock. The flush thread never touches +front+ while +encoding+ is
+ * set, which allows to encode without holding the lock (the encoding calls
+ * back into Ruby). Both buffers keep their capacity across swaps, so that
+ * after a few cycles no allocation is needed anymore.
+ */
+struct ChunkWriter
+{
+    int fd;
+    /** The group whose thread writes this writer's data, or null if the
+     * writer is closed */
+    FlushGroup* group;
+
+    std::string front;
+    std::string back;
+    bool encoding;
+    /** Set when the Ruby object got garbage collected while the group was
+     * still in use. The flush thread deletes the writer once its data got
+     * written */
+    bool orphan;
+
+    /** Position of the file when the writer got created */
+    off_t base_position;
+    /** Amount of bytes queued in the writer since its creation */
+    uint64_t queued;
+    /** Amount of bytes written to the file since the writer creation */
+    uint64_t written;
+    /** All the data queued up to this point must be written without waiting
+     * for the flush interval */
+    uint64_t flush_target;
+    /** errno of the last failed write, or zero */
+    int error;
+
+    ChunkWriter()
+        : fd(-1), group(0), encoding(false), orphan(false), base_position(0), queued(0)
+        , written(0), flush_target(0), error(0) {}
+};
+
+static bool write_all(int fd, char const* data, size_t size, int& error)
+{
+    while (size > 0)
+    {
+        ssize_t result = write(fd, data, size);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            error = errno;
+            return false;
+        }
+        data += result;
+        size -= result;
+    }
+    return true;
+}
+
+static double elapsed_since(struct timeval const& start)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+}
+
+static struct timespec deadline_after(struct timeval const& start, double delay)
+{
+    double deadline = start.tv_sec + start.tv_usec / 1e6 + delay;
+    struct timespec result;
+    result.tv_sec  = static_cast<time_t>(deadline);
+    result.tv_nsec = static_cast<long>((deadline - result.tv_sec) * 1e9);
+    return result;
+}
+
+/* Whether one of the writers of the group is encoding a chunk. Must be called
+ * with the lock held */
+static bool group_encoding(FlushGroup const& group)
+{
+    for (size_t i = 0; i < group.writers.size(); ++i)
+        if (group.writers[i]->encoding)
+            return true;
+    return false;
+}
+
+/* Whether the flush thread should take the content of the +front+ buffers
+ * now. Must be called with the lock held
+ *
+ * The buffers are taken all at once, and only when no writer is in the middle
+ * of encoding a chunk, so that the batches respect the order in which the
+ * chunks got queued in the different writers
+ */
+static bool flush_due(FlushGroup const& group)
+{
+    bool pending = false, urgent = false;
+    for (size_t i = 0; i < group.writers.size(); ++i)
+    {
+        ChunkWriter const& writer = *group.writers[i];
+        if (writer.encoding)
+            return false;
+        if (!writer.front.empty())
+        {
+            pending = true;
+            urgent = urgent || writer.flush_target > writer.written ||
+                writer.front.size() >= FLUSH_THRESHOLD;
+        }
+    }
+    return pending &&
+        (urgent || elapsed_since(group.last_flush) >= group.flush_interval);
+}
+
+/* Deletes the orphan writers whose data got written. Must be called with the
+ * lock held */
+static void reap_orphans(FlushGroup& group)
+{
+    for (size_t i = 0; i < group.writers.size(); )
+    {
+        ChunkWriter* writer = group.writers[i];
+        if (writer->orphan && writer->front.empty() && writer->back.empty())
+        {
+            group.writers.erase(group.writers.begin() + i);
+            close(writer->fd);
+            delete writer;
+        }
+        else ++i;
+    }
+}
+
+static void* flush_thread_main(void* arg)
+{
+    FlushGroup& group = *static_cast<FlushGroup*>(arg);
+    std::vector<ChunkWriter*> batch;
+
+    pthread_mutex_lock(&group.lock);
+    while (true)
+    {
+        if (flush_due(group))
+        {
+            // Only the writers that are part of the batch are touched
+            // without the lock. They cannot leave the group before their
+            // +back+ buffer got cleared
+            batch.clear();
+            for (size_t i = 0; i < group.writers.size(); ++i)
+            {
+                ChunkWriter* writer = group.writers[i];
+                if (!writer->front.empty())
+                {
+                    writer->front.swap(writer->back);
+                    batch.push_back(writer);
+                }
+            }
+            pthread_mutex_unlock(&group.lock);
+
+            std::vector<int> errors(batch.size(), 0);
+            for (size_t i = 0; i < batch.size(); ++i)
+                write_all(batch[i]->fd, batch[i]->back.data(), batch[i]->back.size(), errors[i]);
+
+            pthread_mutex_lock(&group.lock);
+            for (size_t i = 0; i < batch.size(); ++i)
+            {
+                ChunkWriter& writer = *batch[i];
+                if (errors[i] && !writer.error)
+                    writer.error = errors[i];
+                writer.written += writer.back.size();
+                writer.back.clear();
+            }
+            gettimeofday(&group.last_flush, 0);
+            reap_orphans(group);
+            pthread_cond_broadcast(&group.written_cond);
+            continue;
+        }
+
+        bool empty = true;
+        for (size_t i = 0; i < group.writers.size(); ++i)
+            empty = empty && group.writers[i]->front.empty();
+
+        // +front+ can only be looked at when the Ruby thread is not encoding
+        if (group_encoding(group))
+            pthread_cond_wait(&group.wakeup, &group.lock);
+        else if (empty)
+        {
+            reap_orphans(group);
+            if (group.quit)
+                break;
+            pthread_cond_wait(&group.wakeup, &group.lock);
+        }
+        else
+        {
+            struct timespec deadline = deadline_after(group.last_flush, group.flush_interval);
+            pthread_cond_timedwait(&group.wakeup, &group.lock, &deadline);
+        }
+    }
+    pthread_cond_broadcast(&group.written_cond);
+    pthread_mutex_unlock(&group.lock);
+    return 0;
+}
+
+/* Whether +writer+ got inherited from the parent through a fork. The flush
+ * thread does not exist in the child, and the group's lock might have been
+ * held by it at the time of the fork */
+static bool forked_p(ChunkWriter const& writer)
+{
+    return writer.group && writer.group->pid != getpid();
+}
+
+/* Removes +writer+ from its group after its pending data got written, stops
+ * the flush thread if it was the last writer of the group, and closes the
+ * writer's file descriptor. Can be called without the GVL
+ *
+ * In a forked child, the pending data is dropped and the group is left alone,
+ * as neither its thread nor its lock can be used there */
+static void* chunk_writer_shutdown(void* arg)
+{
+    ChunkWriter& writer = *static_cast<ChunkWriter*>(arg);
+    FlushGroup* group = writer.group;
+    if (group && !forked_p(writer))
+    {
+        pthread_mutex_lock(&group->lock);
+        writer.flush_target = writer.queued;
+        pthread_cond_signal(&group->wakeup);
+        while (!writer.front.empty() || !writer.back.empty())
+            pthread_cond_wait(&group->written_cond, &group->lock);
+
+        group->writers.erase(std::find(group->writers.begin(), group->writers.end(), &writer));
+        bool last = true;
+        for (size_t i = 0; i < group->writers.size(); ++i)
+            last = last && group->writers[i]->orphan;
+        if (last)
+        {
+            group->quit = true;
+            pthread_cond_signal(&group->wakeup);
+        }
+        pthread_mutex_unlock(&group->lock);
+
+        if (last)
+        {
+            pthread_join(group->thread, 0);
+            delete group;
+        }
+    }
+    writer.group = 0;
+    if (writer.fd != -1)
+    {
+        close(writer.fd);
+        writer.fd = -1;
+    }
+    return 0;
+}
+
+/* Waits for all the data queued so far to be written. Can be called without
+ * the GVL */
+static void* chunk_writer_wait_flushed(void* arg)
+{
+    ChunkWriter& writer = *static_cast<ChunkWriter*>(arg);
+    FlushGroup& group = *writer.group;
+    pthread_mutex_lock(&group.lock);
+    writer.flush_target = writer.queued;
+    pthread_cond_signal(&group.wakeup);
+    while (writer.written < writer.flush_target)
+        pthread_cond_wait(&group.written_cond, &group.lock);
+    pthread_mutex_unlock(&group.lock);
+    return 0;
+}
+
+static void call_without_gvl(void* (*f)(void*), ChunkWriter& writer)
+{
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    rb_thread_call_without_gvl(f, &writer, 0, 0);
+#else
+    f(&writer);
+#endif
+}
+
+/* Called by the GC. Waiting for the flush thread here could deadlock if
+ * another writer of the group is in the middle of encoding a chunk (the GC
+ * can run during the encoding), so a writer whose group is still used by
+ * other writers is handed over to the flush thread instead */
+static void chunk_writer_free(ChunkWriter* writer)
+{
+    FlushGroup* group = writer->group;
+    if (group && !forked_p(*writer))
+    {
+        pthread_mutex_lock(&group->lock);
+        bool shared = false;
+        for (size_t i = 0; i < group->writers.size(); ++i)
+        {
+            ChunkWriter* other = group->writers[i];
+            shared = shared || (other != writer && !other->orphan);
+        }
+        if (shared)
+        {
+            writer->orphan = true;
+            writer->flush_target = writer->queued;
+            pthread_cond_signal(&group->wakeup);
+        }
+        pthread_mutex_unlock(&group->lock);
+        if (shared)
+            return;
+    }
+
+    chunk_writer_shutdown(writer);
+    delete writer;
+}
+
+static VALUE chunk_writer_alloc(VALUE klass)
+{
+    ChunkWriter* writer = new ChunkWriter;
+    return Data_Wrap_Struct(klass, 0, chunk_writer_free, writer);
+}
+
+static ChunkWriter& get_writer(VALUE self)
+{
+    ChunkWriter* writer;
+    Data_Get_Struct(self, ChunkWriter, writer);
+    return *writer;
+}
+
+static ChunkWriter& get_open_writer(VALUE self)
+{
+    ChunkWriter& writer = get_writer(self);
+    if (writer.fd == -1)
+        rb_raise(rb_eIOError, "closed ChunkWriter");
+    if (forked_p(writer))
+        rb_raise(rb_eIOError, "ChunkWriter cannot be used in a forked process");
+    return writer;
+}
+
+/* Raises if the flush thread failed to write some data */
+static void check_write_error(ChunkWriter& writer)
+{
+    pthread_mutex_lock(&writer.group->lock);
+    int error = writer.error;
+    writer.error = 0;
+    pthread_mutex_unlock(&writer.group->lock);
+    if (error)
+        rb_syserr_fail(error, "ChunkWriter failed to write to its file");
+}
+
+/* call-seq:
+ *   ChunkWriter.new(io, flush_interval = 0.1, leader = nil)
+ *
+ * Creates a writer that appends chunks to +io+. The writer gets its own file
+ * descriptor for +io+, which should not be written to directly afterwards.
+ *
+ * The data is written by a background thread at most every +flush_interval+
+ * seconds, or earlier if more than 1MB of data is waiting.
+ *
+ * If +leader+ is given, the writer shares the flush thread (and the flush
+ * interval) of this other writer. The chunks it queues are then never written
+ * before the chunks that were queued in +leader+ before them, e.g. an index
+ * entry never reaches the disk before the data it points to.
+ */
+static VALUE chunk_writer_initialize(int argc, VALUE* argv, VALUE self)
+{
+    VALUE io, flush_interval, leader;
+    rb_scan_args(argc, argv, "12", &io, &flush_interval, &leader);
+
+    ChunkWriter& writer = get_writer(self);
+    if (writer.fd != -1)
+        rb_raise(rb_eArgError, "ChunkWriter already initialized");
+    FlushGroup* group = 0;
+    if (!NIL_P(leader))
+    {
+        if (!rb_obj_is_kind_of(leader, cChunkWriter))
+            rb_raise(rb_eTypeError, "expected a ChunkWriter as leader");
+        group = get_open_writer(leader).group;
+    }
+
+    rb_funcall(io, id_flush, 0);
+    int fd = dup(NUM2INT(rb_funcall(io, id_fileno, 0)));
+    if (fd == -1)
+        rb_sys_fail("cannot duplicate the file descriptor of the log file");
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    writer.base_position = (position == -1) ? 0 : position;
+
+    if (group)
+    {
+        pthread_mutex_lock(&group->lock);
+        group->writers.push_back(&writer);
+        if (!NIL_P(flush_interval))
+            group->flush_interval = NUM2DBL(flush_interval);
+        pthread_mutex_unlock(&group->lock);
+    }
+    else
+    {
+        group = new FlushGroup;
+        if (!NIL_P(flush_interval))
+            group->flush_interval = NUM2DBL(flush_interval);
+        group->writers.push_back(&writer);
+        if (pthread_create(&group->thread, 0, flush_thread_main, group) != 0)
+        {
+            delete group;
+            close(fd);
+            rb_raise(rb_eRuntimeError, "cannot start the flush thread of ChunkWriter");
+        }
+        group->thread_started = true;
+    }
+    writer.fd = fd;
+    writer.group = group;
+    return self;
+}
+
+struct DumpArg
+{
+    VALUE object;
+    ChunkWriter* writer;
+};
+
+static VALUE chunk_writer_encode(VALUE arg)
+{
+    DumpArg* dump = reinterpret_cast<DumpArg*>(arg);
+    binary_format_encode(dump->object, dump->writer->front);
+    return Qnil;
+}
+
+/* call-seq:
+ *   dump(object) => self
+ *
+ * Queues +object+ as one chunk, i.e. the size of its BinaryFormat encoding
+ * followed by the encoding itself (see Logfile.dump). The object is encoded
+ * directly in the writer's buffer.
+ *
+ * A writer must not be used by more than one thread at a time.
+ */
+static VALUE chunk_writer_dump(VALUE self, VALUE object)
+{
+    ChunkWriter& writer = get_open_writer(self);
+    FlushGroup& group = *writer.group;
+    check_write_error(writer);
+
+    pthread_mutex_lock(&group.lock);
+    bool reentrant = writer.encoding;
+    writer.encoding = true;
+    pthread_mutex_unlock(&group.lock);
+    if (reentrant)
+        rb_raise(rb_eRuntimeError, "ChunkWriter#dump called while already encoding");
+
+    size_t start = writer.front.size();
+    uint32_t size = 0;
+    writer.front.append(reinterpret_cast<char const*>(&size), sizeof(size));
+
+    DumpArg arg = { object, &writer };
+    int state = 0;
+    rb_protect(chunk_writer_encode, reinterpret_cast<VALUE>(&arg), &state);
+
+    pthread_mutex_lock(&group.lock);
+    writer.encoding = false;
+    if (state)
+        writer.front.resize(start);
+    else
+    {
+        size = writer.front.size() - start - sizeof(size);
+        memcpy(&writer.front[start], &size, sizeof(size));
+        writer.queued += writer.front.size() - start;
+    }
+    pthread_cond_signal(&group.wakeup);
+    pthread_mutex_unlock(&group.lock);
+
+    if (state)
+        rb_jump_tag(state);
+    return self;
+}
+
+/* call-seq:
+ *   tell => position
+ *
+ * The position in the file at which the next chunk will be written
+ */
+static VALUE chunk_writer_tell(VALUE self)
+{
+    ChunkWriter& writer = get_open_writer(self);
+    return ULL2NUM(writer.base_position + writer.queued);
+}
+
+/* call-seq:
+ *   flush => self
+ *
+ * Waits for all the chunks queued so far to be written to the file
+ */
+static VALUE chunk_writer_flush(VALUE self)
+{
+    ChunkWriter& writer = get_open_writer(self);
+    call_without_gvl(chunk_writer_wait_flushed, writer);
+    check_write_error(writer);
+    return self;
+}
+
+/* call-seq:
+ *   close
+ *
+ * Writes all the queued chunks and closes the writer's file descriptor. The
+ * flush thread is stopped when the last writer that uses it gets closed. The
+ * IO given at construction is left open.
+ *
+ * In a forked process, the chunks queued by the parent are dropped.
+ */
+static VALUE chunk_writer_close(VALUE self)
+{
+    ChunkWriter& writer = get_writer(self);
+    if (writer.fd == -1)
+        rb_raise(rb_eIOError, "closed ChunkWriter");
+    if (forked_p(writer))
+    {
+        chunk_writer_shutdown(&writer);
+        return Qnil;
+    }
+
+    call_without_gvl(chunk_writer_shutdown, writer);
+    // The writer is out of its group, the flush thread does not touch it
+    // anymore
+    int error = writer.error;
+    writer.error = 0;
+    if (error)
+        rb_syserr_fail(error, "ChunkWriter failed to write to its file");
+    return Qnil;
+}
+
+static VALUE chunk_writer_closed_p(VALUE self)
+{
+    return get_writer(self).fd == -1 ? Qtrue : Qfalse;
+}
+
+static VALUE chunk_writer_flush_interval(VALUE self)
+{
+    FlushGroup& group = *get_open_writer(self).group;
+    pthread_mutex_lock(&group.lock);
+    double interval = group.flush_interval;
+    pthread_mutex_unlock(&group.lock);
+    return DBL2NUM(interval);
+}
+
+static VALUE chunk_writer_set_flush_interval(VALUE self, VALUE value)
+{
+    double interval = NUM2DBL(value);
+    FlushGroup& group = *get_open_writer(self).group;
+    pthread_mutex_lock(&group.lock);
+    group.flush_interval = interval;
+    pthread_cond_signal(&group.wakeup);
+    pthread_mutex_unlock(&group.lock);
+    return value;
+}
+
+void Init_log_writer()
+{
+    id_fileno = rb_intern("fileno");
+    id_flush = rb_intern("flush");
+
+    /* */
+    mRoby     = rb_define_module("Roby");
+    /* */
+    mRobyLog  = rb_define_module_under(mRoby, "Log");
+    /* Buffered writer for the chunks of a log file, see FileLogger */
+    cChunkWriter = rb_define_class_under(mRobyLog, "ChunkWriter", rb_cObject);
+    rb_define_alloc_func(cChunkWriter, chunk_writer_alloc);
+    rb_define_method(cChunkWriter, "initialize", RUBY_METHOD_FUNC(chunk_writer_initialize), -1);
+    rb_define_method(cChunkWriter, "dump", RUBY_METHOD_FUNC(chunk_writer_dump), 1);
+    rb_define_method(cChunkWriter, "tell", RUBY_METHOD_FUNC(chunk_writer_tell), 0);
+    rb_define_method(cChunkWriter, "flush", RUBY_METHOD_FUNC(chunk_writer_flush), 0);
+    rb_define_method(cChunkWriter, "close", RUBY_METHOD_FUNC(chunk_writer_close), 0);
+    rb_define_method(cChunkWriter, "closed?", RUBY_METHOD_FUNC(chunk_writer_closed_p), 0);
+    rb_define_method(cChunkWriter, "flush_interval", RUBY_METHOD_FUNC(chunk_writer_flush_interval), 0);
+    rb_define_method(cChunkWriter, "flush_interval=", RUBY_METHOD_FUNC(chunk_writer_set_flush_interval), 1);
+}
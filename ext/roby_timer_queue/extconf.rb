@@ -0,0 +1,5 @@
+require 'mkmf'
+CONFIG['CC'] = "g++"
+$CFLAGS += " -O3"
+
+create_makefile("roby_timer_queue")
@@ -0,0 +1,393 @@
+#include <ruby.h>
+#include <vector>
+#include <map>
+#include <set>
+#include <limits>
+
+/* An indexed binary heap of timed entries, used for the event deadlines of
+ * the temporal constraints and for the delayed event propagations of the
+ * execution engine.
+ *
+ * Each entry is an arbitrary Ruby object, queued with a time and a key (the
+ * generator it relates to). The heap gives the entries in time order (and in
+ * insertion order for equal times), and the per-key index allows to remove
+ * the entries of a given key without scanning the whole queue.
+ */
+struct TimerNode
+{
+    double time;
+    unsigned long long seq;
+    VALUE key;
+    VALUE entry;
+    size_t pos;
+};
+
+struct TimerNodeLess
+{
+    bool operator ()(TimerNode const* a, TimerNode const* b) const
+    {
+	if (a->time != b->time)
+	    return a->time < b->time;
+	return a->seq < b->seq;
+    }
+};
+
+struct TimerQueue
+{
+    typedef std::set<TimerNode*, TimerNodeLess> node_set;
+    typedef std::map<VALUE, node_set> key_map;
+
+    /* The index in the entries of the key used by TimerQueue#<< */
+    long key_index;
+    unsigned long long next_seq;
+    std::vector<TimerNode*> heap;
+    key_map keys;
+
+    TimerQueue()
+	: key_index(0), next_seq(0) {}
+    ~TimerQueue() { clear(); }
+
+    void clear()
+    {
+	for (size_t i = 0; i < heap.size(); ++i)
+	    delete heap[i];
+	heap.clear();
+	keys.clear();
+    }
+
+    void swap_nodes(size_t a, size_t b)
+    {
+	std::swap(heap[a], heap[b]);
+	heap[a]->pos = a;
+	heap[b]->pos = b;
+    }
+
+    void sift_up(size_t pos)
+    {
+	TimerNodeLess less;
+	while (pos > 0)
+	{
+	    size_t parent = (pos - 1) / 2;
+	    if (!less(heap[pos], heap[parent]))
+		break;
+	    swap_nodes(pos, parent);
+	    pos = parent;
+	}
+    }
+
+    void sift_down(size_t pos)
+    {
+	TimerNodeLess less;
+	size_t size = heap.size();
+	while (true)
+	{
+	    size_t smallest = pos;
+	    size_t left = 2 * pos + 1, right = left + 1;
+	    if (left < size && less(heap[left], heap[smallest]))
+		smallest = left;
+	    if (right < size && less(heap[right], heap[smallest]))
+		smallest = right;
+	    if (smallest == pos)
+		return;
+	    swap_nodes(pos, smallest);
+	    pos = smallest;
+	}
+    }
+
+    void push(double time, VALUE key, VALUE entry)
+    {
+	TimerNode* node = new TimerNode;
+	node->time  = time;
+	node->seq   = next_seq++;
+	node->key   = key;
+	node->entry = entry;
+	node->pos   = heap.size();
+	heap.push_back(node);
+	keys[key].insert(node);
+	sift_up(node->pos);
+    }
+
+    /* Removes +node+ from the heap. It does not update the key index, nor
+     * deletes the node */
+    void remove_from_heap(TimerNode* node)
+    {
+	size_t pos  = node->pos;
+	size_t last = heap.size() - 1;
+	if (pos != last)
+	{
+	    swap_nodes(pos, last);
+	    heap.pop_back();
+	    sift_down(pos);
+	    sift_up(pos);
+	}
+	else
+	    heap.pop_back();
+    }
+
+    void remove_from_keys(TimerNode* node)
+    {
+	key_map::iterator it = keys.find(node->key);
+	it->second.erase(node);
+	if (it->second.empty())
+	    keys.erase(it);
+    }
+};
+
+static VALUE cTimerQueue;
+static ID id_to_f;
+
+static TimerQueue& timer_queue_wrapped(VALUE self)
+{
+    TimerQueue* queue = 0;
+    Data_Get_Struct(self, TimerQueue, queue);
+    return *queue;
+}
+
+static void timer_queue_mark(TimerQueue const* queue)
+{
+    for (size_t i = 0; i < queue->heap.size(); ++i)
+    {
+	rb_gc_mark(queue->heap[i]->key);
+	rb_gc_mark(queue->heap[i]->entry);
+    }
+}
+static void timer_queue_free(TimerQueue* queue) { delete queue; }
+static VALUE timer_queue_alloc(VALUE klass)
+{
+    TimerQueue* queue = new TimerQueue;
+    return Data_Wrap_Struct(klass, timer_queue_mark, timer_queue_free, queue);
+}
+
+static double timer_queue_time(VALUE time)
+{
+    if (rb_obj_is_kind_of(time, rb_cNumeric))
+	return NUM2DBL(time);
+    return NUM2DBL(rb_funcall(time, id_to_f, 0));
+}
+
+/* call-seq:
+ *   TimerQueue.new(key_index = 0)
+ *
+ * Creates an empty queue. +key_index+ is the index in the entries of the
+ * key that is used by #<<
+ */
+static VALUE timer_queue_initialize(int argc, VALUE* argv, VALUE self)
+{
+    VALUE key_index = Qnil;
+    rb_scan_args(argc, argv, "01", &key_index);
+    timer_queue_wrapped(self).key_index = NIL_P(key_index) ? 0 : NUM2LONG(key_index);
+    return self;
+}
+
+/* call-seq:
+ *   queue.push(time, key, entry) => queue
+ *
+ * Queues +entry+ at +time+ for +key+. +time+ is either a Time or a number of
+ * seconds
+ */
+static VALUE timer_queue_push(VALUE self, VALUE time, VALUE key, VALUE entry)
+{
+    double t = timer_queue_time(time);
+    timer_queue_wrapped(self).push(t, key, entry);
+    return self;
+}
+
+/* call-seq:
+ *   queue << entry => queue
+ *
+ * Queues +entry+, which must be an array whose first element is the time and
+ * whose element at the queue's key index is the key
+ */
+static VALUE timer_queue_append(VALUE self, VALUE entry)
+{
+    TimerQueue& queue = timer_queue_wrapped(self);
+    VALUE ary = rb_Array(entry);
+    double t  = timer_queue_time(rb_ary_entry(ary, 0));
+    queue.push(t, rb_ary_entry(ary, queue.key_index), entry);
+    return self;
+}
+
+static VALUE timer_queue_pop_expired(VALUE self, VALUE time, bool inclusive)
+{
+    double t = timer_queue_time(time);
+    TimerQueue& queue = timer_queue_wrapped(self);
+
+    VALUE result = rb_ary_new();
+    while (!queue.heap.empty())
+    {
+	TimerNode* node = queue.heap.front();
+	if (node->time > t || (!inclusive && node->time == t))
+	    break;
+
+	queue.remove_from_heap(node);
+	queue.remove_from_keys(node);
+	rb_ary_push(result, node->entry);
+	delete node;
+    }
+    return result;
+}
+
+/* call-seq:
+ *   queue.pop_until(time) => entries
+ *
+ * Removes and returns the entries queued at or before +time+, in time order
+ */
+static VALUE timer_queue_pop_until(VALUE self, VALUE time)
+{ return timer_queue_pop_expired(self, time, true); }
+
+/* call-seq:
+ *   queue.pop_before(time) => entries
+ *
+ * Removes and returns the entries queued strictly before +time+, in time
+ * order
+ */
+static VALUE timer_queue_pop_before(VALUE self, VALUE time)
+{ return timer_queue_pop_expired(self, time, false); }
+
+/* call-seq:
+ *   queue.delete_first_for(key, after_time) => true or false
+ *
+ * Removes the earliest entry for +key+ whose time is strictly after
+ * +after_time+. Returns true if one has been found, and false otherwise
+ */
+static VALUE timer_queue_delete_first_for(VALUE self, VALUE key, VALUE after_time)
+{
+    double t = timer_queue_time(after_time);
+    TimerQueue& queue = timer_queue_wrapped(self);
+
+    TimerQueue::key_map::iterator it = queue.keys.find(key);
+    if (it == queue.keys.end())
+	return Qfalse;
+
+    // The nodes of a key are sorted by (time, seq), so the first node
+    // strictly after +t+ is the lower bound of (t, max seq)
+    TimerNode probe;
+    probe.time = t;
+    probe.seq  = std::numeric_limits<unsigned long long>::max();
+    TimerQueue::node_set& nodes = it->second;
+    TimerQueue::node_set::iterator node_it = nodes.lower_bound(&probe);
+    if (node_it == nodes.end())
+	return Qfalse;
+
+    TimerNode* node = *node_it;
+    queue.remove_from_heap(node);
+    queue.remove_from_keys(node);
+    delete node;
+    return Qtrue;
+}
+
+/* call-seq:
+ *   queue.delete_all_for(key) => count
+ *
+ * Removes all the entries for +key+ and returns how many there were
+ */
+static VALUE timer_queue_delete_all_for(VALUE self, VALUE key)
+{
+    TimerQueue& queue = timer_queue_wrapped(self);
+
+    TimerQueue::key_map::iterator it = queue.keys.find(key);
+    if (it == queue.keys.end())
+	return INT2FIX(0);
+
+    size_t count = it->second.size();
+    for (TimerQueue::node_set::iterator node_it = it->second.begin(); node_it != it->second.end(); ++node_it)
+    {
+	queue.remove_from_heap(*node_it);
+	delete *node_it;
+    }
+    queue.keys.erase(it);
+    return ULONG2NUM(count);
+}
+
+/* call-seq:
+ *   queue.first_time => time or nil
+ *
+ * Returns the time of the earliest entry, as a number of seconds, or nil if
+ * the queue is empty
+ */
+static VALUE timer_queue_first_time(VALUE self)
+{
+    TimerQueue& queue = timer_queue_wrapped(self);
+    if (queue.heap.empty())
+	return Qnil;
+    return rb_float_new(queue.heap.front()->time);
+}
+
+/* call-seq:
+ *   queue.each { |entry| ... } => queue
+ *
+ * Yields the queued entries in no particular order
+ */
+static VALUE timer_queue_each(VALUE self)
+{
+    RETURN_ENUMERATOR(self, 0, 0);
+
+    TimerQueue& queue = timer_queue_wrapped(self);
+    VALUE entries = rb_ary_new2(queue.heap.size());
+    for (size_t i = 0; i < queue.heap.size(); ++i)
+	rb_ary_push(entries, queue.heap[i]->entry);
+
+    for (long i = 0; i < RARRAY_LEN(entries); ++i)
+	rb_yield(rb_ary_entry(entries, i));
+    return self;
+}
+
+/* call-seq:
+ *   queue.size => integer
+ */
+static VALUE timer_queue_size(VALUE self)
+{ return ULONG2NUM(timer_queue_wrapped(self).heap.size()); }
+
+/* call-seq:
+ *   queue.empty? => true or false
+ */
+static VALUE timer_queue_empty_p(VALUE self)
+{ return timer_queue_wrapped(self).heap.empty() ? Qtrue : Qfalse; }
+
+/* call-seq:
+ *   queue.clear => queue
+ */
+static VALUE timer_queue_clear(VALUE self)
+{
+    timer_queue_wrapped(self).clear();
+    return self;
+}
+
+static VALUE timer_queue_initialize_copy(VALUE self, VALUE other)
+{
+    TimerQueue& queue = timer_queue_wrapped(self);
+    TimerQueue const& source = timer_queue_wrapped(other);
+    queue.clear();
+    queue.key_index = source.key_index;
+    queue.next_seq  = source.next_seq;
+    for (size_t i = 0; i < source.heap.size(); ++i)
+    {
+	TimerNode* node = new TimerNode(*source.heap[i]);
+	queue.heap.push_back(node);
+	queue.keys[node->key].insert(node);
+    }
+    return self;
+}
+
+extern "C" void Init_roby_timer_queue()
+{
+    id_to_f = rb_intern("to_f");
+
+    VALUE mRoby = rb_define_module("Roby");
+    cTimerQueue = rb_define_class_under(mRoby, "TimerQueue", rb_cObject);
+    rb_include_module(cTimerQueue, rb_mEnumerable);
+    rb_define_alloc_func(cTimerQueue, timer_queue_alloc);
+    rb_define_method(cTimerQueue, "initialize", RUBY_METHOD_FUNC(timer_queue_initialize), -1);
+    rb_define_method(cTimerQueue, "initialize_copy", RUBY_METHOD_FUNC(timer_queue_initialize_copy), 1);
+    rb_define_method(cTimerQueue, "push", RUBY_METHOD_FUNC(timer_queue_push), 3);
+    rb_define_method(cTimerQueue, "<<", RUBY_METHOD_FUNC(timer_queue_append), 1);
+    rb_define_method(cTimerQueue, "pop_until", RUBY_METHOD_FUNC(timer_queue_pop_until), 1);
+    rb_define_method(cTimerQueue, "pop_before", RUBY_METHOD_FUNC(timer_queue_pop_before), 1);
+    rb_define_method(cTimerQueue, "delete_first_for", RUBY_METHOD_FUNC(timer_queue_delete_first_for), 2);
+    rb_define_method(cTimerQueue, "delete_all_for", RUBY_METHOD_FUNC(timer_queue_delete_all_for), 1);
+    rb_define_method(cTimerQueue, "first_time", RUBY_METHOD_FUNC(timer_queue_first_time), 0);
+    rb_define_method(cTimerQueue, "each", RUBY_METHOD_FUNC(timer_queue_each), 0);
+    rb_define_method(cTimerQueue, "size", RUBY_METHOD_FUNC(timer_queue_size), 0);
+    rb_define_method(cTimerQueue, "empty?", RUBY_METHOD_FUNC(timer_queue_empty_p), 0);
+    rb_define_method(cTimerQueue, "clear", RUBY_METHOD_FUNC(timer_queue_clear), 0);
+}
@@ -0,0 +1,612 @@
+#include <ruby.h>
+#include "value_set.hh"
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+/* Dense integer ids for the tasks of a plan, and bitmaps over these ids. They
+ * are the storage of Roby::Queries::Index: each model, predicate and owner is
+ * a bitmap of the ids of the matching tasks, which makes the evaluation of
+ * the index part of a query a sequence of word-wise AND, OR and AND NOT
+ * operations.
+ *
+ * The bitmaps are split in blocks of BLOCK_BITS bits, and empty blocks are not
+ * allocated. The bitmaps of the models and owners that only concern a few
+ * tasks therefore stay small, while the operations on the dense ones (the
+ * predicates, the most generic models) stay linear in the number of words.
+ */
+struct DenseIds
+{
+    /* The object of each id, Qnil if the id is free */
+    std::vector<VALUE> objects;
+    std::unordered_map<VALUE, size_t> ids;
+    std::vector<size_t> free_ids;
+
+    size_t register_object(VALUE object)
+    {
+	std::unordered_map<VALUE, size_t>::const_iterator it = ids.find(object);
+	if (it != ids.end())
+	    return it->second;
+
+	size_t id;
+	if (free_ids.empty())
+	{
+	    id = objects.size();
+	    objects.push_back(object);
+	}
+	else
+	{
+	    id = free_ids.back();
+	    free_ids.pop_back();
+	    objects[id] = object;
+	}
+	ids[object] = id;
+	return id;
+    }
+
+    bool find(VALUE object, size_t& id) const
+    {
+	std::unordered_map<VALUE, size_t>::const_iterator it = ids.find(object);
+	if (it == ids.end())
+	    return false;
+	id = it->second;
+	return true;
+    }
+
+    bool release(VALUE object, size_t& id)
+    {
+	if (!find(object, id))
+	    return false;
+	ids.erase(object);
+	objects[id] = Qnil;
+	free_ids.push_back(id);
+	return true;
+    }
+
+    void clear()
+    {
+	objects.clear();
+	ids.clear();
+	free_ids.clear();
+    }
+};
+
+struct Bitmap
+{
+    static const size_t WORD_BITS   = 64;
+    static const size_t BLOCK_WORDS = 64;
+    static const size_t BLOCK_BITS  = WORD_BITS * BLOCK_WORDS;
+    typedef std::vector<uint64_t> Block;
+
+    /* The DenseIds object that maps the bits to objects */
+    VALUE ids;
+    /* The blocks. An empty vector stands for a block with no bit set */
+    std::vector<Block> blocks;
+
+    Bitmap()
+	: ids(Qnil) {}
+
+    static void release_block(Block& block)
+    { Block().swap(block); }
+
+    static bool block_empty(Block const& block)
+    {
+	for (size_t i = 0; i < block.size(); ++i)
+	    if (block[i])
+		return false;
+	return true;
+    }
+
+    void set(size_t id)
+    {
+	size_t block_idx = id / BLOCK_BITS;
+	if (block_idx >= blocks.size())
+	    blocks.resize(block_idx + 1);
+	Block& block = blocks[block_idx];
+	if (block.empty())
+	    block.resize(BLOCK_WORDS, 0);
+	size_t bit = id % BLOCK_BITS;
+	block[bit / WORD_BITS] |= (uint64_t(1) << (bit % WORD_BITS));
+    }
+
+    void reset(size_t id)
+    {
+	size_t block_idx = id / BLOCK_BITS;
+	if (block_idx >= blocks.size() || blocks[block_idx].empty())
+	    return;
+	Block& block = blocks[block_idx];
+	size_t bit = id % BLOCK_BITS;
+	block[bit / WORD_BITS] &= ~(uint64_t(1) << (bit % WORD_BITS));
+	if (block_empty(block))
+	    release_block(block);
+    }
+
+    bool test(size_t id) const
+    {
+	size_t block_idx = id / BLOCK_BITS;
+	if (block_idx >= blocks.size() || blocks[block_idx].empty())
+	    return false;
+	size_t bit = id % BLOCK_BITS;
+	return blocks[block_idx][bit / WORD_BITS] & (uint64_t(1) << (bit % WORD_BITS));
+    }
+
+    size_t count() const
+    {
+	size_t result = 0;
+	for (size_t i = 0; i < blocks.size(); ++i)
+	    for (size_t w = 0; w < blocks[i].size(); ++w)
+		result += __builtin_popcountll(blocks[i][w]);
+	return result;
+    }
+
+    bool empty() const
+    {
+	for (size_t i = 0; i < blocks.size(); ++i)
+	    if (!blocks[i].empty())
+		return false;
+	return true;
+    }
+
+    void intersect(Bitmap const& other)
+    {
+	if (blocks.size() > other.blocks.size())
+	    blocks.resize(other.blocks.size());
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+	    Block& block = blocks[i];
+	    if (block.empty())
+		continue;
+	    Block const& other_block = other.blocks[i];
+	    if (other_block.empty())
+	    {
+		release_block(block);
+		continue;
+	    }
+	    for (size_t w = 0; w < BLOCK_WORDS; ++w)
+		block[w] &= other_block[w];
+	    if (block_empty(block))
+		release_block(block);
+	}
+    }
+
+    void unite(Bitmap const& other)
+    {
+	if (blocks.size() < other.blocks.size())
+	    blocks.resize(other.blocks.size());
+	for (size_t i = 0; i < other.blocks.size(); ++i)
+	{
+	    Block const& other_block = other.blocks[i];
+	    if (other_block.empty())
+		continue;
+	    Block& block = blocks[i];
+	    if (block.empty())
+		block = other_block;
+	    else
+	    {
+		for (size_t w = 0; w < BLOCK_WORDS; ++w)
+		    block[w] |= other_block[w];
+	    }
+	}
+    }
+
+    void subtract(Bitmap const& other)
+    {
+	size_t size = std::min(blocks.size(), other.blocks.size());
+	for (size_t i = 0; i < size; ++i)
+	{
+	    Block& block = blocks[i];
+	    Block const& other_block = other.blocks[i];
+	    if (block.empty() || other_block.empty())
+		continue;
+	    for (size_t w = 0; w < BLOCK_WORDS; ++w)
+		block[w] &= ~other_block[w];
+	    if (block_empty(block))
+		release_block(block);
+	}
+    }
+
+    /* Calls f(id) for each bit set, in increasing order */
+    template<typename F>
+    void each_id(F f) const
+    {
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+	    Block const& block = blocks[i];
+	    for (size_t w = 0; w < block.size(); ++w)
+	    {
+		uint64_t word = block[w];
+		while (word)
+		{
+		    size_t bit = __builtin_ctzll(word);
+		    f(i * BLOCK_BITS + w * WORD_BITS + bit);
+		    word &= word - 1;
+		}
+	    }
+	}
+    }
+};
+
+static VALUE cDenseIds;
+static VALUE cBitmap;
+
+static DenseIds& dense_ids_wrapped(VALUE self)
+{
+    DenseIds* ids = 0;
+    Data_Get_Struct(self, DenseIds, ids);
+    return *ids;
+}
+
+static void dense_ids_mark(DenseIds const* ids)
+{
+    for (size_t i = 0; i < ids->objects.size(); ++i)
+	rb_gc_mark(ids->objects[i]);
+}
+static void dense_ids_free(DenseIds* ids) { delete ids; }
+static VALUE dense_ids_alloc(VALUE klass)
+{
+    DenseIds* ids = new DenseIds;
+    return Data_Wrap_Struct(klass, dense_ids_mark, dense_ids_free, ids);
+}
+
+/* call-seq:
+ *   ids.register(object) => id
+ *
+ * Returns the id of +object+, allocating one if needed. The ids of the
+ * released objects get reused
+ */
+static VALUE dense_ids_register(VALUE self, VALUE object)
+{ return ULONG2NUM(dense_ids_wrapped(self).register_object(object)); }
+
+/* call-seq:
+ *   ids.release(object) => id or nil
+ *
+ * Frees the id of +object+ and returns it. The caller must make sure that
+ * the bitmaps do not refer to it anymore. Returns nil if +object+ had no id
+ */
+static VALUE dense_ids_release(VALUE self, VALUE object)
+{
+    size_t id;
+    if (!dense_ids_wrapped(self).release(object, id))
+	return Qnil;
+    return ULONG2NUM(id);
+}
+
+/* call-seq:
+ *   ids.id_of(object) => id or nil
+ */
+static VALUE dense_ids_id_of(VALUE self, VALUE object)
+{
+    size_t id;
+    if (!dense_ids_wrapped(self).find(object, id))
+	return Qnil;
+    return ULONG2NUM(id);
+}
+
+/* call-seq:
+ *   ids.include?(object) => true or false
+ */
+static VALUE dense_ids_include_p(VALUE self, VALUE object)
+{
+    size_t id;
+    return dense_ids_wrapped(self).find(object, id) ? Qtrue : Qfalse;
+}
+
+/* call-seq:
+ *   ids[id] => object or nil
+ */
+static VALUE dense_ids_get(VALUE self, VALUE id)
+{
+    DenseIds const& ids = dense_ids_wrapped(self);
+    size_t i = NUM2ULONG(id);
+    if (i >= ids.objects.size())
+	return Qnil;
+    return ids.objects[i];
+}
+
+/* call-seq:
+ *   ids.size => integer
+ *
+ * The number of objects that have an id
+ */
+static VALUE dense_ids_size(VALUE self)
+{ return ULONG2NUM(dense_ids_wrapped(self).ids.size()); }
+
+/* call-seq:
+ *   ids.clear => ids
+ */
+static VALUE dense_ids_clear(VALUE self)
+{
+    dense_ids_wrapped(self).clear();
+    return self;
+}
+
+static VALUE dense_ids_initialize_copy(VALUE self, VALUE other)
+{
+    dense_ids_wrapped(self) = dense_ids_wrapped(other);
+    return self;
+}
+
+static Bitmap& bitmap_wrapped(VALUE self)
+{
+    Bitmap* bitmap = 0;
+    Data_Get_Struct(self, Bitmap, bitmap);
+    return *bitmap;
+}
+
+static void bitmap_mark(Bitmap const* bitmap)
+{ rb_gc_mark(bitmap->ids); }
+static void bitmap_free(Bitmap* bitmap) { delete bitmap; }
+static VALUE bitmap_alloc(VALUE klass)
+{
+    Bitmap* bitmap = new Bitmap;
+    return Data_Wrap_Struct(klass, bitmap_mark, bitmap_free, bitmap);
+}
+
+/* Returns the bitmap wrapped by +other+, and checks that it is defined on the
+ * same ids than +self+ */
+static Bitmap& bitmap_argument(VALUE self, VALUE other)
+{
+    if (!RTEST(rb_obj_is_kind_of(other, cBitmap)))
+	rb_raise(rb_eTypeError, "expected a Roby::Queries::Bitmap");
+    Bitmap& other_bitmap = bitmap_wrapped(other);
+    if (other_bitmap.ids != bitmap_wrapped(self).ids)
+	rb_raise(rb_eArgError, "the two bitmaps are not defined on the same ids");
+    return other_bitmap;
+}
+
+/* call-seq:
+ *   Bitmap.new(ids, source = nil)
+ *
+ * Creates a bitmap of the objects registered in the DenseIds object +ids+.
+ * If +source+ is given, the bitmap is initialized with its bits. It does not
+ * need to be defined on +ids+, which allows to copy the bitmaps along with
+ * their DenseIds object
+ */
+static VALUE bitmap_initialize(int argc, VALUE* argv, VALUE self)
+{
+    VALUE ids, source = Qnil;
+    rb_scan_args(argc, argv, "11", &ids, &source);
+    if (!RTEST(rb_obj_is_kind_of(ids, cDenseIds)))
+	rb_raise(rb_eTypeError, "expected a Roby::Queries::DenseIds");
+    if (!NIL_P(source) && !RTEST(rb_obj_is_kind_of(source, cBitmap)))
+	rb_raise(rb_eTypeError, "expected a Roby::Queries::Bitmap");
+
+    Bitmap& bitmap = bitmap_wrapped(self);
+    bitmap.ids = ids;
+    if (!NIL_P(source))
+	bitmap.blocks = bitmap_wrapped(source).blocks;
+    return self;
+}
+
+static VALUE bitmap_initialize_copy(VALUE self, VALUE other)
+{
+    bitmap_wrapped(self) = bitmap_wrapped(other);
+    return self;
+}
+
+/* call-seq:
+ *   bitmap.ids => dense_ids
+ */
+static VALUE bitmap_ids(VALUE self)
+{ return bitmap_wrapped(self).ids; }
+
+/* call-seq:
+ *   bitmap << object => bitmap
+ *
+ * Adds +object+ to the bitmap. Objects that have no id are ignored
+ */
+static VALUE bitmap_insert(VALUE self, VALUE object)
+{
+    Bitmap& bitmap = bitmap_wrapped(self);
+    size_t id;
+    if (dense_ids_wrapped(bitmap.ids).find(object, id))
+	bitmap.set(id);
+    return self;
+}
+
+/* call-seq:
+ *   bitmap.delete(object) => bitmap
+ */
+static VALUE bitmap_delete(VALUE self, VALUE object)
+{
+    Bitmap& bitmap = bitmap_wrapped(self);
+    size_t id;
+    if (dense_ids_wrapped(bitmap.ids).find(object, id))
+	bitmap.reset(id);
+    return self;
+}
+
+/* call-seq:
+ *   bitmap.include?(object) => true or false
+ */
+static VALUE bitmap_include_p(VALUE self, VALUE object)
+{
+    Bitmap const& bitmap = bitmap_wrapped(self);
+    size_t id;
+    if (!dense_ids_wrapped(bitmap.ids).find(object, id))
+	return Qfalse;
+    return bitmap.test(id) ? Qtrue : Qfalse;
+}
+
+/* call-seq:
+ *   bitmap.size => integer
+ */
+static VALUE bitmap_size(VALUE self)
+{ return ULONG2NUM(bitmap_wrapped(self).count()); }
+
+/* call-seq:
+ *   bitmap.empty? => true or false
+ */
+static VALUE bitmap_empty_p(VALUE self)
+{ return bitmap_wrapped(self).empty() ? Qtrue : Qfalse; }
+
+/* call-seq:
+ *   bitmap.clear => bitmap
+ */
+static VALUE bitmap_clear(VALUE self)
+{
+    bitmap_wrapped(self).blocks.clear();
+    return self;
+}
+
+struct BitmapToArray
+{
+    std::vector<VALUE> const& objects;
+    VALUE result;
+    BitmapToArray(std::vector<VALUE> const& objects, VALUE result)
+	: objects(objects), result(result) {}
+    void operator ()(size_t id) const
+    {
+	if (!NIL_P(objects[id]))
+	    rb_ary_push(result, objects[id]);
+    }
+};
+
+/* call-seq:
+ *   bitmap.to_a => array
+ *
+ * Returns the objects of this bitmap, in id order
+ */
+static VALUE bitmap_to_a(VALUE self)
+{
+    Bitmap const& bitmap = bitmap_wrapped(self);
+    VALUE result = rb_ary_new();
+    bitmap.each_id(BitmapToArray(dense_ids_wrapped(bitmap.ids).objects, result));
+    return result;
+}
+
+/* call-seq:
+ *   bitmap.each { |object| ... } => bitmap
+ */
+static VALUE bitmap_each(VALUE self)
+{
+    RETURN_ENUMERATOR(self, 0, 0);
+
+    VALUE objects = bitmap_to_a(self);
+    for (long i = 0; i < RARRAY_LEN(objects); ++i)
+	rb_yield(rb_ary_entry(objects, i));
+    return self;
+}
+
+struct BitmapToSet
+{
+    std::vector<VALUE> const& objects;
+    ValueSet& result;
+    BitmapToSet(std::vector<VALUE> const& objects, ValueSet& result)
+	: objects(objects), result(result) {}
+    void operator ()(size_t id) const
+    {
+	if (!NIL_P(objects[id]))
+	    result.insert(objects[id]);
+    }
+};
+
+/* call-seq:
+ *   bitmap.to_value_set => value_set
+ */
+static VALUE bitmap_to_value_set(VALUE self)
+{
+    Bitmap const& bitmap = bitmap_wrapped(self);
+    VALUE result = rb_class_new_instance(0, 0, cValueSet);
+    bitmap.each_id(BitmapToSet(dense_ids_wrapped(bitmap.ids).objects, get_wrapped_set(result)));
+    return result;
+}
+
+/* call-seq:
+ *   bitmap.intersection!(other) => bitmap
+ */
+static VALUE bitmap_intersection_bang(VALUE self, VALUE other)
+{
+    Bitmap& other_bitmap = bitmap_argument(self, other);
+    bitmap_wrapped(self).intersect(other_bitmap);
+    return self;
+}
+
+/* call-seq:
+ *   bitmap.merge(other) => bitmap
+ */
+static VALUE bitmap_merge(VALUE self, VALUE other)
+{
+    Bitmap& other_bitmap = bitmap_argument(self, other);
+    bitmap_wrapped(self).unite(other_bitmap);
+    return self;
+}
+
+/* call-seq:
+ *   bitmap.difference!(other) => bitmap
+ */
+static VALUE bitmap_difference_bang(VALUE self, VALUE other)
+{
+    Bitmap& other_bitmap = bitmap_argument(self, other);
+    bitmap_wrapped(self).subtract(other_bitmap);
+    return self;
+}
+
+/* call-seq:
+ *   bitmap & other => new_bitmap
+ */
+static VALUE bitmap_intersection(VALUE self, VALUE other)
+{
+    bitmap_argument(self, other);
+    VALUE result = rb_obj_dup(self);
+    return bitmap_intersection_bang(result, other);
+}
+
+/* call-seq:
+ *   bitmap | other => new_bitmap
+ */
+static VALUE bitmap_union(VALUE self, VALUE other)
+{
+    bitmap_argument(self, other);
+    VALUE result = rb_obj_dup(self);
+    return bitmap_merge(result, other);
+}
+
+/* call-seq:
+ *   bitmap - other => new_bitmap
+ */
+static VALUE bitmap_difference(VALUE self, VALUE other)
+{
+    bitmap_argument(self, other);
+    VALUE result = rb_obj_dup(self);
+    return bitmap_difference_bang(result, other);
+}
+
+void Init_bitmap()
+{
+    VALUE mRoby    = rb_define_module("Roby");
+    VALUE mQueries = rb_define_module_under(mRoby, "Queries");
+
+    cDenseIds = rb_define_class_under(mQueries, "DenseIds", rb_cObject);
+    rb_define_alloc_func(cDenseIds, dense_ids_alloc);
+    rb_define_method(cDenseIds, "initialize_copy", RUBY_METHOD_FUNC(dense_ids_initialize_copy), 1);
+    rb_define_method(cDenseIds, "register", RUBY_METHOD_FUNC(dense_ids_register), 1);
+    rb_define_method(cDenseIds, "release", RUBY_METHOD_FUNC(dense_ids_release), 1);
+    rb_define_method(cDenseIds, "id_of", RUBY_METHOD_FUNC(dense_ids_id_of), 1);
+    rb_define_method(cDenseIds, "include?", RUBY_METHOD_FUNC(dense_ids_include_p), 1);
+    rb_define_method(cDenseIds, "[]", RUBY_METHOD_FUNC(dense_ids_get), 1);
+    rb_define_method(cDenseIds, "size", RUBY_METHOD_FUNC(dense_ids_size), 0);
+    rb_define_method(cDenseIds, "clear", RUBY_METHOD_FUNC(dense_ids_clear), 0);
+
+    cBitmap = rb_define_class_under(mQueries, "Bitmap", rb_cObject);
+    rb_include_module(cBitmap, rb_mEnumerable);
+    rb_define_alloc_func(cBitmap, bitmap_alloc);
+    rb_define_method(cBitmap, "initialize", RUBY_METHOD_FUNC(bitmap_initialize), -1);
+    rb_define_method(cBitmap, "initialize_copy", RUBY_METHOD_FUNC(bitmap_initialize_copy), 1);
+    rb_define_method(cBitmap, "ids", RUBY_METHOD_FUNC(bitmap_ids), 0);
+    rb_define_method(cBitmap, "<<", RUBY_METHOD_FUNC(bitmap_insert), 1);
+    rb_define_method(cBitmap, "delete", RUBY_METHOD_FUNC(bitmap_delete), 1);
+    rb_define_method(cBitmap, "include?", RUBY_METHOD_FUNC(bitmap_include_p), 1);
+    rb_define_method(cBitmap, "size", RUBY_METHOD_FUNC(bitmap_size), 0);
+    rb_define_method(cBitmap, "empty?", RUBY_METHOD_FUNC(bitmap_empty_p), 0);
+    rb_define_method(cBitmap, "clear", RUBY_METHOD_FUNC(bitmap_clear), 0);
+    rb_define_method(cBitmap, "to_a", RUBY_METHOD_FUNC(bitmap_to_a), 0);
+    rb_define_method(cBitmap, "each", RUBY_METHOD_FUNC(bitmap_each), 0);
+    rb_define_method(cBitmap, "to_value_set", RUBY_METHOD_FUNC(bitmap_to_value_set), 0);
+    rb_define_method(cBitmap, "intersection!", RUBY_METHOD_FUNC(bitmap_intersection_bang), 1);
+    rb_define_method(cBitmap, "merge", RUBY_METHOD_FUNC(bitmap_merge), 1);
+    rb_define_method(cBitmap, "difference!", RUBY_METHOD_FUNC(bitmap_difference_bang), 1);
+    rb_define_method(cBitmap, "&", RUBY_METHOD_FUNC(bitmap_intersection), 1);
+    rb_define_method(cBitmap, "|", RUBY_METHOD_FUNC(bitmap_union), 1);
+    rb_define_method(cBitmap, "-", RUBY_METHOD_FUNC(bitmap_difference), 1);
+}
@@ -4,10 +4,10 @@
 
 using namespace std;
 
-static VALUE cValueSet;
+VALUE cValueSet;
 static ID id_new;
 
-static ValueSet& get_wrapped_set(VALUE self)
+ValueSet& get_wrapped_set(VALUE self)
 {
     ValueSet* object = 0;
     Data_Get_Struct(self, ValueSet, object);
@@ -392,6 +392,7 @@ static VALUE enumerable_to_value_set(VALUE self)
  * their object_id.
  */
 
+void Init_bitmap();
 extern "C" void Init_value_set()
 {
     rb_define_method(rb_mEnumerable, "to_value_set", RUBY_METHOD_FUNC(enumerable_to_value_set), 0);
@@ -420,6 +421,8 @@ extern "C" void Init_value_set()
     rb_define_method(cValueSet, "clear", RUBY_METHOD_FUNC(value_set_clear), 0);
     rb_define_method(cValueSet, "initialize_copy", RUBY_METHOD_FUNC(value_set_initialize_copy), 1);
     rb_define_method(cValueSet, "delete_if", RUBY_METHOD_FUNC(value_set_delete_if), 0);
+
+    Init_bitmap();
 }
 
 
@@ -5,5 +5,10 @@
 #include "ruby_allocator.hh"
 typedef std::set<VALUE, std::less<VALUE>, ruby_allocator<VALUE> > ValueSet;
 
+/* The ValueSet class, and the set wrapped by one of its instances. They are
+ * defined in value_set.cc for the other native code of this extension */
+extern VALUE cValueSet;
+ValueSet& get_wrapped_set(VALUE self);
+
 #endif
 
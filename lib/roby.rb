@@ -120,6 +120,8 @@ class Task < PlanObject; end
 
 require 'roby/decision_control'
 require 'roby/schedulers/null'
+require 'roby/cycle_profiler'
+require 'roby/sampling_profiler'
 require 'roby/execution_engine'
 require 'roby/app'
 require 'roby/state'
@@ -497,6 +497,9 @@ def self.common_optparse_setup(parser)
         Roby.app.public_logs = true
         Roby.app.filter_backtraces = false
       end
+      parser.on('--sampling-profiler[=PERIOD]', Float, "samples the execution thread every PERIOD seconds (defaults to #{SamplingProfiler::DEFAULT_PERIOD}) and saves a flame graph in the log dir") do |period|
+        Roby.app.sampling_profiler_period = period || SamplingProfiler::DEFAULT_PERIOD
+      end
       parser.on_tail('-h', '--help', 'this help message') do
         STDERR.puts parser
         exit
@@ -1537,6 +1540,9 @@ def prepare
         logfile = File.join(log_dir, robot_name)
         logger  = Roby::Log::FileLogger.new(logfile, :plugins => plugins.map { |n, _| n })
         logger.stats_mode = (log['events'] == 'stats')
+        if log['flush_interval']
+          logger.flush_interval = log['flush_interval']
+        end
         Roby::Log.add_logger logger
 
         Robot.info "logs are in #{log_dir}"
@@ -1557,6 +1563,9 @@ def run(&block)
       engine = self.plan.engine
       options = { :cycle => engine_config['cycle'] || 0.1 }
 
+      if sampling_profiler_period
+        start_sampling_profiler(sampling_profiler_period)
+      end
       engine.run options
       plugins = self.plugins.map { |_, mod| mod if (mod.respond_to?(:start) || mod.respond_to?(:run)) }.compact
       run_plugins(plugins, &block)
@@ -1655,6 +1664,7 @@ def cleanup
         end
       end
 
+      stop_sampling_profiler
       stop_log_server
       stop_shell_interface
       if manage_drb?
@@ -1767,6 +1777,39 @@ def start_log_server(logfile)
       end
     end
 
+    # If non-nil, {#run} starts the sampling profiler with this period
+    #
+    # @see start_sampling_profiler
+    attr_accessor :sampling_profiler_period
+
+    # The sampling profiler started by {#start_sampling_profiler}, or nil
+    #
+    # @return [SamplingProfiler,nil]
+    attr_reader :sampling_profiler
+
+    # Starts sampling the execution thread
+    #
+    # The samples are saved in the log directory as ROBOT-samples.folded
+    #
+    # @param [Float] period the sampling period in seconds
+    # @return [SamplingProfiler]
+    def start_sampling_profiler(period = SamplingProfiler::DEFAULT_PERIOD)
+      stop_sampling_profiler
+      path = File.join(log_dir, "#{robot_name}-samples.folded")
+      @sampling_profiler = SamplingProfiler.new(plan.engine, path, period: period)
+      sampling_profiler.start
+      Robot.info "sampling the execution thread every #{period}s into #{path}"
+      sampling_profiler
+    end
+
+    # Stops the sampling profiler started by {#start_sampling_profiler}
+    def stop_sampling_profiler
+      if @sampling_profiler
+        @sampling_profiler.stop
+        @sampling_profiler = nil
+      end
+    end
+
     def stop_log_server
       if @log_server
         Process.kill('INT', @log_server)
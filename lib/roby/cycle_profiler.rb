@@ -0,0 +1,334 @@
+module Roby
+    # Instrumentation of the execution engine's cycle
+    #
+    # Unlike the timepoints stored in the cycle statistics (see
+    # {ExecutionEngine#add_timepoint}), which are meant for offline analysis,
+    # the profiler accumulates the durations in histograms that can be
+    # queried live, e.g. through the Roby interface. It records:
+    #
+    # * the latency of each cycle, i.e. the time spent between the cycle start
+    #   and the point where the engine goes to sleep
+    # * the duration of each phase of the cycle, named after the timepoints
+    #   (:events, :structure_check, :garbage_collect, :ruby_gc, ...). The time
+    #   spent in Ruby's GC during the cycle is recorded as the :gc phase when
+    #   the interpreter reports it.
+    # * the duration of each propagation handler and poll block, indexed by
+    #   the location of their block (see
+    #   {ExecutionEngine::PollBlockDefinition#profile_key})
+    #
+    # When a cycle overruns the cycle length, the biggest of the cycle's
+    # slowest handler, of the time spent in each phase outside of the
+    # measured handlers and of the GC time is registered as its culprit in
+    # {#overruns}.
+    #
+    # All durations are measured with the monotonic clock.
+    class CycleProfiler
+        # A histogram with a bounded relative error, in the spirit of
+        # HdrHistogram
+        #
+        # Values are stored in microseconds. Below 2 * SUB_BUCKET_COUNT, each
+        # value has its own bucket. Above, each power of two is split into
+        # SUB_BUCKET_COUNT buckets, which bounds the relative error of the
+        # percentiles to 1 / SUB_BUCKET_COUNT
+        class Histogram
+            SUB_BUCKET_BITS  = 5
+            SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS
+
+            # The number of recorded values
+            attr_reader :count
+            # The sum of the recorded values, in seconds
+            attr_reader :sum
+            # The smallest recorded value, in seconds
+            attr_reader :min
+            # The biggest recorded value, in seconds
+            attr_reader :max
+            # The count of values per bucket
+            attr_reader :buckets
+
+            def initialize
+                reset
+            end
+
+            # Removes all recorded values
+            def reset
+                @count = 0
+                @sum = 0
+                @min = nil
+                @max = nil
+                @buckets = Array.new
+            end
+
+            def empty?; count == 0 end
+
+            # Returns the index of the bucket in which a value in microseconds
+            # is stored
+            def self.bucket_index(value)
+                shift = value.bit_length - SUB_BUCKET_BITS - 1
+                if shift <= 0
+                    value
+                else
+                    (shift << SUB_BUCKET_BITS) + (value >> shift)
+                end
+            end
+
+            # Returns the biggest value, in microseconds, that is stored in
+            # the given bucket
+            def self.bucket_upper_bound(index)
+                if index < 2 * SUB_BUCKET_COUNT
+                    index
+                else
+                    shift = (index >> SUB_BUCKET_BITS) - 1
+                    ((index - (shift << SUB_BUCKET_BITS) + 1) << shift) - 1
+                end
+            end
+
+            # Records a duration given in seconds
+            def record(duration)
+                if duration < 0
+                    duration = 0
+                end
+                index = Histogram.bucket_index((duration * 1_000_000).round)
+                buckets[index] = (buckets[index] || 0) + 1
+                @count += 1
+                @sum += duration
+                if !min || min > duration
+                    @min = duration
+                end
+                if !max || max < duration
+                    @max = duration
+                end
+                self
+            end
+
+            # Adds the values recorded in another histogram to this one
+            def merge(histogram)
+                histogram.buckets.each_with_index do |c, i|
+                    if c
+                        buckets[i] = (buckets[i] || 0) + c
+                    end
+                end
+                @count += histogram.count
+                @sum += histogram.sum
+                if histogram.min && (!min || min > histogram.min)
+                    @min = histogram.min
+                end
+                if histogram.max && (!max || max < histogram.max)
+                    @max = histogram.max
+                end
+                self
+            end
+
+            # The mean of the recorded values, in seconds
+            def mean
+                if count > 0
+                    sum / count
+                end
+            end
+
+            # Returns the value, in seconds, below which the given percentage
+            # of the recorded values are
+            #
+            # @param [Float] p the percentage, in [0, 100]
+            # @return [Float,nil] the percentile, or nil if the histogram is
+            #   empty
+            def percentile(p)
+                return if empty?
+
+                target = [(count * p / 100.0).ceil, 1].max
+                seen = 0
+                buckets.each_with_index do |c, i|
+                    next if !c
+                    seen += c
+                    if seen >= target
+                        value = Histogram.bucket_upper_bound(i) / 1_000_000.0
+                        return [[value, max].min, min].max
+                    end
+                end
+                max
+            end
+
+            # Returns a summary of the histogram
+            #
+            # @return [Hash] the count, min, max, mean and a set of percentiles
+            #   (p50, p90, p99, p999). All durations are in seconds
+            def to_h
+                Hash[count: count, min: min, max: max, mean: mean,
+                     p50: percentile(50), p90: percentile(90),
+                     p99: percentile(99), p999: percentile(99.9)]
+            end
+        end
+
+        # Whether the profiler records anything
+        attr_predicate :enabled?, true
+        # The latency of the cycles
+        #
+        # @return [Histogram]
+        attr_reader :cycles
+        # The duration of the cycle phases
+        #
+        # @return [Hash<Symbol,Histogram>]
+        attr_reader :phases
+        # The duration of the handlers
+        #
+        # @return [Hash<String,Histogram>]
+        attr_reader :handlers
+        # The count of cycles that overran the cycle length
+        attr_reader :overrun_count
+        # The number of overruns per culprit, i.e. per slowest handler or
+        # phase of the overrunning cycles
+        #
+        # @return [Hash<String,Integer>]
+        attr_reader :overruns
+        # How often (in cycles) the execution engine should dump the
+        # profile in the log. Set to zero or nil to disable.
+        attr_accessor :dump_period
+
+        def initialize
+            @enabled = false
+            @dump_period = 100
+            reset
+        end
+
+        # Removes all the recorded data
+        def reset
+            @cycles = Histogram.new
+            @phases = Hash.new
+            @handlers = Hash.new
+            @overrun_count = 0
+            @overruns = Hash.new(0)
+            @cycle_start = nil
+            @last_timepoint = nil
+            @slowest_handler = nil
+            @cycle_phases = Hash.new(0)
+            @cycle_gc_duration = nil
+        end
+
+        if defined?(Process::CLOCK_MONOTONIC)
+            def self.now; Process.clock_gettime(Process::CLOCK_MONOTONIC) end
+        else
+            def self.now; Time.now.to_f end
+        end
+
+        if GC.respond_to?(:stat) && GC.stat.has_key?(:time)
+            # The time spent in the GC since the process start, in
+            # seconds
+            def self.gc_time; GC.stat(:time) / 1000.0 end
+        else
+            def self.gc_time; end
+        end
+
+        # Starts measuring a new cycle
+        def start_cycle
+            @cycle_start = @last_timepoint = CycleProfiler.now
+            @cycle_gc_time = CycleProfiler.gc_time
+            @slowest_handler = nil
+            @slowest_handler_duration = 0
+            @handlers_duration = 0
+            @cycle_phases = Hash.new(0)
+            @cycle_gc_duration = nil
+        end
+
+        # Records the time elapsed since the last timepoint as the duration of
+        # the phase +name+
+        def timepoint(name)
+            now = CycleProfiler.now
+            if @last_timepoint
+                duration = now - @last_timepoint
+                (phases[name] ||= Histogram.new).record(duration)
+                if @cycle_start
+                    @cycle_phases[name] += duration - (@handlers_duration || 0)
+                end
+            end
+            @handlers_duration = 0
+            @last_timepoint = now
+        end
+
+        # Yields, and records the duration of the block as the duration of
+        # the handler +description+
+        #
+        # @return the value returned by the block
+        def measure(description)
+            return yield if !enabled?
+
+            start = CycleProfiler.now
+            begin
+                yield
+            ensure
+                duration = CycleProfiler.now - start
+                (handlers[description] ||= Histogram.new).record(duration)
+                @handlers_duration = (@handlers_duration || 0) + duration
+                if duration > (@slowest_handler_duration || 0)
+                    @slowest_handler = description
+                    @slowest_handler_duration = duration
+                end
+            end
+        end
+
+        # Ends the measurement of the current cycle
+        #
+        # @param [Float] cycle_length the expected cycle length, in seconds
+        # @return [Float,nil] the cycle latency, or nil if no cycle was
+        #   started
+        def end_cycle(cycle_length)
+            return if !@cycle_start
+
+            latency = CycleProfiler.now - @cycle_start
+            cycles.record(latency)
+            if @cycle_gc_time
+                @cycle_gc_duration = CycleProfiler.gc_time - @cycle_gc_time
+                (phases[:gc] ||= Histogram.new).record(@cycle_gc_duration)
+            end
+            if latency > cycle_length
+                @overrun_count += 1
+                overruns[overrun_culprit] += 1
+            end
+            @cycle_start = nil
+            latency
+        end
+
+        # Returns the description of what is to blame for the current cycle's
+        # overrun
+        #
+        # The phases are charged only for the time spent outside of the
+        # measured handlers, so that a slow handler is not hidden behind the
+        # phase it is called in.
+        def overrun_culprit
+            candidates = Hash.new
+            if @slowest_handler
+                candidates[@slowest_handler] = @slowest_handler_duration
+            end
+            @cycle_phases.each do |name, duration|
+                candidates["phase #{name}"] = duration
+            end
+            if @cycle_gc_duration
+                candidates["phase gc"] = @cycle_gc_duration
+            end
+
+            if culprit = candidates.max_by { |_, duration| duration }
+                culprit.first
+            else
+                "unknown"
+            end
+        end
+
+        # Tests whether the profile should be dumped at the end of the given
+        # cycle
+        def dump?(cycle_index)
+            enabled? && dump_period && dump_period > 0 &&
+                (cycle_index % dump_period) == 0
+        end
+
+        # Returns a summary of the recorded data
+        #
+        # The returned hash only contains plain objects (hashes, strings,
+        # symbols and numbers) so that it can be marshalled in the log and
+        # through the Roby interface
+        def report
+            Hash[cycles: cycles.to_h,
+                 overrun_count: overrun_count,
+                 overruns: Hash[overruns],
+                 phases: Hash[phases.map { |name, h| [name, h.to_h] }],
+                 handlers: Hash[handlers.map { |name, h| [name, h.to_h] }]]
+        end
+    end
+end
@@ -32,6 +32,7 @@ def add_owner(peer, distributed = true)
 		    owners << peer
 		    if plan
 			plan.task_index.add_owner(self, peer)
+			plan.notify_task_status_changed(self)
 		    end
 		    Distributed.debug { "added owner to #{self}: #{owners.to_a}" }
 		end
@@ -55,6 +56,7 @@ def remove_owner(peer, distributed = true)
 		    removed_owner(peer)
 		    if plan
 			plan.task_index.remove_owner(self, peer)
+			plan.notify_task_status_changed(self)
 		    end
 		    Distributed.debug { "removed owner to #{self}: #{owners.to_a}" }
 		end
@@ -193,14 +193,17 @@ def call_without_propagation(context)
                 end
 
 		@pending = true
-                @pending_sources = plan.engine.propagation_source_events
-		plan.engine.propagation_context([self]) do
+                engine = plan.engine
+                @pending_sources = engine.propagation_source_events
+		engine.propagation_context([self]) do
+                    current_handler, engine.current_handler = engine.current_handler, self
                     begin
                         @calling_command = true
                         @command_emitted = false
                         command[context]
                     ensure
                         @calling_command = false
+                        engine.current_handler = current_handler
                     end
 		end
 
@@ -564,16 +567,20 @@ def call_handlers(event)
 	    # to other objects are not done, but gathered in the 
 	    # :propagation TLS
             all_handlers = enum_for(:each_handler).to_a
+            engine = plan.engine
+            current_handler, engine.current_handler = engine.current_handler, self
 	    all_handlers.each do |h| 
 		begin
 		    h.call(event)
                 rescue LocalizedError => e
-                    plan.engine.add_error( e )
+                    engine.add_error( e )
 		rescue Exception => e
-		    plan.engine.add_error( EventHandlerError.new(e, event) )
+		    engine.add_error( EventHandlerError.new(e, event) )
 		end
 	    end
             handlers.delete_if { |h| h.once? }
+        ensure
+            engine.current_handler = current_handler if engine
 	end
 
 	# Raises an exception object when an event whose command has been
@@ -1,3 +1,4 @@
+require 'roby_timer_queue'
 module Roby
     # Exception wrapper used to report that multiple errors have been raised
     # during a synchronous event processing call.
@@ -177,7 +178,7 @@ def initialize(plan, control = Roby::DecisionControl.new)
             @propagation_id = 0
             @propagation_exceptions = nil
             @application_exceptions = nil
-            @delayed_events = []
+            @delayed_events = TimerQueue.new(3)
             @event_ordering = Array.new
             @event_priorities = Hash.new
             @propagation_handlers = []
@@ -193,6 +194,7 @@ def initialize(plan, control = Roby::DecisionControl.new)
             @worker_threads_mtx = Mutex.new
             @worker_threads = Array.new
             @worker_completion_blocks = Queue.new
+            @profiler = CycleProfiler.new
 
 	    each_cycle(&ExecutionEngine.method(:call_every))
 
@@ -254,6 +256,23 @@ def initialize(description, handler, options)
         
             def to_s; "#<PollBlockDefinition: #{description} #{handler} on_error:#{on_error}>" end
 
+            # The name under which the durations of this handler are
+            # accumulated by the cycle profiler
+            #
+            # The descriptions embed the handler's address, so the handlers
+            # are named after the location of their block instead. The
+            # one-shot handlers (#once, #delayed, worker completion blocks)
+            # are all accumulated together.
+            def profile_key
+                @profile_key ||=
+                    if once? then "one-shot handlers"
+                    elsif handler.respond_to?(:source_location) && (location = handler.source_location)
+                        description.sub(handler.to_s, location.join(":"))
+                    else
+                        description
+                    end
+            end
+
             def call(engine, *args)
                 handler.call(*args)
                 true
@@ -485,10 +504,15 @@ def each_cycle(&block)
         # See Schedulers::Basic
         attr_reader :scheduler
 
+        # Sets the scheduler. The #teardown method of the previous
+        # scheduler, if it has one, is called
         def scheduler=(scheduler)
             if !scheduler
                 raise ArgumentError, "cannot set the scheduler to nil. You can disable the current scheduler with .enabled = false instead, or set it to Schedulers::Null.new"
             end
+            if @scheduler != scheduler && @scheduler.respond_to?(:teardown)
+                @scheduler.teardown
+            end
             @scheduler = scheduler
         end
 
@@ -524,11 +548,12 @@ def propagation_source_generators
             result
         end
 
-        # The set of pending delayed events. This is an array of the form
+        # The set of pending delayed events. This is a {TimerQueue} of
+        # entries of the form
         #
-        #   [[time, is_forward, source, target, context], ...]
+        #   [time, is_forward, source, target, context]
         #
-        # See #add_event_delay for more information
+        # keyed by target. See #add_event_delay for more information
         attr_reader :delayed_events
 
         # Adds a propagation step to be performed when the current time is
@@ -548,18 +573,14 @@ def add_event_delay(time, is_forward, source, target, context)
         #
         # See #add_event_delay and #delayed_events
         def execute_delayed_events
-            reftime = Time.now
-            delayed_events.delete_if do |time, forward, source, signalled, context|
-                if time <= reftime
-                    add_event_propagation(forward, [source], signalled, context, nil)
-                    true
-                end
+            delayed_events.pop_until(Time.now).each do |time, forward, source, signalled, context|
+                add_event_propagation(forward, [source], signalled, context, nil)
             end
         end
 
         # Called by #plan when an event became unreachable
         def unreachable_event(event)
-            delayed_events.delete_if { |_, _, _, signalled, _| signalled == event }
+            delayed_events.delete_all_for(event)
             super if defined? super
         end
 
@@ -747,8 +768,13 @@ def call_poll_blocks(blocks, late = false)
                     next
                 end
 
-                if !handler.call(self, plan)
-                    handler.disabled = true
+                begin
+                    @current_handler = handler
+                    if !profiler.measure(handler.profile_key) { handler.call(self, plan) }
+                        handler.disabled = true
+                    end
+                ensure
+                    @current_handler = nil
                 end
                 handler.once?
             end
@@ -761,7 +787,7 @@ def process_workers
             completion_blocks = []
             while !worker_completion_blocks.empty?
                 block = worker_completion_blocks.pop
-                completion_blocks << PollBlockDefinition.new("worker completion handler #{block}", block, Hash.new)
+                completion_blocks << PollBlockDefinition.new("worker completion handler #{block}", block, Hash[:once => true])
             end
             call_poll_blocks(completion_blocks)
         end
@@ -776,9 +802,11 @@ def gather_external_events
         def call_propagation_handlers
             if scheduler.enabled?
                 gather_framework_errors('scheduler') do
-                    report_scheduler_state(scheduler.state)
-                    scheduler.clear_reports
-                    scheduler.initial_events
+                    profiler.measure('scheduler') do
+                        report_scheduler_state(scheduler.state)
+                        scheduler.clear_reports
+                        scheduler.initial_events
+                    end
                 end
             end
             call_poll_blocks(self.class.propagation_handlers, false)
@@ -1545,21 +1573,47 @@ def handled_exception(error, task)
         def unmark_finished_missions_and_permanent_tasks
             to_unmark = plan.task_index.by_predicate[:finished?] | plan.task_index.by_predicate[:failed?]
 
-            finished_missions = (plan.missions & to_unmark)
+            finished_missions = plan.missions.find_all { |t| to_unmark.include?(t) }
 	    # Remove all missions that are finished
 	    for finished_mission in finished_missions
                 if !finished_mission.being_repaired?
                     plan.unmark_mission(finished_mission)
                 end
 	    end
-            finished_permanent = (plan.permanent_tasks & to_unmark)
-	    for finished_permanent in (plan.permanent_tasks & to_unmark)
+	    for finished_permanent in plan.permanent_tasks.find_all { |t| to_unmark.include?(t) }
                 if !finished_permanent.being_repaired?
                     plan.unmark_permanent(finished_permanent)
                 end
 	    end
         end
         
+        # Returns the subset of +tasks+ that have no unfinished parents in
+        # +relations+
+        def gc_roots(tasks, relations)
+            BGL::Graph.roots(relations, tasks, BGL::Vertex::FINISHED_FLAG)
+        end
+
+        # Breaks the cycles that exist between the unfinished tasks of +tasks+
+        # in +relations+, by removing one weak edge in each of them. The cycles
+        # that have no weak edges are left alone.
+        #
+        # @return [Boolean] true if at least one edge has been removed
+        def break_gc_cycles(tasks, relations)
+            removed_edge = false
+            while cycle = BGL::Graph.find_cycle(relations, tasks, tasks, BGL::Vertex::FINISHED_FLAG)
+                from, to, rel = cycle.find { |_, _, edge_rel| edge_rel.weak? }
+                if !rel
+                    debug { "GC: cannot break cycle #{cycle.map { |edge_from, edge_to, edge_rel| "#{edge_from} -> #{edge_to} (#{edge_rel})" }.join(", ")}, it has no weak relations" }
+                    break
+                end
+
+                debug { "GC: breaking cycle by removing #{from} -> #{to} in #{rel}" }
+                rel.remove_relation(from, to)
+                removed_edge = true
+            end
+            removed_edge
+        end
+
         # Kills and removes all unneeded tasks. +force_on+ is a set of task
         # whose garbage-collection must be performed, even though those tasks
         # are actually useful for the system. This is used to properly kill
@@ -1621,31 +1675,18 @@ def garbage_collect(force_on = nil)
                 end
 
                 # Mark all root local_tasks as garbage.
-                roots = nil
-                2.times do |i|
-                    roots = local_tasks.dup
-                    for rel in TaskStructure.relations
-                        next if !rel.root_relation?
-                        roots.delete_if do |t|
-                            t.enum_parent_objects(rel).any? { |p| !p.finished? }
-                        end
-                        break if roots.empty?
-                    end
-
-                    break if i == 1 || !roots.empty?
-
+                root_relations = TaskStructure.relations.find_all(&:root_relation?)
+                roots = gc_roots(local_tasks, root_relations)
+                if roots.empty?
                     # There is a cycle somewhere. Try to break it by removing
-                    # weak relations within elements of local_tasks
+                    # the weak edges that are part of it
                     debug "cycle found, removing weak relations"
-
-                    local_tasks.each do |t|
-                        for rel in t.sorted_relations
-                            rel.remove(t) if rel.weak?
-                        end
+                    if break_gc_cycles(local_tasks, root_relations)
+                        roots = gc_roots(local_tasks, root_relations)
                     end
                 end
 
-                (roots.to_value_set - finishing - plan.gc_quarantine).each do |local_task|
+                (roots - finishing - plan.gc_quarantine).each do |local_task|
                     if local_task.pending?
                         info "GC: removing pending task #{local_task}"
 
@@ -1956,6 +1997,33 @@ def add_expected_duration(stats, name, duration)
         def add_timepoint(stats, name)
             stats[:end] = stats[name] = Time.now - stats[:start]
             @remaining_cycle_time = cycle_length - stats[:end]
+            if profiler.enabled?
+                profiler.timepoint(name)
+            end
+        end
+
+        # The object whose code is currently being run by the engine
+        #
+        # It is either a {PollBlockDefinition} while the poll blocks and
+        # propagation handlers are called, or an {EventGenerator} while its
+        # command or handlers are called. It is nil otherwise. It is used by
+        # {SamplingProfiler} to attribute the samples.
+        attr_accessor :current_handler
+
+        # The profiler that measures the cycle latency as well as the
+        # duration of the cycle phases and of the handlers
+        #
+        # It is disabled by default
+        #
+        # @return [CycleProfiler]
+        attr_reader :profiler
+
+        # Called every {CycleProfiler#dump_period} cycles with the profiler's
+        # report while the profiler is enabled
+        #
+        # @param [Hash] report the profile, see {CycleProfiler#report}
+        def cycle_profile(report)
+            super if defined? super
         end
 
         # If set to true, Roby will warn if the GC cannot be controlled by Roby
@@ -2008,6 +2076,10 @@ def event_loop
 		    end
                     stats[:start] = cycle_start
 		    stats[:cycle_index] = cycle_index
+                    BGL::Graph.journal_stamp = cycle_index
+                    if profiler.enabled?
+                        profiler.start_cycle
+                    end
 
                     Roby.synchronize do
                         process_events(stats) 
@@ -2023,6 +2095,9 @@ def event_loop
 			GC.disable
 		    end
 		    add_timepoint(stats, :ruby_gc)
+                    if profiler.enabled?
+                        profiler.end_cycle(cycle_length)
+                    end
 
 		    # Sleep if there is enough time for it
 		    if remaining_cycle_time > SLEEP_MIN_TIME
@@ -2055,6 +2130,9 @@ def event_loop
                     stats[:state] = Roby::State
                     Roby.synchronize do
                         cycle_end(stats)
+                        if profiler.dump?(cycle_index)
+                            cycle_profile(profiler.report)
+                        end
                     end
                     stats = Hash.new
 
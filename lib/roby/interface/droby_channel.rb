@@ -74,7 +74,7 @@ def read_packet(timeout = 0)
                     end
                 end
 
-                unmarshalled = begin Marshal.load(packet.to_s)
+                unmarshalled = begin Distributed::BinaryFormat.load(packet.to_s)
                                rescue TypeError => e
                                    raise ProtocolError, "failed to unmarshal received packet: #{e.message}"
                                end
@@ -89,10 +89,12 @@ def read_packet(timeout = 0)
             # Write one ruby object (usually an array) as a marshalled packet and
             # send it to {#io}
             #
+            # The object is encoded with {Distributed::BinaryFormat}
+            #
             # @param [Object] object the object to be sent
             # @return [void]
             def write_packet(object)
-                marshalled = Marshal.dump(object.droby_dump(remote_object_manager))
+                marshalled = Distributed::BinaryFormat.dump(object.droby_dump(remote_object_manager))
                 packet =
                     if client?
                         WebSocket::Frame::Outgoing::Client.new(data: marshalled, type: :binary)
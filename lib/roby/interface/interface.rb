@@ -146,6 +146,61 @@ def actions
             end
             command :actions, 'lists a summary of the available actions'
 
+            # Enables or disables the execution engine's cycle profiler
+            #
+            # @param [Boolean] enable
+            # @param [Integer,nil] dump_period if non-nil, how often (in
+            #   cycles) the profile should be dumped in the log
+            # @see ExecutionEngine#profiler
+            def cycle_profiler(enable, dump_period = nil)
+                engine.execute do
+                    engine.profiler.enabled = enable
+                    if dump_period
+                        engine.profiler.dump_period = Integer(dump_period)
+                    end
+                end
+                nil
+            end
+            command :cycle_profiler, 'enables or disables the cycle profiler',
+                enable: 'whether the profiler should be enabled',
+                dump_period: 'how often, in cycles, the profile is dumped in the log'
+
+            # Returns the current cycle profile
+            #
+            # @param [Boolean] reset if true, the recorded data is cleared
+            #   once the report is generated
+            # @return [Hash] see {CycleProfiler#report}
+            def cycle_profile(reset = false)
+                engine.execute do
+                    report = engine.profiler.report
+                    if reset
+                        engine.profiler.reset
+                    end
+                    report
+                end
+            end
+            command :cycle_profile, 'returns the cycle latency, phase and handler histograms',
+                reset: 'whether the recorded data should be cleared'
+
+            # Starts or stops the sampling profiler
+            #
+            # @param [Boolean] enable
+            # @param [Float] period the sampling period in seconds
+            # @return [String,nil] the path to the file in which the samples
+            #   are saved
+            # @see Application#start_sampling_profiler
+            def sampling_profiler(enable, period = SamplingProfiler::DEFAULT_PERIOD)
+                if enable
+                    app.start_sampling_profiler(Float(period)).path
+                else
+                    app.stop_sampling_profiler
+                    nil
+                end
+            end
+            command :sampling_profiler, 'starts or stops sampling the execution thread for flame graphs',
+                enable: 'whether the profiler should be running',
+                period: 'the sampling period in seconds'
+
             # Starts a job
             #
             # @return [Integer] the job ID
@@ -15,7 +15,7 @@ module Interface
             # auto-allocate a job ID using {#allocate_job_id}.
             #
             # @return [Integer,nil]
-            argument :job_id, default: nil
+            argument :job_id, default: nil, index: true
 
             def self.allocate_job_id
                 @@job_id += 1
@@ -129,7 +129,7 @@ def read
 		start_pos = index_data[current_cycle][:pos]
 		logfile.seek(start_pos)
                 data_size = logfile.read(4).unpack("I").first
-		Marshal.load_with_missing_constants(logfile.read(data_size))
+		Roby::Log::Logfile.load_chunk_data(logfile.read(data_size))
 
 	    ensure
 		@current_cycle += 1
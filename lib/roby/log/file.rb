@@ -4,7 +4,7 @@
 module Roby::Log
     class Logfile < DelegateClass(File)
 	# The current log format version
-	FORMAT_VERSION = 4
+	FORMAT_VERSION = 5
 
 	attr_reader :event_io
 	attr_reader :index_io
@@ -96,18 +96,28 @@ def read_header
             Logfile.read_header(@event_io)
         end
 
+        # Writes +object+ to +io+ as one chunk, i.e. the size of its encoding
+        # with Distributed::BinaryFormat followed by the encoding itself
+        #
+        # If +buffer_io+ is given, the underlying string of this StringIO is
+        # reused as encoding buffer
         def self.dump(object, io, buffer_io = nil)
             if buffer_io
-		buffer_io.truncate(0)
-		buffer_io.seek(0)
-                Marshal.dump(object, buffer_io)
-                io.write([buffer_io.size].pack("I"))
-                io.write(buffer_io.string)
+                buffer = buffer_io.string
+                buffer.clear
+                Roby::Distributed::BinaryFormat.dump(object, buffer)
             else
-                buffer = Marshal.dump(object)
-                io.write([buffer.size].pack("I"))
-                io.write(buffer)
+                buffer = Roby::Distributed::BinaryFormat.dump(object)
             end
+            io.write([buffer.size].pack("I"))
+            io.write(buffer)
+        end
+
+        # Decodes the data of a chunk written by {dump}
+        #
+        # Chunks of format 4 (marshalled data) are accepted as well
+        def self.load_chunk_data(buffer)
+            Roby::Distributed::BinaryFormat.load(buffer, true)
         end
 
         def dump(object, buffer_io = nil)
@@ -128,7 +138,7 @@ def self.load_one_chunk(io)
             if !buffer || buffer.size < data_size
                 raise TruncatedFileError
             end
-            Marshal.load_with_missing_constants(buffer)
+            load_chunk_data(buffer)
         end
 
         def load_one_chunk
@@ -333,18 +343,40 @@ class FileLogger
 	# The set of events for the current cycle. This is dumped only
 	# when the +cycle_end+ event is received
 	attr_reader :current_cycle
-	# StringIO object on which we dump the data
-	attr_reader :dump_io
+	# The ChunkWriter object that buffers the chunks of the event log
+	attr_reader :event_writer
+	# The ChunkWriter object that buffers the chunks of the index log
+	attr_reader :index_writer
+
+	class << self
+	    # The default value for #flush_interval
+	    attr_accessor :flush_interval
+	end
+	@flush_interval = 0.1
 
 	def initialize(basename, options)
-	    @current_pos   = 0
-	    @dump_io	   = StringIO.new('', 'w')
 	    @current_cycle = Array.new
 	    @event_log = File.open("#{basename}-events.log", 'w')
 	    event_log.sync = true
 	    Logfile.write_header(@event_log, options)
 	    @index_log = File.open("#{basename}-index.log", 'w')
 	    index_log.sync = true
+
+	    @event_writer = ChunkWriter.new(event_log, FileLogger.flush_interval)
+	    # The index writer shares the event writer's flush thread, so that
+	    # an index entry never reaches the disk before the cycle it points
+	    # to
+	    @index_writer = ChunkWriter.new(index_log, nil, event_writer)
+	end
+
+	# The maximum time, in seconds, during which the chunks are kept in
+	# memory before being written to the log files. The writes are done
+	# in a background thread, all the chunks queued during that time
+	# being written at once. Set to zero to write each cycle as soon as
+	# possible.
+	def flush_interval; event_writer.flush_interval end
+	def flush_interval=(value)
+	    event_writer.flush_interval = value
 	end
 
 	attr_accessor :stats_mode
@@ -355,21 +387,30 @@ def logs_message?(m)
 
         def close
             dump_method(:cycle_end, Time.now, [])
+            event_writer.close
+            index_writer.close
             @event_log.close
             @index_log.close
         end
 
+        # Called by Log.flush. Waits for all the queued chunks to be
+        # written on disk
+        def flush(time, args)
+            event_writer.flush
+            index_writer.flush
+        end
+
 	def dump_method(m, time, args)
 	    if m == :cycle_end || !stats_mode
 		current_cycle << m << time.tv_sec << time.tv_usec << args
 	    end
 	    if m == :cycle_end
 		info = args.first
-		info[:pos] = event_log.tell
+		info[:pos] = event_writer.tell
 		info[:event_count] = current_cycle.size / 4
 
-		Logfile.dump(current_cycle, event_log, dump_io)
-		Logfile.dump(info, index_log, dump_io)
+		event_writer.dump(current_cycle)
+		index_writer.dump(info)
 		current_cycle.clear
 	    end
 
@@ -438,7 +479,7 @@ def self.define_hook(m)
 	end
 
         def dump(object)
-            Logfile.dump(object, event_io)
+            event_writer.dump(object)
         end
 
 	def self.from_format_0(input, output)
@@ -528,6 +569,14 @@ def self.from_format_3(input, output)
             end
         end
 
+        def self.from_format_4(input, output)
+            # In format 5, chunks are encoded with Distributed::BinaryFormat
+            # instead of Marshal. Since the format 5 reader still accepts
+            # marshalled chunks, simply copy them
+            input.seek(PROLOGUE_SIZE)
+            output.write(input.read)
+        end
+
 	def self.to_new_format(file, into = file)
 	    input = File.open(file)
 	    log_format = Logfile.guess_log_format(input)
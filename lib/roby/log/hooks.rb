@@ -21,16 +21,19 @@ module TaskHooks
 
 	def updated_edge_info(child, relation, info)
 	    super if defined? super
+            return if Roby::Log.relation_journal?
 	    Roby::Log.log(:updated_task_relation) { [self, relation, child, info] }
 	end
 
 	def added_child_object(child, relations, info)
 	    super if defined? super
+            return if Roby::Log.relation_journal?
 	    Roby::Log.log(:added_task_child) { [self, relations, child, info] }
 	end
 
 	def removed_child_object(child, relations)
 	    super if defined? super
+            return if Roby::Log.relation_journal?
 	    Roby::Log.log(:removed_task_child) { [self, relations, child] }
 	end
 
@@ -74,10 +77,12 @@ def garbage(object)
 	end
 	def finalized_event(event)
 	    super if defined? super
+            Roby::Log.flush_relation_journal
 	    Roby::Log.log(:finalized_event) { [self, event] }
 	end
 	def finalized_task(task)
 	    super if defined? super
+            Roby::Log.flush_relation_journal
 	    Roby::Log.log(:finalized_task) { [self, task] }
 	end
 
@@ -87,6 +92,7 @@ def added_transaction(trsc)
 	end
 	def removed_transaction(trsc)
 	    super if defined? super
+            Roby::Log.flush_relation_journal
 	    Roby::Log.log(:removed_transaction) { [self, trsc] }
 	end
     end
@@ -114,16 +120,19 @@ module EventGeneratorHooks
 
 	def added_child_object(to, relations, info)
 	    super if defined? super
+            return if Roby::Log.relation_journal?
 	    Roby::Log.log(:added_event_child) { [self, relations, to, info] }
 	end
 
 	def removed_child_object(to, relations)
 	    super if defined? super
+            return if Roby::Log.relation_journal?
 	    Roby::Log.log(:removed_event_child) { [self, relations, to] }
 	end
 
 	def updated_edge_info(child, relation, info)
 	    super if defined? super
+            return if Roby::Log.relation_journal?
 	    Roby::Log.log(:updated_event_relation) { [self, relation, child, info] }
 	end
 
@@ -170,13 +179,19 @@ def postponed(context, generator, reason)
     Roby::EventGenerator.include EventGeneratorHooks
 
     module ExecutionHooks
-	HOOKS = %w{cycle_end fatal_exception handled_exception nonfatal_exception report_scheduler_state}
+	HOOKS = %w{relation_deltas cycle_end cycle_profile fatal_exception handled_exception nonfatal_exception report_scheduler_state}
 
 	def cycle_end(timings)
 	    super if defined? super
+            Roby::Log.flush_relation_journal
 	    Roby::Log.log(:cycle_end) { [timings] }
 	end
 
+        def cycle_profile(report)
+            super if defined? super
+            Roby::Log.log(:cycle_profile) { [report] }
+        end
+
         def nonfatal_exception(error, tasks)
             super if defined? super
 	    Roby::Log.log(:nonfatal_exception) { [error.exception, tasks] }
@@ -207,6 +222,97 @@ def updated(key, value)
     end
     Roby::TaskArguments.include TaskArgumentsHooks
 
+    class << self
+        # If true, the relation changes are logged as one relation_deltas
+        # message per cycle built from the journals of the relation graphs
+        # (see BGL::Graph#enable_journal), instead of one message per change
+        #
+        # @see enable_relation_journal disable_relation_journal
+        def relation_journal?; !!@relation_journal end
+    end
+
+    # Yields the relation graphs whose changes are logged through their
+    # journal
+    def self.each_journaled_relation(&block)
+        Roby::TaskStructure.relations.each(&block)
+        Roby::EventStructure.relations.each(&block)
+    end
+
+    # Starts logging the relation changes through the journals of the
+    # relation graphs. +capacity+ is the size of each journal, which must be
+    # big enough to hold the changes done in one cycle.
+    def self.enable_relation_journal(capacity = 4096)
+        each_journaled_relation do |rel|
+            rel.enable_journal(capacity)
+        end
+        @journal_dropped = Hash.new
+        @relation_journal = true
+    end
+
+    # Goes back to logging each relation change in its own message
+    def self.disable_relation_journal
+        @relation_journal = false
+        each_journaled_relation(&:disable_journal)
+    end
+
+    # Logs the changes accumulated in the relation journals as one
+    # relation_deltas message, if the journals are enabled
+    #
+    # It is called at the end of each cycle, and before the messages that
+    # remove objects from the plans (finalization, transaction removal) so
+    # that the log replay never sees changes on objects that are already
+    # gone.
+    def self.flush_relation_journal
+        return if !relation_journal?
+
+        deltas = relation_deltas
+        if !deltas.empty?
+            Roby::Log.log(:relation_deltas) { [deltas] }
+        end
+    end
+
+    # Drains the relation journals and returns the changes as a list of
+    #
+    #   [plan, relation, [[operation, source, target, info], ...]]
+    #
+    # where +operation+ is one of the BGL::Graph::JOURNAL_LINK,
+    # JOURNAL_UNLINK or JOURNAL_UPDATE constants. The insertions and
+    # removals of vertices are left out, as they are already logged by the
+    # plan hooks.
+    #
+    # The journals are shared by all plans, so the changes are grouped by
+    # the plan of their endpoints. The changes between objects that are not
+    # included in the same plan are left out.
+    def self.relation_deltas
+        deltas = Array.new
+        each_journaled_relation do |rel|
+            entries = rel.drain_journal
+            dropped = rel.journal_dropped
+            if @journal_dropped[rel] != dropped
+                if dropped > 0
+                    Roby::Log.warn "the journal of #{rel} overflowed, the logged relation changes are incomplete"
+                end
+                @journal_dropped[rel] = dropped
+            end
+
+            by_plan = Hash.new
+            entries.each do |op, _, source, target, info|
+                if op != BGL::Graph::JOURNAL_LINK && op != BGL::Graph::JOURNAL_UNLINK && op != BGL::Graph::JOURNAL_UPDATE
+                    next
+                end
+
+                plan = source.plan
+                if plan && plan == target.plan
+                    (by_plan[plan] ||= Array.new) << [op, source, target, info]
+                end
+            end
+            by_plan.each do |plan, plan_entries|
+                deltas << [plan, rel, plan_entries]
+            end
+        end
+        deltas
+    end
+
     class << self
         # Hooks that need to be registered for the benefit of generic loggers
         # such as {FileLogger}
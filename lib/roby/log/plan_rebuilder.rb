@@ -642,6 +642,59 @@ def updated_task_relation(time, parent, rel, child, info)
                 end
             end
 
+            # Applies the relation changes logged as one delta per cycle (see
+            # Roby::Log.enable_relation_journal)
+            #
+            # The changes are applied through the same hooks and with the same
+            # guards than the per-change messages (#added_task_child and
+            # #removed_task_child). The changes of plans that are not tracked
+            # by this rebuilder, and the ones that involve unknown or garbaged
+            # objects, are ignored.
+            def relation_deltas(time, deltas)
+                deltas.each do |plan, rel, entries|
+                    Distributed.catch_ignored_call do
+                        plan = local_object(plan)
+                        next if !plans.include?(plan)
+
+                        rel = local_object(rel)
+                        all_relations << rel
+                        modified = false
+                        entries.each do |op, parent, child, info|
+                            Distributed.catch_ignored_call do
+                                parent = local_object(parent)
+                                child  = local_object(child)
+                                if !parent || !child
+                                    next
+                                elsif plan.garbaged_objects.include?(parent) || plan.garbaged_objects.include?(child)
+                                    next
+                                end
+
+                                case op
+                                when BGL::Graph::JOURNAL_LINK
+                                    if !rel.linked?(parent, child)
+                                        parent.add_child_object(child, rel, local_object(info))
+                                        modified = true
+                                    end
+                                when BGL::Graph::JOURNAL_UNLINK
+                                    if rel.linked?(parent, child)
+                                        parent.remove_child_object(child, rel)
+                                        modified = true
+                                    end
+                                when BGL::Graph::JOURNAL_UPDATE
+                                    if rel.linked?(parent, child)
+                                        parent[child, rel] = local_object(info)
+                                        modified = true
+                                    end
+                                end
+                            end
+                        end
+                        if modified
+                            announce_structure_update(plan)
+                        end
+                    end
+                end
+            end
+
 	    def added_event_child(time, parent, rel, child, info)
 		parent = local_object(parent)
 		child  = local_object(child)
@@ -353,7 +353,7 @@ def read_and_process_one_pending_cycle
                 if data_size && (buffer.size >= data_size + 4)
                     cycle_data = buffer[4, data_size]
                     @buffer = buffer[(data_size + 4)..-1]
-                    data = Marshal.load_with_missing_constants(cycle_data)
+                    data = Roby::Log::Logfile.load_chunk_data(cycle_data)
                     if data.kind_of?(Hash)
                         Roby::Log::Logfile.process_options_hash(data)
                     elsif data == Server::CONNECTION_INIT_DONE
@@ -15,6 +15,17 @@ module Arguments
             # @return [Set<#evaluate_delayed_argument>]
             inherited_attribute("argument_default", "argument_defaults", map: true) { Hash.new }
 
+            # The names of the arguments declared on this model with the
+            # :index option
+            #
+            # Unlike {#argument_set}, it does not include the arguments of the
+            # parent models
+            #
+            # @return [Set<Symbol>]
+            def indexed_arguments
+                @indexed_arguments ||= Set.new
+            end
+
             # @return [Boolean] returns if the given name is a known argument of
             #   this task
             def has_argument?(name)
@@ -37,6 +48,10 @@ def arguments
             #   @option options default the default value for this argument. It
             #     can either be a plain value (e.g. a number) or one of the
             #     delayed arguments (see examples below)
+            #   @option options [Boolean] index (false) if true, the plans
+            #     maintain an index of the tasks of this model by the value of
+            #     this argument, which speeds up the queries that match on it
+            #     (see Queries::Index#argument_index)
             #
             # @example getting an argument at runtime from another object
             #   argument :target_point, :default => from(:planned_task).target_point
@@ -45,10 +60,14 @@ def arguments
             # @example defining 'nil' as a default value
             #   argument :main_direction, :default => nil
             def argument(arg_name, **options)
-                options = Kernel.validate_options options, default: nil
+                options = Kernel.validate_options options, default: nil, index: false
 
                 arg_name = arg_name.to_sym
                 argument_set << arg_name
+                if options[:index]
+                    indexed_arguments << arg_name
+                    Queries::Index.indexed_arguments_changed
+                end
                 if arg_name =~ /^\w+$/ && !method_defined?(arg_name)
                     define_method(arg_name) { arguments[arg_name] }
                     define_method("#{arg_name}=") { |value| arguments[arg_name] = value }
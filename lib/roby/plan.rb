@@ -73,6 +73,22 @@ def control; execution_engine.control end
         #
         # See {#add_trigger}
         attr_reader :triggers
+        # Objects that get notified of the relation changes between the
+        # tasks and events of this plan
+        #
+        # They must respond to #relation_changed(parent, child, relations),
+        # which is called from {#added_task_relation},
+        # {#removed_task_relation}, {#added_event_relation} and
+        # {#removed_event_relation}. They may also define
+        # #constraining_event_emitted(generator), which is called when an
+        # event that constrains other events in
+        # EventStructure::TemporalConstraints gets emitted, and
+        # #task_status_changed(task), which is called when a task gets added
+        # to or removed from the plan, and when its started, finished,
+        # executable or owners status or its arguments change
+        #
+        # @see add_relation_listener remove_relation_listener
+        attr_reader :relation_listeners
 
 	# A set of tasks which are useful (and as such would not been garbage
 	# collected), but we want to GC anyway
@@ -145,6 +161,7 @@ def initialize
             @fault_response_tables = Array.new
             @active_fault_response_tables = Array.new
             @triggers = []
+            @relation_listeners = []
 
             on_exception LocalizedError do |plan, error|
                 plan.default_localized_error_handling(error)
@@ -865,6 +882,9 @@ def add_task_set(tasks)
 		task_index.add t
 	    end
 	    added_tasks(tasks)
+	    for t in tasks
+		notify_task_status_changed(t)
+	    end
 
 	    for t in tasks
 		t.instantiate_model_event_relations
@@ -935,6 +955,7 @@ def added_events(events)
         #   the new relation has been created
         # @return [void]
         def added_task_relation(parent, child, relations)
+            notify_relation_listeners(parent, child, relations)
             super if defined? super
         end
 
@@ -947,6 +968,7 @@ def added_task_relation(parent, child, relations)
         #   the relation has been removed
         # @return [void]
         def removed_task_relation(parent, child, relations)
+            notify_relation_listeners(parent, child, relations)
             super if defined? super
         end
 
@@ -962,6 +984,7 @@ def added_event_relation(parent, child, relations)
             if execution_engine && relations.include?(Roby::EventStructure::Precedence)
                 execution_engine.event_ordering.clear
             end
+            notify_relation_listeners(parent, child, relations)
             super if defined? super
         end
 
@@ -977,9 +1000,56 @@ def removed_event_relation(parent, child, relations)
             if execution_engine && relations.include?(Roby::EventStructure::Precedence)
                 execution_engine.event_ordering.clear
             end
+            notify_relation_listeners(parent, child, relations)
             super if defined? super
         end
 
+        # Registers an object that should be notified of the relation changes
+        # in this plan
+        #
+        # @see relation_listeners
+        def add_relation_listener(listener)
+            relation_listeners << listener
+        end
+
+        # Removes a listener added with {#add_relation_listener}
+        def remove_relation_listener(listener)
+            relation_listeners.delete(listener)
+        end
+
+        # @api private
+        #
+        # Calls #relation_changed on the {#relation_listeners}
+        def notify_relation_listeners(parent, child, relations)
+            relation_listeners.each do |listener|
+                listener.relation_changed(parent, child, relations)
+            end
+        end
+
+        # @api private
+        #
+        # Calls #constraining_event_emitted on the {#relation_listeners} that
+        # define it
+        def notify_constraining_event_emitted(generator)
+            relation_listeners.each do |listener|
+                if listener.respond_to?(:constraining_event_emitted)
+                    listener.constraining_event_emitted(generator)
+                end
+            end
+        end
+
+        # @api private
+        #
+        # Calls #task_status_changed on the {#relation_listeners} that define
+        # it
+        def notify_task_status_changed(task)
+            relation_listeners.each do |listener|
+                if listener.respond_to?(:task_status_changed)
+                    listener.task_status_changed(task)
+                end
+            end
+        end
+
         # Creates a new transaction and yields it. Ensures that the transaction
         # is discarded if the block returns without having committed it.
         def in_transaction
@@ -1003,61 +1073,28 @@ def removed_transaction(trsc); super if defined? super end
 
 	# Merges the set of tasks that are useful for +seeds+ into +useful_set+.
 	# Only the tasks that are in +complete_set+ are included.
-	def discover_new_objects(relations, complete_set, useful_set, seeds, explored_relations = Hash.new)
-            new_objects = ValueSet.new
+        #
+        # The objects that are already in +useful_set+ are not explored
+        # further. Returns +seeds+, in which the new objects have been merged
+	def discover_new_objects(relations, complete_set, useful_set, seeds)
             useful_set.merge(seeds)
-	    for rel in relations
-		next if !rel.root_relation?
-
-                explored_relations[rel] ||= [ValueSet.new, ValueSet.new]
-
-                reverse_seeds = seeds - explored_relations[rel][0]
-		for subgraph in rel.reverse.generated_subgraphs(reverse_seeds, false)
-                    explored_relations[rel][0].merge(subgraph)
-		    new_objects.merge(subgraph)
-		end
-
-                direct_seeds = seeds - explored_relations[rel][1]
-		for subgraph in rel.generated_subgraphs(direct_seeds, false)
-                    explored_relations[rel][1].merge(subgraph)
-		    new_objects.merge(subgraph)
-		end
-	    end
-
-	    if complete_set
-		new_objects.delete_if { |obj| !complete_set.include?(obj) }
-	    end
-
-            new_objects.difference!(seeds)
-            new_objects.delete_if { |t| useful_set.include?(t) }
-            if new_objects.empty?
-                seeds
-            else
-                useful_set.merge(new_objects)
-                seeds.merge(discover_new_objects(relations, complete_set, useful_set, new_objects, explored_relations))
-            end
+            relations = relations.find_all(&:root_relation?)
+            new_objects = BGL::Graph.reachable_vertices(relations, seeds,
+                BGL::Graph::DIRECT | BGL::Graph::REVERSE, complete_set, useful_set)
+            useful_set.merge(new_objects)
+            seeds.merge(new_objects)
 	end
 
 	# Merges the set of tasks that are useful for +seeds+ into +useful_set+.
 	# Only the tasks that are in +complete_set+ are included.
 	def useful_task_component(complete_set, useful_set, seeds)
-	    old_useful_set = useful_set.dup
-	    for rel in TaskStructure.relations
-		next if !rel.root_relation?
-		for subgraph in rel.generated_subgraphs(seeds, false)
-		    useful_set.merge(subgraph)
-		end
-	    end
-
+            relations = TaskStructure.relations.find_all(&:root_relation?)
+            useful_set.merge(BGL::Graph.reachable_vertices(relations, seeds,
+                BGL::Graph::DIRECT, complete_set))
 	    if complete_set
 		useful_set &= complete_set
 	    end
-
-	    if useful_set.size == old_useful_set.size || (complete_set && useful_set.size == complete_set.size)
-		useful_set
-	    else
-		useful_task_component(complete_set, useful_set, (useful_set - old_useful_set))
-	    end
+            useful_set
 	end
 
 	# Returns the set of useful tasks in this plan
@@ -1076,12 +1113,15 @@ def locally_useful_tasks
 	end
 
 	def local_tasks
-	    task_index.by_owner[Roby::Distributed] || ValueSet.new
+	    if local_tasks = task_index.by_owner[Roby::Distributed]
+                local_tasks.to_value_set
+            else ValueSet.new
+            end
 	end
 
 	def remote_tasks
 	    if local_tasks = task_index.by_owner[Roby::Distributed]
-		known_tasks - local_tasks
+		known_tasks - local_tasks.to_value_set
 	    else
 		known_tasks
 	    end
@@ -1271,6 +1311,7 @@ def remove_object(object, timestamp = nil)
                 for ev in object.bound_events
 		    @task_events.delete(ev[1])
                 end
+                notify_task_status_changed(object)
             end
 
             finalize_object(object, timestamp)
@@ -1603,10 +1644,10 @@ def find_local_tasks(*args, &block)
 	# Called by TaskMatcher#result_set and Query#result_set to get the set
 	# of tasks matching +matcher+
 	def query_result_set(matcher) # :nodoc:
-            filtered = matcher.filter(known_tasks.dup, task_index)
+            filtered = matcher.filter(task_index.all_tasks.dup, task_index)
 
             if matcher.indexed_query?
-                filtered
+                filtered.to_value_set
             else
                 result = ValueSet.new
                 for task in filtered
@@ -1627,16 +1668,7 @@ def query_each(result_set, &block) # :nodoc:
 	# Given the result set of +query+, returns the subset of tasks which
 	# have no parent in +query+
 	def query_roots(result_set, relation) # :nodoc:
-	    children = ValueSet.new
-	    found    = ValueSet.new
-	    for task in result_set
-		next if children.include?(task)
-		task_children = task.generated_subgraph(relation)
-		found -= task_children
-		children.merge(task_children)
-		found << task
-	    end
-	    found
+            relation.roots_within(result_set)
 	end
     end
 end
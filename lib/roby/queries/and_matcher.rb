@@ -14,7 +14,7 @@ def initialize(*ops)
 	def filter(task_set, task_index)
 	    result = task_set
 	    for child in @ops
-		result &= child.filter(task_set, task_index)
+		result = child.filter(result, task_index)
 	    end
 	    result
 	end
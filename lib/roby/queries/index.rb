@@ -2,51 +2,303 @@ module Roby
     module Queries
     # Maintains a set of tasks as classified sets, speeding up query operations.
     #
+    # Each task of the index gets a dense integer id (see {#ids}), and the
+    # classified sets are {Bitmap}s of these ids. The index part of a query
+    # (see {PlanObjectMatcher#filter}) is therefore evaluated with word-wise
+    # operations, and converted to a ValueSet only at the end.
+    #
+    # The index can also classify the tasks by the value of some of their
+    # arguments. This is opt-in, by declaring the argument with the :index
+    # option (see {Models::Arguments#argument}). See {#argument_index}.
+    #
     # @see {Roby::Plan#task_index} {Roby::Queries::Query}
     class Index
-        # A model => ValueSet map of the tasks for each model
+        # Classification of the tasks of a model by the value of one of their
+        # arguments
+        #
+        # The values are compared with #eql? and #hash, after converting the
+        # numeric values to floats. Only the values for which this agrees with
+        # #== are classified (see {.indexable?}), the tasks whose value is of
+        # another kind are always returned as candidates. The index must only
+        # be used to reduce the set of candidates of a query (as matchers
+        # compare the values with #==), and values that are modified in-place
+        # are not tracked.
+        class ArgumentIndex
+            # The argument name
+            attr_reader :name
+            # A value => Bitmap map of the tasks for which the argument has
+            # this value
+            attr_reader :values
+            # The Bitmap of the tasks for which the argument is a delayed
+            # argument, whose value can only be known at query time
+            attr_reader :delayed
+            # The Bitmap of the tasks for which the argument value cannot be
+            # classified (see {.indexable?})
+            attr_reader :unindexed
+
+            def initialize(ids, name)
+                @ids = ids
+                @name = name
+                @values = Hash.new
+                @delayed = Bitmap.new(ids)
+                @unindexed = Bitmap.new(ids)
+                @task_keys = Hash.new.compare_by_identity
+            end
+
+            # Copies +source+ on the DenseIds object +ids+
+            def copy_from(ids, source)
+                @ids = ids
+                @delayed = Bitmap.new(ids, source.delayed)
+                @unindexed = Bitmap.new(ids, source.unindexed)
+                @values = Hash.new
+                source.values.each do |key, set|
+                    @values[key] = Bitmap.new(ids, set)
+                end
+                @task_keys = source.task_keys.dup
+                self
+            end
+
+            # @api private
+            #
+            # The task => key in {#values} mapping
+            attr_reader :task_keys
+
+            DELAYED = Object.new
+            UNINDEXED = Object.new
+
+            # Tests whether an argument value can be classified in {#values},
+            # i.e. whether comparing it with #== is equivalent to comparing
+            # its {.value_key} with #eql?
+            def self.indexable?(value)
+                case value
+                when NilClass, TrueClass, FalseClass, Symbol, Integer, Float
+                    true
+                when String
+                    value.instance_of?(String)
+                else false
+                end
+            end
+
+            # Returns the key in {#values} for an argument value
+            def self.value_key(value)
+                if value.kind_of?(Integer) || value.kind_of?(Float)
+                    value.to_f
+                else value
+                end
+            end
+
+            # Adds or updates +task+ in this index
+            def add(task)
+                remove(task)
+                return if !task.arguments.has_key?(name)
+
+                value = task.arguments.values[name]
+                if value.kind_of?(DefaultArgument)
+                    value = value.value
+                elsif TaskArguments.delayed_argument?(value)
+                    delayed << task
+                    task_keys[task] = DELAYED
+                    return
+                elsif !ArgumentIndex.indexable?(value)
+                    unindexed << task
+                    task_keys[task] = UNINDEXED
+                    return
+                end
+
+                key = ArgumentIndex.value_key(value)
+                (values[key] ||= Bitmap.new(@ids)) << task
+                task_keys[task] = key
+            end
+
+            # Removes +task+ from this index
+            def remove(task)
+                if !task_keys.has_key?(task)
+                    return
+                end
+
+                key = task_keys.delete(task)
+                if DELAYED.equal?(key)
+                    delayed.delete(task)
+                elsif UNINDEXED.equal?(key)
+                    unindexed.delete(task)
+                elsif set = values[key]
+                    set.delete(task)
+                    if set.empty?
+                        values.delete(key)
+                    end
+                end
+            end
+
+            # Returns the Bitmap of the tasks for which the argument might be
+            # equal to +value+
+            def candidates(value)
+                result = delayed.dup
+                result.merge(unindexed)
+                if !ArgumentIndex.indexable?(value)
+                    values.each_value do |set|
+                        result.merge(set)
+                    end
+                elsif set = values[ArgumentIndex.value_key(value)]
+                    result.merge(set)
+                end
+                result
+            end
+        end
+
+        @indexed_arguments_version = 0
+
+        class << self
+            # Incremented each time a model declares an indexed argument
+            attr_reader :indexed_arguments_version
+        end
+
+        # Called by {Models::Arguments#argument} when a model declares an
+        # indexed argument
+        def self.indexed_arguments_changed
+            @indexed_arguments_version += 1
+        end
+        # The DenseIds object that gives their id to the tasks of this index
+        attr_reader :ids
+        # A Bitmap of all the tasks of this index
+        attr_reader :all_tasks
+        # A model => Bitmap map of the tasks for each model
 	attr_reader :by_model
-	# A state => ValueSet map of tasks given their state. The state is
+	# A state => Bitmap map of tasks given their state. The state is
 	# a symbol in [:pending, :starting, :running, :finishing,
 	# :finished]
 	attr_reader :by_predicate
-	# A peer => ValueSet map of tasks given their owner.
+	# A peer => Bitmap map of tasks given their owner.
 	attr_reader :by_owner
+        # A [model, argument_name] => ArgumentIndex map of the indexed
+        # arguments
+        #
+        # @see argument_index
+        attr_reader :by_argument
 
 	STATE_PREDICATES = [:pending?, :running?, :finished?, :success?, :failed?].to_value_set
         PREDICATES = STATE_PREDICATES.dup
 
 	def initialize
-	    @by_model = Hash.new { |h, k| h[k] = ValueSet.new }
+            @ids = DenseIds.new
+            @all_tasks = Bitmap.new(ids)
+	    @by_model = Hash.new { |h, k| h[k] = Bitmap.new(ids) }
 	    @by_predicate = Hash.new
 	    STATE_PREDICATES.each do |state_name|
-		by_predicate[state_name] = ValueSet.new
+		by_predicate[state_name] = Bitmap.new(ids)
 	    end
 	    @by_owner = Hash.new
+            @by_argument = Hash.new
+            @indexed_arguments = Hash.new
 	end
 
         def initialize_copy(source)
             super
-	    @by_model = Hash.new { |h, k| h[k] = ValueSet.new }
+            @ids = source.ids.dup
+            @all_tasks = Bitmap.new(ids, source.all_tasks)
+	    @by_model = Hash.new { |h, k| h[k] = Bitmap.new(ids) }
             source.by_model.each do |model, set|
-                by_model[model] = set.dup
+                by_model[model] = Bitmap.new(ids, set)
             end
 
             @by_predicate = Hash.new
             source.by_predicate.each do |state, set|
-                by_predicate[state] = set.dup
+                by_predicate[state] = Bitmap.new(ids, set)
             end
-            @by_owner = source.by_owner.dup
+            @by_owner = Hash.new
+            source.by_owner.each do |owner, set|
+                by_owner[owner] = Bitmap.new(ids, set)
+            end
+            @by_argument = Hash.new
+            source.by_argument.each do |key, index|
+                by_argument[key] = index.dup.copy_from(ids, index)
+            end
+            @indexed_arguments = Hash.new
         end
 
         def clear
+            @ids.clear
+            @all_tasks.clear
             @by_model.clear
             @by_predicate.each_value(&:clear)
             @by_owner.clear
+            @by_argument.clear
+        end
+
+        # Returns the [model, argument_name] pairs of the indexed arguments
+        # that apply to the tasks of +model+
+        def indexed_arguments_of(model)
+            if @indexed_arguments_version != Index.indexed_arguments_version
+                @indexed_arguments.clear
+                @indexed_arguments_version = Index.indexed_arguments_version
+            end
+
+            @indexed_arguments[model] ||= model.ancestors.flat_map do |m|
+                if m.respond_to?(:indexed_arguments)
+                    m.indexed_arguments.map { |name| [m, name] }
+                else []
+                end
+            end
+        end
+
+        # Returns the ArgumentIndex of the +name+ argument of +model+, which
+        # must have been declared with the :index option
+        #
+        # It is created and filled with the tasks of +model+ the first time it
+        # is needed.
+        def argument_index(model, name)
+            if index = by_argument[[model, name]]
+                return index
+            end
+
+            index = by_argument[[model, name]] = ArgumentIndex.new(ids, name)
+            for task in by_model[model]
+                index.add(task)
+            end
+            index
+        end
+
+        # Returns a Bitmap of the tasks that fullfill one of +models+ and
+        # for which the +name+ argument might be equal to +value+, or nil if
+        # this argument is indexed for none of +models+
+        def argument_candidates(models, name, value)
+            for model in models
+                for indexed_model, indexed_name in indexed_arguments_of(model)
+                    if indexed_name == name
+                        return argument_index(indexed_model, name).candidates(value)
+                    end
+                end
+            end
+            nil
+        end
+
+        # Updates the argument indexes after a change of the arguments of
+        # +task+
+        #
+        # @param [Array<Symbol>,nil] names the names of the changed arguments,
+        #   or nil for all of them
+        def update_arguments(task, names = nil)
+            return if !ids.include?(task)
+
+            for model, name in indexed_arguments_of(task.model)
+                if !names || names.include?(name)
+                    argument_index(model, name).add(task)
+                end
+            end
+        end
+
+        # Returns a Bitmap of the tasks of +tasks+ that are in this index
+        def bitmap_of(tasks)
+            result = Bitmap.new(ids)
+            for task in tasks
+                result << task
+            end
+            result
         end
 
         # Add a new task to this index
 	def add(task)
+            ids.register(task)
+            all_tasks << task
 	    for klass in task.model.ancestors
 		by_model[klass] << task
 	    end
@@ -58,11 +310,14 @@ def add(task)
 	    for owner in task.owners
 		add_owner(task, owner)
 	    end
+            for model, name in indexed_arguments_of(task.model)
+                argument_index(model, name).add(task)
+            end
 	end
 
         # Updates the index to reflect that +new_owner+ now owns +task+
 	def add_owner(task, new_owner)
-	    (by_owner[new_owner] ||= ValueSet.new) << task
+	    (by_owner[new_owner] ||= Bitmap.new(ids)) << task
 	end
 
         # Updates the index to reflect that +peer+ no more owns +task+
@@ -101,16 +356,26 @@ def remove_predicate(task, predicate)
 
 
         # Remove all references of +task+ from the index.
+        #
+        # The id of +task+ gets reused, so it is cleared from all the bitmaps
+        # of the index and not only from the ones of its current models and
+        # owners, which may have changed since it has been added
 	def remove(task)
-	    for klass in task.model.ancestors
-		by_model[klass].delete(task)
-	    end
-	    for state_set in by_predicate
-		state_set.last.delete(task)
-	    end
-	    for owner in task.owners
-		remove_owner(task, owner)
+            return if !ids.include?(task)
+
+	    by_model.each_value { |set| set.delete(task) }
+	    by_predicate.each_value { |set| set.delete(task) }
+	    by_owner.delete_if do |_, set|
+		set.delete(task)
+		set.empty?
 	    end
+            for model, name in indexed_arguments_of(task.model)
+                if index = by_argument[[model, name]]
+                    index.remove(task)
+                end
+            end
+            all_tasks.delete(task)
+            ids.release(task)
 	end
     end
     end
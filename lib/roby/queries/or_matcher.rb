@@ -11,9 +11,9 @@ def initialize(*ops)
 
         # Overload of TaskMatcher#filter
 	def filter(task_set, task_index)
-	    result = ValueSet.new
+	    result = Bitmap.new(task_index.ids)
 	    for child in @ops
-		result.merge child.filter(task_set, task_index)
+		result.merge child.filter(task_set.dup, task_index)
 	    end
 	    result
 	end
@@ -241,9 +241,11 @@ def ===(object)
         # include all tasks in +initial_set+ which match with #===, but can
         # include tasks which do not match #===
         #
-        # @param [ValueSet] initial_set
+        # +initial_set+ may be modified and returned
+        #
+        # @param [Bitmap] initial_set
         # @param [Index] index
-        # @return [ValueSet]
+        # @return [Bitmap]
 	def filter(initial_set, index)
             for m in model
                 initial_set.intersection!(index.by_model[m])
@@ -253,7 +255,7 @@ def filter(initial_set, index)
                 if candidates = index.by_owner[o]
                     initial_set.intersection!(candidates)
                 else
-                    return ValueSet.new
+                    return initial_set.clear
                 end
             end
 
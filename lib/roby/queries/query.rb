@@ -51,15 +51,15 @@ def filter(initial_set, task_index)
             result = super
 
             if plan_predicates.include?(:mission?)
-                result.intersection!(plan.missions)
+                result.intersection!(task_index.bitmap_of(plan.missions))
             elsif neg_plan_predicates.include?(:mission?)
-                result.difference!(plan.missions)
+                result.difference!(task_index.bitmap_of(plan.missions))
             end
 
             if plan_predicates.include?(:permanent?)
-                result.intersection!(plan.permanent_tasks)
+                result.intersection!(task_index.bitmap_of(plan.permanent_tasks))
             elsif neg_plan_predicates.include?(:permanent?)
-                result.difference!(plan.permanent_tasks)
+                result.difference!(task_index.bitmap_of(plan.permanent_tasks))
             end
 
             result
@@ -288,9 +288,24 @@ def ===(task)
             return super
 	end
 
+        # Overloaded to use the argument indexes of +index+ (see
+        # Index#argument_index) for the arguments that have one
+        def filter(initial_set, index)
+            initial_set = super
+            for name, value in arguments
+                if candidates = index.argument_candidates(model, name, value)
+                    initial_set.intersection!(candidates)
+                end
+            end
+            initial_set
+        end
+
         # Returns true if filtering with this TaskMatcher using #=== is
         # equivalent to calling #filter() using a Index. This is used to
         # avoid an explicit O(N) filtering step after filter() has been called
+        #
+        # The argument indexes only reduce the number of candidates, so
+        # queries with arguments are never fully indexed
         def indexed_query?
             arguments.empty? && super
         end
@@ -1,8 +1,9 @@
 require 'utilrb/object/scoped_eval'
 module Roby
     # This exception is raised when an edge is being added in a DAG, while this
-    # edge would create a cycle.
-    class CycleFoundError < RuntimeError; end
+    # edge would create a cycle. It is raised by the native relation hierarchy
+    # code (see BGL::Graph#link_in_hierarchy)
+    CycleFoundError = BGL::CycleFoundError
 
     # Base support for relations. It is mixed in objects on which a
     # RelationSpace applies on, like Task for TaskStructure and EventGenerator
@@ -221,8 +222,7 @@ def []=(object, relation, value)
     class RelationGraph < BGL::Graph
 	# The relation name
 	attr_reader   :name
-	# The relation parent (if any). See #superset_of.
-	attr_accessor :parent
+	# The relation parent (if any) is BGL::Graph#parent. See #superset_of.
 	# The set of graphs that are directly children of self in the graph
         # hierarchy. They are subgraphs of self, but not all the existing
         # subgraphs of self. See {#recursive_subsets} to get all subsets
@@ -249,7 +249,7 @@ def initialize(name, options = {})
 	    @subsets = ValueSet.new
             @recursive_subsets = ValueSet.new
 	    @distribute = options[:distribute]
-	    @dag     = options[:dag]
+	    self.dag = options[:dag]
 	    @weak    = options[:weak]
             @strong  = options[:strong]
             @copy_on_replace = options[:copy_on_replace]
@@ -260,8 +260,8 @@ def initialize(name, options = {})
 	    end
 	end
 
-	# True if this relation graph is a DAG
-	attr_predicate :dag
+	# True if this relation graph is a DAG. The flag is kept natively (see
+	# BGL::Graph#dag=)
 	# True if this relation should be seen by remote peers
 	attr_predicate :distribute
         # If this relation is weak. Weak relations can be removed without major
@@ -311,23 +311,7 @@ def remove(vertex)
         # <tt>parent.parent</tt>, ...] if the parent, grandparent, ... graphs
         # do not include the edge either.
 	def add_relation(from, to, info = nil)
-	    # Get the toplevel DAG in our relation hierarchy. We only test for the
-	    # DAG property on this one, as it is the union of all its children
-	    top_dag = nil
-	    new_relations = []
-	    rel     = self
-	    while rel
-		top_dag = rel if rel.dag?
-                if !rel.linked?(from, to)
-                    new_relations << rel
-                end
-		rel = rel.parent
-	    end
-	    if top_dag && !top_dag.linked?(from, to) && top_dag.reachable?(to, from)
-		raise CycleFoundError, "cannot add a #{from} -> #{to} relation since it would create a cycle"
-	    end
-
-	    # Now check that we're not changing the edge info. This is ignored
+	    # Check that we're not changing the edge info. This is ignored
             # if +self+ has the noinfo flag set.
             if linked?(from, to)
                 if !(old_info = from[to, self]).nil?
@@ -339,18 +323,19 @@ def add_relation(from, to, info = nil)
                 return
             end
 
-	    if !new_relations.empty?
+	    # The edge is added natively in the whole hierarchy, and the DAG
+	    # property is checked on the toplevel DAG only as it is the union of
+	    # all its children
+	    new_relations = link_in_hierarchy(from, to, info) do |new_relations|
 		if from.respond_to?(:adding_child_object)
 		    from.adding_child_object(to, new_relations, info)
 		end
 		if to.respond_to?(:adding_parent_object)
 		    to.adding_parent_object(from, new_relations, info)
 		end
+	    end
 
-		for rel in new_relations
-		    rel.__bgl_link(from, to, (info if self == rel))
-		end
-
+	    if !new_relations.empty?
 		if from.respond_to?(:added_child_object)
 		    from.added_child_object(to, new_relations, info)
 		end
@@ -408,27 +393,15 @@ def link(from, to, info)
         # <tt>[self, parent, parent.parent, ...]</tt> up to the root relation
         # which is a superset of +self+.
 	def remove_relation(from, to)
-            if !linked?(from, to)
-                return
-            end
-
-	    rel = self
-	    relations = []
-	    while rel
-		relations << rel
-		rel = rel.parent
-	    end
-
-	    if from.respond_to?(:removing_child_object)
-		from.removing_child_object(to, relations)
-	    end
-	    if to.respond_to?(:removing_parent_object)
-		to.removing_parent_object(from, relations)
-	    end
-
-	    for rel in relations
-		rel.unlink(from, to)
+	    relations = unlink_in_hierarchy(from, to) do |relations|
+		if from.respond_to?(:removing_child_object)
+		    from.removing_child_object(to, relations)
+		end
+		if to.respond_to?(:removing_parent_object)
+		    to.removing_parent_object(from, relations)
+		end
 	    end
+	    return if relations.empty?
 
 	    if from.respond_to?(:removed_child_object)
 		from.removed_child_object(to, relations)
@@ -472,14 +445,10 @@ def superset_of(relation)
 		end
 	    end
 
+	    # This copies the edges of the child into this graph and its parents
 	    relation.parent = self
 	    subsets << relation
             recompute_recursive_subsets
-
-	    # Copy the relations of the child into this graph
-	    relation.each_edge do |source, target, info|
-		source.add_child_object(target, self, info)
-	    end
 	end
 
 	# The Ruby module that gets included in graph objects
@@ -509,6 +478,11 @@ def recompute_recursive_subsets
     #   relation.related_tasks?(ta, tb)
     #
     # will return true
+    #
+    # The task graph is maintained natively as the projection of this graph
+    # through the event owners (see BGL::Graph#projection=), which are set by
+    # TaskEventGenerator. Its edges are reference-counted, so ta and tb are
+    # related as long as at least one of their event pairs is linked.
     class EventRelationGraph < RelationGraph
         # The graph of tasks related to each other by their events
         attr_reader :task_graph
@@ -516,31 +490,7 @@ class EventRelationGraph < RelationGraph
         def initialize(*args)
             super
             @task_graph = BGL::Graph.new
-        end
-
-        def __bgl_link(from, to, info)
-            super
-
-            if from.respond_to?(:task) && to.respond_to?(:task)
-                from_task, to_task = from.task, to.task
-                if from_task != to_task && !task_graph.linked?(from_task, to_task)
-                    task_graph.link(from_task, to_task, nil)
-                end
-            end
-        end
-
-        def remove(event)
-            super
-            if event.respond_to?(:task)
-                task_graph.remove(event.task)
-            end
-        end
-
-        def unlink(from, to)
-            super
-            if from.respond_to?(:task) && to.respond_to?(:task)
-                task_graph.unlink(from.task, to.task)
-            end
+            self.projection = task_graph
         end
 
         def related_tasks?(ta, tb)
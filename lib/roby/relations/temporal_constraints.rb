@@ -1,3 +1,5 @@
+require 'roby_timer_queue'
+
 # Define Infinity
 if !defined? Infinity
     Infinity = 1.0/0
@@ -13,29 +15,23 @@ class Plan
     module EventStructure
         # Class used to maintain the event deadlines
         class EventDeadlines
+            # The deadlines, as a {TimerQueue} of [deadline, event, generator]
+            # entries keyed by generator
             attr_reader :deadlines
 
             def initialize
-                @deadlines = Array.new
+                @deadlines = TimerQueue.new(2)
             end
 
             # Adds a deadline to the set
             def add(deadline, event, generator)
-                deadlines << [deadline, event, generator]
-                @deadlines = deadlines.sort_by(&:first)
+                deadlines.push(deadline, generator, [deadline, event, generator])
             end
 
-            # Remove the first deadline registered for +generator+
+            # Remove the first deadline registered for +generator+ that is
+            # after +time+
             def remove_deadline_for(generator, time)
-                found = false
-                deadlines.delete_if do |deadline, _, gen|
-                    if found
-                        false
-                    else
-                        found = (deadline > time && generator == gen)
-                    end
-                end
-                found
+                deadlines.delete_first_for(generator, time)
             end
 
             # Returns the number of queued deadlines
@@ -46,11 +42,7 @@ def size
             # Returns the set of deadlines that have been missed at
             # +current_time+. These deadlines get removed from the set.
             def missed_deadlines(current_time)
-                result = []
-                while !deadlines.empty? && deadlines.first[0] < current_time
-                    result << deadlines.shift
-                end
-                result
+                deadlines.pop_before(current_time)
             end
         end
 
@@ -141,9 +133,26 @@ def initialize
 
             # Returns true if +value+ is included in one of the intervals
             def include?(value)
-                candidate = intervals.
-                    find { |min, max| max >= value }
-                candidate && (candidate[0] <= value)
+                candidate = intervals.bsearch { |min, max| max >= value }
+                !!candidate && (candidate[0] <= value)
+            end
+
+            # Returns true if the whole [min, max] range is included in one of
+            # the intervals
+            def include_range?(min, max)
+                candidate = intervals.bsearch { |_, interval_max| interval_max >= min }
+                !!candidate && candidate[0] <= min && candidate[1] >= max
+            end
+
+            # Returns the smallest interval boundary that is greater or equal
+            # to +value+, i.e. the value from which the result of #include?
+            # might change, or nil if +value+ is after all the intervals
+            def next_boundary(value)
+                if candidate = intervals.bsearch { |min, max| max >= value }
+                    if candidate[0] > value then candidate[0]
+                    else candidate[1]
+                    end
+                end
             end
 
             # Returns the lower and upper bound of the union of all intervals
@@ -156,56 +165,48 @@ def boundaries
             #
             # Returns +self+
             def add(min, max)
-                if intervals.empty?
-                    intervals << [min, max]
-                    return
+                # The existing intervals that overlap [min, max] are in
+                # [first, last)
+                first = intervals.bsearch_index { |_, interval_max| interval_max >= min } || intervals.size
+                last  = intervals.bsearch_index { |interval_min, _| interval_min > max } || intervals.size
+                if first < last
+                    if intervals[first][0] < min
+                        min = intervals[first][0]
+                    end
+                    if intervals[last - 1][1] > max
+                        max = intervals[last - 1][1]
+                    end
                 end
+                intervals[first...last] = [[min, max]]
+                self
+            end
 
-                new_list = Array.new
-                while interval = intervals.shift
-                    if interval[1] < min
-                        new_list << interval
-                    elsif interval[0] > min
-                        if interval[0] > max
-                            new_list << [min, max] << interval
-                            break
-                        else
-                            new_list << [min, [max, interval[1]].max]
-                        end
-                        break
+            # Adds all the intervals of +other+ to this set
+            #
+            # Returns +self+
+            def merge(other)
+                result = Array.new
+                a, b = intervals, other.intervals
+                i, j = 0, 0
+                while i < a.size || j < b.size
+                    if j == b.size || (i < a.size && a[i][0] <= b[j][0])
+                        interval = a[i]
+                        i += 1
                     else
-                        new_list << [interval[0], [max, interval[1]].max]
-                        break
+                        interval = b[j]
+                        j += 1
                     end
-                end
 
-                if intervals.empty? && new_list.last[1] < min
-                    new_list << [min, max]
-
-                elsif new_list.last[1] <= max
-                    while interval = intervals.shift
-                        last_interval = new_list.last
-
-                        # It is guaranteed that interval[0] > last_interval[0].
-                        # We therefore only need to check if interval[0] is
-                        # included in last_interval
-                        if interval[0] <= last_interval[1]
-                            if last_interval[1] < interval[1]
-                                last_interval[1] = interval[1]
-                                break
-                            end
-                        else
-                            new_list << interval
-                            break
+                    last_interval = result.last
+                    if last_interval && interval[0] <= last_interval[1]
+                        if interval[1] > last_interval[1]
+                            result[-1] = [last_interval[0], interval[1]]
                         end
+                    else
+                        result << interval
                     end
                 end
-
-                # We now know that the last interval in new_list has an upper
-                # bound that comes from an already existing interval. We are
-                # therefore sure that there are no overlaps.
-                new_list.concat(intervals)
-                @intervals = new_list
+                @intervals = result
                 self
             end
         end
@@ -259,6 +260,45 @@ def schedule_as(event)
                 event.add_forward_scheduling_constraint(self)
             end
 
+            # The [earliest, latest] window (as floating-point times) in which
+            # this event can be emitted according to the emissions of the
+            # events that constrain it so far, or nil if none of them has been
+            # emitted yet. It is maintained by TemporalConstraints, see
+            # TemporalConstraints.emission_window
+            attr_reader :emission_window
+
+            # @api private
+            #
+            # Narrows #emission_window with the constraint of a parent that
+            # has been emitted between +first+ and +last+, through an edge
+            # whose delay bounds are +min+ and +max+
+            def constrain_emission_window(first, last, min, max)
+                # An edge with a negative minimum can still be fulfilled by a
+                # future emission of the parent, it does not constrain +self+
+                return if min < 0
+
+                earliest, latest = last + min, first + max
+                if @emission_window
+                    earliest = @emission_window[0] if @emission_window[0] > earliest
+                    latest   = @emission_window[1] if @emission_window[1] < latest
+                end
+                @emission_window = [earliest, latest]
+            end
+
+            # @api private
+            #
+            # Recomputes #emission_window from the emissions of all the
+            # parents of this event
+            def reset_emission_window
+                @emission_window = nil
+                each_backward_temporal_constraint do |parent|
+                    if first = parent.history.first
+                        constrain_emission_window(first.time.to_f, parent.last.time.to_f,
+                                                  *TemporalConstraints.edge_bounds(parent, self))
+                    end
+                end
+            end
+
             # True if this event is constrained by the TemporalConstraints
             # relation in any way
             def has_scheduling_constraints?
@@ -334,18 +374,56 @@ def find_failed_temporal_constraint(time)
                         next
                     end
 
+                    history = parent.history
+                    next if history.empty?
+                    # The differences between +time+ and the emissions of
+                    # +parent+ are all within the range given by its first
+                    # and last emissions. If that range is included in a
+                    # single interval, so are all of them
+                    if disjoint_set.include_range?(time - history.last.time, time - history.first.time)
+                        next
+                    end
+
                     max_diff = disjoint_set.boundaries[1]
-                    parent.history.each do |parent_event|
+                    history.each do |parent_event|
                         diff = time - parent_event.time
                         if diff > max_diff || !disjoint_set.include?(diff)
                             return parent, disjoint_set
                         end
-                        disjoint_set.include?(diff)
                     end
                 end
                 nil
             end
 
+            # Returns the earliest time, as a floating-point value, from which
+            # the result of #find_failed_temporal_constraint might change
+            # without new emissions, or nil if it cannot. The optional block
+            # filters the parents in the same way
+            def temporal_constraints_expiry(time)
+                time = time.to_f
+                expiry = nil
+                each_backward_temporal_constraint do |parent|
+                    if block_given?
+                        next if !yield(parent)
+                    end
+
+                    disjoint_set = parent[self, TemporalConstraints]
+                    next if disjoint_set.intervals.empty?
+                    next if disjoint_set.boundaries[0] < 0
+
+                    parent.history.each do |parent_event|
+                        parent_time = parent_event.time.to_f
+                        if boundary = disjoint_set.next_boundary(time - parent_time)
+                            parent_expiry = parent_time + boundary
+                            if !expiry || parent_expiry < expiry
+                                expiry = parent_expiry
+                            end
+                        end
+                    end
+                end
+                expiry
+            end
+
             # Returns true if this event meets its temporal constraints
             def meets_temporal_constraints?(time, &block)
                 !find_failed_temporal_constraint(time, &block) &&
@@ -442,6 +520,15 @@ def fired(event)
                     plan.engine.add_error OccurenceConstraintViolation.new(event, parent, count, allowed_interval, since)
                 end
 
+                if !leaf?(TemporalConstraints)
+                    first_time = (history.first || event).time.to_f
+                    each_forward_temporal_constraint do |target, _|
+                        target.constrain_emission_window(first_time, event.time.to_f,
+                                                         *TemporalConstraints.edge_bounds(self, target))
+                    end
+                    plan.notify_constraining_event_emitted(self)
+                end
+
                 deadlines = plan.emission_deadlines
                 # Remove the deadline that this emission fullfills (if any)
                 deadlines.remove_deadline_for(self, event.time)
@@ -485,17 +572,7 @@ def should_start_after(task_or_event)
         # deadlines represented by +opt1+ and +opt2+
         def TemporalConstraints.merge_info(parent, child, opt1, opt2)
             result = TemporalConstraintSet.new
-            if opt1.intervals.size > opt2.intervals.size
-                result.intervals.concat(opt1.intervals)
-                for i in opt2.intervals
-                    result.add(*i)
-                end
-            else
-                result.intervals.concat(opt2.intervals)
-                for i in opt1.intervals
-                    result.add(*i)
-                end
-            end
+            result.merge(opt1).merge(opt2)
 
             result.occurence_constraints.merge!(opt1.occurence_constraints)
             opt2.occurence_constraints.each do |recurrent, spec|
@@ -505,6 +582,53 @@ def TemporalConstraints.merge_info(parent, child, opt1, opt2)
             result
         end
 
+        # Updates the delay bounds of the from -> to edge from the intervals in
+        # +info+, and the emission window of +to+ that depends on them
+        def TemporalConstraints.update_edge_bounds(from, to, info)
+            if info && !info.intervals.empty?
+                set_edge_bounds(from, to, *info.boundaries)
+            else
+                set_edge_bounds(from, to, -Infinity, Infinity)
+            end
+            to.reset_emission_window
+        end
+
+        # Overloaded to keep the edge bounds in sync with the edge information
+        def TemporalConstraints.add_relation(from, to, info = nil)
+            super
+            update_edge_bounds(from, to, from[to, self])
+        end
+
+        # Overloaded to keep the edge bounds in sync with the edge information
+        def TemporalConstraints.updated_info(from, to, info)
+            super
+            update_edge_bounds(from, to, info)
+            if plan = from.plan
+                plan.notify_relation_listeners(from, to, [self])
+            end
+        end
+
+        # Overloaded to update the emission window of +to+, which +from+ does
+        # not constrain anymore
+        def TemporalConstraints.remove_relation(from, to)
+            super
+            to.reset_emission_window
+        end
+
+        # Returns the [earliest, latest] window (as floating-point times) in
+        # which +event+ can be emitted according to the emissions of the
+        # events that constrain it so far, or nil if none of them has been
+        # emitted yet.
+        #
+        # It is computed on the edge bounds, i.e. on the hull of the allowed
+        # intervals, and therefore only gives a necessary condition for
+        # #find_failed_temporal_constraint to succeed. It is updated when the
+        # constraints of +event+ change and when one of its parents gets
+        # emitted, so reading it is O(1).
+        def TemporalConstraints.emission_window(event)
+            event.emission_window
+        end
+
         # Check the temporal constraint structure
         #
         # What it needs to do is check that events that *should* have been
@@ -0,0 +1,185 @@
+module Roby
+    # A sampling profiler for the execution engine's thread
+    #
+    # A background thread samples the engine thread's Ruby stack at a fixed
+    # period and attributes each sample to the handler the engine is
+    # currently running (see {ExecutionEngine#current_handler}): the poll
+    # block of a task model, the command or handlers of an event, or a
+    # propagation handler.
+    #
+    # The samples are aggregated by stack and saved in the "folded" format
+    # used by flame graph tools (one stack per line, with frames separated by
+    # ';' followed by the sample count). The plan object is the root frame of
+    # each stack, which groups the flame graph by task model and event.
+    #
+    # The cost of the profiler is bounded by its period and by
+    # {#max_depth}, as the engine thread only gets stopped while its stack is
+    # read.
+    #
+    # Since the sampling thread is a Ruby thread, it can only take a sample
+    # once it gets the GVL. When the engine thread is busy running Ruby code,
+    # this happens at the interpreter's thread switches (every 100ms on MRI)
+    # or when the engine releases the GVL (blocking I/O, sleep, C extensions
+    # that release it). The {#period} is therefore a lower bound, not the
+    # actual sampling period, and the samples are biased towards the code
+    # that runs right before the points where the GVL is handed off. The
+    # flame graphs show where the engine spends its time well when the cycles
+    # are long, but should not be read as exact proportions.
+    class SamplingProfiler
+        DEFAULT_PERIOD = 0.01
+        DEFAULT_MAX_DEPTH = 64
+        DEFAULT_SAVE_PERIOD = 10
+
+        # The engine whose thread is sampled
+        attr_reader :engine
+        # The minimum time between two samples, in seconds. See the class
+        # documentation for why the actual period is usually longer
+        attr_reader :period
+        # The maximum number of frames that are kept in each sample,
+        # starting from the innermost one
+        attr_reader :max_depth
+        # The file to which the samples are saved, or nil
+        attr_reader :path
+        # How often, in seconds, the samples are saved in {#path}
+        attr_reader :save_period
+        # The number of samples taken so far
+        attr_reader :sample_count
+
+        def initialize(engine, path = nil, period: DEFAULT_PERIOD, max_depth: DEFAULT_MAX_DEPTH, save_period: DEFAULT_SAVE_PERIOD)
+            @engine = engine
+            @path = path
+            @period = period
+            @max_depth = max_depth
+            @save_period = save_period
+            @samples = Hash.new(0)
+            @sample_count = 0
+            @mutex = Mutex.new
+            @labels = ObjectSpace::WeakMap.new
+        end
+
+        # Whether the sampling thread is running
+        def running?; !!@thread end
+
+        # Starts sampling
+        def start
+            if running?
+                raise ArgumentError, "#{self} is already running"
+            end
+
+            @thread = Thread.new do
+                last_save = Time.now
+                while true
+                    sleep period
+                    sample
+                    if path && (Time.now - last_save) > save_period
+                        save
+                        last_save = Time.now
+                    end
+                end
+            end
+        end
+
+        # Stops sampling and saves the samples in {#path}
+        def stop
+            return if !running?
+
+            @thread.kill
+            @thread.join
+            @thread = nil
+            if path
+                save
+            end
+        end
+
+        # Returns a copy of the aggregated samples
+        #
+        # @return [Hash<String,Integer>] the number of samples per stack. The
+        #   frames of a stack are separated by ';', from the outermost to the
+        #   innermost
+        def samples
+            @mutex.synchronize { @samples.dup }
+        end
+
+        # Removes all samples
+        def clear
+            @mutex.synchronize do
+                @samples.clear
+                @sample_count = 0
+            end
+        end
+
+        # Takes one sample of the engine thread
+        #
+        # @return [Boolean] true if a sample was taken, false if the engine
+        #   was not running
+        def sample
+            thread = engine.thread
+            return false if !thread || !thread.alive?
+
+            handler   = engine.current_handler
+            locations = thread.backtrace_locations(0, max_depth)
+            return false if !locations
+
+            stack = [handler_label(handler)]
+            locations.reverse_each do |loc|
+                stack << "#{loc.label} (#{loc.path})".tr(';', ':')
+            end
+            stack = stack.join(";")
+            @mutex.synchronize do
+                @samples[stack] += 1
+                @sample_count += 1
+            end
+            true
+        end
+
+        # Returns the frame that represents a handler in the samples
+        #
+        # Tasks' poll blocks are attributed to the task model, event commands
+        # and handlers to the task model and the event symbol (or to the
+        # generator model for free events) and the other handlers to their
+        # description.
+        def handler_label(handler)
+            return "engine" if !handler
+            if label = @labels[handler]
+                return label
+            end
+
+            label =
+                case handler
+                when ExecutionEngine::PollBlockDefinition
+                    block = handler.handler
+                    if block.respond_to?(:receiver) && block.receiver.kind_of?(Task)
+                        "#{block.receiver.model}##{block.name}"
+                    else
+                        handler.description.gsub(/0x\h+/, '')
+                    end
+                when EventGenerator
+                    if handler.respond_to?(:task)
+                        "#{handler.task.model}/#{handler.symbol}"
+                    else
+                        handler.model.to_s
+                    end
+                else handler.to_s.gsub(/0x\h+/, '')
+                end
+            label = label.tr(';', ':')
+            # The cache holds the handlers weakly, so that it does not keep
+            # the finalized objects alive
+            @labels[handler] = label
+        end
+
+        # Saves the aggregated samples in the folded format in the given IO
+        def write(io)
+            samples.sort_by(&:first).each do |stack, count|
+                io.puts "#{stack} #{count}"
+            end
+        end
+
+        # Saves the aggregated samples in the folded format in {#path}
+        def save
+            File.open("#{path}.tmp", 'w') do |io|
+                write(io)
+            end
+            File.rename("#{path}.tmp", path)
+        end
+    end
+end
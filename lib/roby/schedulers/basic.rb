@@ -1,3 +1,4 @@
+require 'roby_timer_queue'
 require 'roby/schedulers/reporting'
 
 module Roby
@@ -33,12 +34,18 @@ module Schedulers
         #    started if and only if it has at least one parent that is running
         #    (i.e. children are started after their parents).
         #
+        # The verdicts of #can_schedule? are cached from one cycle to the
+        # next. The verdict of a task is recomputed only if the relations of
+        # the task or of its start event changed, if its status changed or if
+        # one of its parents started or stopped (as notified by
+        # Plan#relation_listeners), or once the expiry time set by
+        # #verdict_valid_until is reached. Each cycle only looks at these
+        # tasks and at the ones that could be scheduled at the previous
+        # cycle, not at all the pending tasks of the plan.
+        #
 	class Basic < Reporting
             # The plan on which the scheduler applies
             attr_reader :plan
-            # The Roby::Query which is used to get the set of tasks that might
-            # be startable
-	    attr_reader :query
             # If true, the scheduler will start tasks which are non-root in the
             # dependency relation, if they have parents that are already
             # running. 
@@ -55,13 +62,16 @@ def initialize(include_children = false, plan = nil)
 
                 @plan = plan || Roby.plan
                 @include_children = include_children
-		@query = self.plan.find_tasks.
-		    executable.
-		    pending.
-		    self_owned
 
                 @can_schedule_cache = Hash.new
+                @verdict_expiry = Infinity
+                @verdict_expiries = TimerQueue.new
+                @cached_holdoffs = Hash.new
+                @non_executable_tasks = Hash.new
+                @revisited_tasks = Set.new
+                @invalidated_tasks = Set.new(self.plan.known_tasks)
                 @enabled = true
+                self.plan.add_relation_listener(self)
 	    end
 
             attr_predicate :enabled?, true
@@ -98,6 +108,11 @@ def can_schedule?(task, time = Time.now, stack = [])
                         true
                     else
                         planned_tasks = task.planned_tasks
+                        if !planned_tasks.empty?
+                            # The executable flag of the planned tasks is not
+                            # tracked
+                            uncacheable_verdict
+                        end
                         !planned_tasks.empty? &&
                             planned_tasks.all? { |t| !t.executable? }
                     end
@@ -112,42 +127,177 @@ def can_schedule?(task, time = Time.now, stack = [])
                 end
             end
 
-            # Starts all tasks that are eligible. See the documentation of the
-            # Basic class for an in-depth description
-	    def initial_events
+            # Called by the plan's relation hooks (see
+            # Plan#relation_listeners) to invalidate the cached verdicts of
+            # the tasks whose schedulability depends on this relation
+            def relation_changed(parent, child, relations)
+                if child.respond_to?(:task)
+                    invalidate(child.task)
+                elsif child.kind_of?(Roby::Task)
+                    invalidate(child)
+                end
+            end
+
+            # Called by the plan (see Plan#relation_listeners) when +task+ got
+            # added or removed, or when its status changed. The verdicts of
+            # its children depend on whether it is running
+            def task_status_changed(task)
+                invalidate(task)
+                if include_children
+                    task.each_child_object(TaskStructure::Dependency) do |child|
+                        invalidate(child)
+                    end
+                end
+            end
+
+            # Unregisters this scheduler from its plan's relation listeners and
+            # drops its cached verdicts. It is called by
+            # ExecutionEngine#scheduler= when the scheduler gets replaced
+            def teardown
+                plan.remove_relation_listener(self)
                 @can_schedule_cache.clear
-                time = Time.now
+                @verdict_expiries.clear
+                @cached_holdoffs.clear
+                @non_executable_tasks.clear
+                @revisited_tasks.clear
+                @invalidated_tasks.clear
+            end
+
+            # Forces the verdict of +task+ to be recomputed on the next call
+            # to #initial_events
+            def invalidate(task)
+                @invalidated_tasks << task
+            end
+
+            # Called during #can_schedule? to mark that the verdict depends on
+            # something that does not invalidate the cache, and should
+            # therefore be recomputed at each cycle
+            def uncacheable_verdict
+                @verdict_expiry = -Infinity
+            end
+
+            # Called during #can_schedule? to mark that the verdict might
+            # change at +time+ (as a floating-point time) even if the plan does
+            # not change
+            def verdict_valid_until(time)
+                if time < @verdict_expiry
+                    @verdict_expiry = time
+                end
+            end
+
+            # Drops everything the scheduler knows about +task+. It will be
+            # looked at again only once it gets invalidated
+            def forget(task)
+                @can_schedule_cache.delete(task)
+                @verdict_expiries.delete_all_for(task)
+                @cached_holdoffs.delete(task)
+                @non_executable_tasks.delete(task)
+                @revisited_tasks.delete(task)
+            end
+
+            # Returns the cached verdict of #can_schedule? for +task+, or
+            # computes and caches it
+            def cached_can_schedule?(task, time)
+                cached = @can_schedule_cache[task]
+                if cached && time.to_f < cached[2]
+                    result, holdoffs = *cached
+                    if holdoffs
+                        state.non_scheduled_tasks[task].merge(holdoffs)
+                    end
+                    return result
+                end
 
-                not_executable = self.plan.find_tasks.
-                    not_executable.
-                    pending.
-                    self_owned
+                forget(task)
+                @verdict_expiry = Infinity
+                result = can_schedule?(task, time, [])
+                if time.to_f < @verdict_expiry
+                    holdoffs = state.non_scheduled_tasks.fetch(task, nil)
+                    holdoffs = holdoffs.dup if holdoffs
+                    @can_schedule_cache[task] = [result, holdoffs, @verdict_expiry]
+                    if @verdict_expiry != Infinity
+                        @verdict_expiries.push(@verdict_expiry, task, task)
+                    end
+                    if result
+                        @revisited_tasks << task
+                    elsif holdoffs
+                        @cached_holdoffs[task] = holdoffs
+                    end
+                else
+                    @revisited_tasks << task
+                end
+                result
+            end
+
+            # @api private
+            #
+            # Removes the cached verdicts that might have changed since the
+            # last call to #initial_events, and returns the tasks that should
+            # be looked at in this cycle: the invalidated ones, and the ones
+            # that could be scheduled or whose verdict could not be cached at
+            # the last cycle
+            def update_can_schedule_cache(time = Time.now)
+                for task in @verdict_expiries.pop_until(time)
+                    invalidate(task)
+                end
+
+                invalidated, @invalidated_tasks = @invalidated_tasks, Set.new
+                candidates = @revisited_tasks | invalidated
+                for task in invalidated
+                    forget(task)
+                end
+                candidates
+            end
 
-                not_executable.each do |task|
-                    # Try to figure out why ...
+            # Reports +task+ as pending but not executable, and keeps the report
+            # until it gets invalidated
+            def report_non_executable(task)
+                # Try to figure out why ...
+                report =
                     if task.execution_agent && !task.execution_agent.ready?
-                        report_pending_non_executable_task("execution agent not ready (%2)", task, task.execution_agent)
+                        ["execution agent not ready (%2)", task, task.execution_agent]
                     elsif task.partially_instanciated?
-                        report_pending_non_executable_task("partially instanciated", task)
+                        ["partially instanciated", task]
                     else
-                        report_pending_non_executable_task("not executable", task)
+                        ["not executable", task]
                     end
+                report_pending_non_executable_task(*report)
+                @non_executable_tasks[task] = report
+
+                # Delayed arguments may get set without notification
+                if !task.arguments.static?
+                    @revisited_tasks << task
                 end
+            end
 
-                scheduled_tasks = []
-		for task in query.reset
-                    result =
-                        if @can_schedule_cache.include?(task)
-                            @can_schedule_cache[task]
-                        else @can_schedule_cache[task] = can_schedule?(task, time, [])
-                        end
+            # Starts all tasks that are eligible. See the documentation of the
+            # Basic class for an in-depth description
+	    def initial_events
+                time = Time.now
+                candidates = update_can_schedule_cache(time)
 
-                    if result
+                scheduled_tasks = []
+		for task in candidates
+                    if !plan.include?(task) || !task.self_owned? ||
+                        task.started? || task.failed_to_start?
+                        forget(task)
+                    elsif !task.pending?
+                        # Either starting or with an error, which change
+                        # without notification
+                        @revisited_tasks << task
+                    elsif !task.executable?
+                        report_non_executable(task)
+                    elsif cached_can_schedule?(task, time)
                         task.start!
                         report_trigger task.start_event
                         scheduled_tasks << task
                     end
 		end
+
+                # Report the tasks that have not been looked at again
+                state.pending_non_executable_tasks.merge(@non_executable_tasks.values)
+                state.non_scheduled_tasks.merge!(@cached_holdoffs) do |_, reported, cached|
+                    reported | cached
+                end
                 scheduled_tasks
 	    end
 	end
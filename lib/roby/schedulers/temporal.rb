@@ -5,6 +5,12 @@ module Schedulers
         # scheduler information given by the temporal constraint network.
         #
         # See the documentation of Roby::Schedulers for more information
+        #
+        # The verdicts are cached as in Basic. In addition, the verdict of a
+        # task is recomputed when an event that constrains its start event
+        # gets emitted, when the verdict of a task it is scheduled as (see
+        # EventStructure::SchedulingConstraints) gets recomputed, and when
+        # the current time reaches a bound of its temporal constraints.
         class Temporal < Basic
             # If true, the basic scheduler's constraints must be met for all
             # tasks. If false, they are applied only on tasks for which no
@@ -16,6 +22,42 @@ def initialize(with_basic = true, with_children = true, plan = nil)
                 @basic_constraints = with_basic
             end
 
+            # Overloaded to invalidate the tasks that are scheduled as +task+
+            def invalidate(task)
+                return if @invalidated_tasks.include?(task)
+
+                super
+                task.start_event.each_forward_scheduling_constraint do |child|
+                    if child.respond_to?(:task)
+                        invalidate(child.task)
+                    end
+                end
+            end
+
+            # Overloaded to invalidate the parent task as well on temporal
+            # and scheduling constraint changes, as #can_schedule? filters the
+            # constraints using the relations between tasks
+            def relation_changed(parent, child, relations)
+                super
+                if relations.include?(EventStructure::SchedulingConstraints) ||
+                    relations.include?(EventStructure::TemporalConstraints)
+                    if parent.respond_to?(:task)
+                        invalidate(parent.task)
+                    end
+                end
+            end
+
+            # Called by the plan when an event that constrains other events
+            # gets emitted. The emission changes the temporal constraints of
+            # its direct children
+            def constraining_event_emitted(generator)
+                generator.each_forward_temporal_constraint do |child|
+                    if child.respond_to?(:task)
+                        invalidate(child.task)
+                    end
+                end
+            end
+
             def can_schedule?(task, time = Time.now, stack = [])
                 if task.running?
                     return true
@@ -35,6 +77,27 @@ def can_schedule?(task, time = Time.now, stack = [])
                     end
                 end
 
+                # Fast path: the emission window of the start event is a
+                # necessary condition for the temporal constraints to be met.
+                # It takes all the parents into account, so it can be used
+                # only if none of them is filtered out
+                if window = Roby::EventStructure::TemporalConstraints.emission_window(start_event)
+                    if time.to_f < window[0]
+                        verdict_valid_until(window[0])
+                    elsif time.to_f <= window[1]
+                        verdict_valid_until(window[1])
+                    end
+
+                    if (time.to_f < window[0] || time.to_f > window[1]) &&
+                        start_event.each_backward_temporal_constraint.all?(&event_filter)
+                        report_holdoff "outside of its emission window [%2, %3]", task, *window
+                        return false
+                    end
+                end
+
+                if expiry = start_event.temporal_constraints_expiry(time, &event_filter)
+                    verdict_valid_until(expiry)
+                end
                 meets_constraints = start_event.meets_temporal_constraints?(time, &event_filter)
                 if !meets_constraints
                     if failed_temporal = start_event.find_failed_temporal_constraint(time, &event_filter)
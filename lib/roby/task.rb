@@ -174,6 +174,7 @@ def __assign_arguments__(arguments)
 
         ensure
             @arguments = initial_arguments
+            initial_arguments.updated_index
         end
 
         # Internal helper to set arguments by either using the argname= accessor
@@ -212,6 +213,7 @@ def initialize(arguments = Hash.new) #:yields: task_object
             @finishing = false
             @success = nil
             @reusable = true
+            update_status_flags
 
 	    @arguments = TaskArguments.new(self)
             __assign_arguments__(arguments)
@@ -334,6 +336,7 @@ def initialize_copy(old) # :nodoc:
 	    super
 
 	    @name    = nil
+            update_status_flags
 
 	    @arguments = TaskArguments.new(self)
 	    arguments.force_merge! old.arguments
@@ -347,6 +350,7 @@ def initialize_copy(old) # :nodoc:
                 if old.has_event?(ev_symbol)
                     ev = old.event(ev_symbol).dup
                     ev.instance_variable_set(:@task, self)
+                    ev.vertex_owner = self
                     bound_events[ev_symbol.to_sym] = ev
                 end
 	    end
@@ -469,7 +473,12 @@ def plan=(new_plan) # :nodoc:
         #
         #   task.abstract = <value>
         #
-        attr_predicate :abstract?, true
+        attr_predicate :abstract?
+
+        def abstract=(flag)
+            @abstract = flag
+            notify_status_changed
+        end
         
 	# True if this task is executable. A task is not executable if it is
         # abstract or partially instanciated.
@@ -496,6 +505,7 @@ def executable=(flag)
 		raise ModelViolation, "cannot unset the executable flag of #{self} since it is running"
 	    end
 	    super
+            notify_status_changed
 	end
 
         # Lists all arguments, that are set to be needed via the :argument 
@@ -548,6 +558,44 @@ def running?; started? && !finished? end
 
 	attr_predicate :started?, true
 	attr_predicate :finished?, true
+
+        def started=(flag)
+            @started = flag
+            update_status_flags
+            notify_status_changed
+        end
+
+        def finished=(flag)
+            @finished = flag
+            update_status_flags
+            notify_status_changed
+        end
+
+        # Tells the plan's listeners that the status of this task changed
+        # (see Plan#relation_listeners)
+        def notify_status_changed
+            if plan
+                plan.notify_task_status_changed(self)
+            end
+        end
+
+        # The BGL vertex flags that reflect the task status
+        STATUS_FLAGS = BGL::Vertex::PENDING_FLAG | BGL::Vertex::RUNNING_FLAG | BGL::Vertex::FINISHED_FLAG
+
+        # Updates the BGL vertex flags that reflect the task status, so that
+        # the graph algorithms can filter tasks by status (see
+        # BGL::Graph.roots)
+        def update_status_flags
+            flags = 0
+            if finished?
+                flags |= BGL::Vertex::FINISHED_FLAG
+            elsif started?
+                flags |= BGL::Vertex::RUNNING_FLAG
+            elsif !failed_to_start?
+                flags |= BGL::Vertex::PENDING_FLAG
+            end
+            update_vertex_flags(STATUS_FLAGS, flags)
+        end
 	attr_predicate :success?, true
         # True if the task is finishing, i.e. if a terminal event is pending.
         attr_predicate :finishing?, true
@@ -569,7 +617,9 @@ def failed_to_start!(reason, time = Time.now)
             @failed_to_start = true
             @failed_to_start_time = time
             @failure_reason = reason
+            update_status_flags
             plan.task_index.set_state(self, :failed?)
+            notify_status_changed
 
             each_event do |ev|
                 ev.unreachable!(reason)
@@ -139,6 +139,19 @@ def each
         # @return [Object]
 	def update!(key, value)
             values[key] = value
+            updated_index([key])
+            value
+        end
+
+        # @api private
+        #
+        # Updates the argument indexes of the task's plan after a change of
+        # the given arguments (or of all of them if +keys+ is nil)
+        def updated_index(keys = nil)
+            if task && (plan = task.plan) && task.arguments.equal?(self)
+                plan.task_index.update_arguments(task, keys)
+                plan.notify_task_status_changed(task)
+            end
         end
 
         # Assigns a value to a given argument name
@@ -162,6 +175,7 @@ def []=(key, value)
 
 		updating
 		values[key] = value
+                updated_index([key])
 		updated(key, value)
 
                 if update_static
@@ -202,6 +216,7 @@ def evaluate_delayed_arguments
 
         def force_merge!(hash)
             values.merge!(hash)
+            updated_index
         end
 
 	def merge!(hash)
@@ -213,6 +228,7 @@ def merge!(hash)
 		end
 	    end
             @static = values.all? { |k, v| !TaskArguments.delayed_argument?(v) }
+            updated_index
             self
 	end
 
@@ -17,6 +17,7 @@ def initialize(task, model)
 	    super(model.respond_to?(:call))
             @task, @event_model = task, model
 	    @symbol = model.symbol
+            self.vertex_owner = task
         end
 
         # The default command if the event is created with :controlable => true.
@@ -734,50 +734,10 @@ def removing_plan_relation(parent, child, relations)
         #
         # This is an internal method used by queries
 	def merged_generated_subgraphs(relation, plan_seeds, transaction_seeds)
-	    plan_set        = ValueSet.new
-	    transaction_set = ValueSet.new
-	    plan_seeds	      = plan_seeds.to_value_set
-	    transaction_seeds = transaction_seeds.to_value_set
-
-	    loop do
-		old_transaction_set = transaction_set.dup
-		transaction_set.merge(transaction_seeds)
-		for new_set in relation.generated_subgraphs(transaction_seeds, false)
-		    transaction_set.merge(new_set)
-		end
-
-		if old_transaction_set.size != transaction_set.size
-		    for o in (transaction_set - old_transaction_set)
-			if o.respond_to?(:__getobj__)
-			    o.__getobj__.each_child_object(relation) do |child|
-				plan_seeds << child unless self[child, false]
-			    end
-			end
-		    end
-		end
-		transaction_seeds.clear
-
-		plan_set.merge(plan_seeds)
-		plan_seeds.each do |seed|
-		    relation.each_dfs(seed, BGL::Graph::TREE) do |_, dest, _, kind|
-			next if plan_set.include?(dest)
-			if self[dest, false]
-			    proxy = wrap(dest, false)
-			    unless transaction_set.include?(proxy)
-				transaction_seeds << proxy
-			    end
-			    relation.prune # transaction branches must be developed inside the transaction
-			else
-			    plan_set << dest
-			end
-		    end
-		end
-		break if transaction_seeds.empty?
-
-		plan_seeds.clear
-	    end
-
-	    [plan_set, transaction_set]
+	    # The proxies are an overlay over the plan objects in the relation
+	    # graph, so the merged view is computed in a single native traversal
+	    relation.overlay_generated_subgraphs(plan_seeds.to_value_set,
+		transaction_seeds.to_value_set, proxy_objects)
 	end
 	
 	# Returns [plan_set, transaction_set], where the first is the set of
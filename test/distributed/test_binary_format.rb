@@ -0,0 +1,85 @@
+require 'roby/test/self'
+
+describe Roby::Distributed::BinaryFormat do
+    # A class that BinaryFormat encodes ivar by ivar. It needs to be named
+    class BinaryFormatPlainObject
+        attr_accessor :a, :b
+        def ==(other)
+            other.class == self.class && other.a == a && other.b == b
+        end
+    end
+
+    def roundtrip(object)
+        Roby::Distributed::BinaryFormat.load(Roby::Distributed::BinaryFormat.dump(object))
+    end
+
+    it "encodes the basic types" do
+        values = [nil, true, false, 0, -1, 2**62, 2**70, 1.5, :sym, "str", "bin".b,
+                  "\u00e9", [1, [2]], { a: 1, "b" => [2] }, 1r, (1..3)]
+        result = roundtrip(values)
+        values.zip(result).each do |expected, actual|
+            if expected.nil? then assert_nil actual
+            else assert_equal expected, actual
+            end
+            assert_equal expected.class, actual.class
+        end
+        assert_equal Encoding::UTF_8, result[11].encoding
+        assert_equal Encoding::BINARY, result[10].encoding
+    end
+
+    it "encodes times" do
+        local, utc = Time.at(10, 123456789, :nsec), Time.now.utc
+        result = roundtrip([local, utc])
+        assert_equal [local, utc], result
+        assert_equal local.utc_offset, result[0].utc_offset
+        assert result[1].utc?
+    end
+
+    it "encodes RemoteID and plain objects" do
+        object = BinaryFormatPlainObject.new
+        object.a = [Roby::Distributed::RemoteID.new("druby://localhost:0", 42)]
+        object.b = { "key" => :value }
+        assert_equal object, roundtrip(object)
+    end
+
+    it "falls back to Marshal for the objects it does not know about" do
+        hash = Hash.new(10)
+        result = roundtrip([Set[1, 2], hash, "latin".encode("ISO-8859-1")])
+        assert_equal Set[1, 2], result[0]
+        assert_equal 10, result[1].default
+        assert_equal Encoding::ISO_8859_1, result[2].encoding
+    end
+
+    it "keeps the object links valid after a Marshal-encoded symbol" do
+        sym = "caf\xE9".force_encoding("ISO-8859-1").to_sym
+        s = "shared"
+        result = roundtrip([sym, s, s])
+        assert_equal [sym, s, s], result
+        assert_same result[1], result[2]
+    end
+
+    it "encodes repeated objects as links" do
+        shared = [1, 2]
+        cycle = [shared, shared]
+        cycle << cycle
+        result = roundtrip(cycle)
+        assert_same result[0], result[1]
+        assert_same result, result[2]
+    end
+
+    it "appends to the given buffer" do
+        buffer = "prefix".b
+        assert_same buffer, Roby::Distributed::BinaryFormat.dump(1, buffer)
+        assert buffer.start_with?("prefix")
+        assert_equal 1, Roby::Distributed::BinaryFormat.load(buffer[6..-1])
+    end
+
+    it "loads marshalled data" do
+        assert_equal [1, :a], Roby::Distributed::BinaryFormat.load(Marshal.dump([1, :a]))
+    end
+
+    it "raises ArgumentError on truncated data" do
+        dumped = Roby::Distributed::BinaryFormat.dump([1, "string"])
+        assert_raises(ArgumentError) { Roby::Distributed::BinaryFormat.load(dumped[0..-2]) }
+    end
+end
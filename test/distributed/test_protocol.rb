@@ -492,6 +492,52 @@ def test_incremental_dump
 	end
     end
 
+    def test_format_follows_droby_dump_redefinitions
+	klass = Class.new
+	obj = klass.new
+	assert_same(obj, Distributed.format(obj))
+	klass.class_eval { def droby_dump(dest); [:dumped, dest] end }
+	assert_equal([:dumped, nil], Distributed.format(obj))
+	klass.class_eval { remove_method :droby_dump }
+	assert_same(obj, Distributed.format(obj))
+	klass.class_eval { include Module.new { def droby_dump(dest); :included end } }
+	assert_equal(:included, Distributed.format(obj))
+    end
+
+    def test_format_dumps_repeated_objects_once
+	klass = Class.new do
+	    attr_reader :dump_count
+	    def droby_dump(dest)
+		@dump_count = (@dump_count || 0) + 1
+		[:dumped, Distributed.format(self.class.name, dest)]
+	    end
+	end
+	obj = klass.new
+	formatted = Distributed.format([obj, [obj], { obj => obj }, [obj].to_set, [obj].to_value_set])
+	assert_equal(1, obj.dump_count)
+	assert_equal([:dumped, nil], formatted[0])
+	assert_same(formatted[0], formatted[1][0])
+	assert_equal({ formatted[0] => formatted[0] }, formatted[2])
+	assert_equal([formatted[0]].to_set, formatted[3])
+	assert_equal([formatted[0]].to_value_set, formatted[4])
+
+	Distributed.format(obj)
+	assert_equal(2, obj.dump_count)
+    end
+
+    def test_format_uses_the_log_known_objects
+	klass = Class.new do
+	    def droby_dump(dest); :full end
+	    def remote_id; :remote_id end
+	end
+	obj = klass.new
+	assert_equal([:full], Distributed.format([obj], Roby::Log))
+	Roby::Log.known_objects.insert(obj)
+	assert_equal([:remote_id], Distributed.format([obj], Roby::Log))
+    ensure
+	Roby::Log.known_objects.delete(obj)
+    end
+
     def test_local_object
 	model = Roby::Task.new_submodel do
 	    local_only
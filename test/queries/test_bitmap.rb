@@ -0,0 +1,82 @@
+require 'roby/test/self'
+
+describe Roby::Queries::Bitmap do
+    attr_reader :ids, :objects
+    before do
+        @ids = Roby::Queries::DenseIds.new
+        @objects = (0...10_000).map { Object.new }
+        objects.each { |obj| ids.register(obj) }
+    end
+
+    def bitmap_of(*objs)
+        bitmap = Roby::Queries::Bitmap.new(ids)
+        objs.each { |obj| bitmap << obj }
+        bitmap
+    end
+
+    it "reuses the ids of the released objects" do
+        id = ids.id_of(objects[10])
+        assert_equal id, ids.release(objects[10])
+        assert !ids.include?(objects[10])
+        obj = Object.new
+        assert_equal id, ids.register(obj)
+        assert_same obj, ids[id]
+    end
+
+    it "adds, removes and tests objects" do
+        bitmap = bitmap_of(objects[0], objects[5000])
+        assert bitmap.include?(objects[0])
+        assert bitmap.include?(objects[5000])
+        assert !bitmap.include?(objects[1])
+        assert !bitmap.include?(Object.new)
+        assert_equal 2, bitmap.size
+        bitmap.delete(objects[0])
+        assert !bitmap.include?(objects[0])
+        assert_equal [objects[5000]], bitmap.to_a
+        bitmap.delete(objects[5000])
+        assert bitmap.empty?
+    end
+
+    it "computes intersections, unions and differences" do
+        a = bitmap_of(*objects.values_at(1, 2, 3, 9000))
+        b = bitmap_of(*objects.values_at(2, 3, 4, 5000))
+        assert_equal objects.values_at(2, 3), (a & b).to_a
+        assert_equal objects.values_at(1, 2, 3, 4, 5000, 9000), (a | b).to_a
+        assert_equal objects.values_at(1, 9000), (a - b).to_a
+        assert_equal objects.values_at(1, 2, 3, 9000), a.to_a
+
+        a.intersection!(b)
+        assert_equal objects.values_at(2, 3), a.to_a
+        a.difference!(b)
+        assert a.empty?
+        a.merge(b)
+        assert_equal objects.values_at(2, 3, 4, 5000), a.to_a
+    end
+
+    it "converts to a ValueSet" do
+        bitmap = bitmap_of(*objects.values_at(1, 7000))
+        assert_equal objects.values_at(1, 7000).to_value_set, bitmap.to_value_set
+    end
+
+    it "ignores the bits of the released ids" do
+        bitmap = bitmap_of(*objects.values_at(1, 2))
+        ids.release(objects[1])
+        assert_equal [objects[2]], bitmap.to_a
+        assert_equal [objects[2]].to_value_set, bitmap.to_value_set
+    end
+
+    it "copies the bits on a copy of the ids" do
+        bitmap = bitmap_of(objects[42])
+        new_ids = ids.dup
+        copy = Roby::Queries::Bitmap.new(new_ids, bitmap)
+        assert_same new_ids, copy.ids
+        assert_equal [objects[42]], copy.to_a
+        new_ids.release(objects[1])
+        assert ids.include?(objects[1])
+    end
+
+    it "refuses to combine bitmaps defined on different ids" do
+        other = Roby::Queries::Bitmap.new(Roby::Queries::DenseIds.new)
+        assert_raises(ArgumentError) { bitmap_of(objects[0]) & other }
+    end
+end
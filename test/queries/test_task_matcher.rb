@@ -40,6 +40,50 @@ def test_match_task_fullfills
 	check_matches_fullfill(task_model, plan, t0, t1, t2)
     end
 
+    def test_match_indexed_arguments
+	task_model = Task.new_submodel do
+	    argument :value, :index => true, :default => 3
+	end
+
+	t0 = task_model.new(:value => 1)
+	t1 = task_model.new(:value => 2)
+	t2 = task_model.new
+	plan.add([t0, t1, t2])
+
+	assert_equal [t0].to_set, task_model.match.with_arguments(:value => 1).enum_for(:each, plan).to_set
+	assert_equal [t0].to_set, task_model.match.with_arguments(:value => 1.0).enum_for(:each, plan).to_set
+	assert_equal [t2].to_set, task_model.match.with_arguments(:value => 3).enum_for(:each, plan).to_set
+
+	t2.arguments[:value] = 4
+	assert_equal [t2].to_set, task_model.match.with_arguments(:value => 4).enum_for(:each, plan).to_set
+	assert task_model.match.with_arguments(:value => 3).enum_for(:each, plan).to_a.empty?
+	index = plan.task_index.argument_index(task_model, :value)
+	assert_equal [1.0, 2.0, 4.0], index.values.keys.sort
+
+	plan.remove_object(t0)
+	assert_equal [2.0, 4.0], index.values.keys.sort
+    end
+
+    def test_match_indexed_arguments_whose_equality_differs_from_eql
+        value_model = Struct.new(:value) do
+            def ==(other); value == other || super end
+        end
+	task_model = Task.new_submodel do
+	    argument :value, :index => true
+	end
+
+	t0 = task_model.new(:value => value_model.new(1))
+	t1 = task_model.new(:value => 1)
+	t2 = task_model.new(:value => 2)
+	plan.add([t0, t1, t2])
+
+	assert_equal [t0, t1].to_set, task_model.match.with_arguments(:value => 1).enum_for(:each, plan).to_set
+	assert_equal [t0, t1].to_set, task_model.match.with_arguments(:value => value_model.new(1)).enum_for(:each, plan).to_set
+	index = plan.task_index.argument_index(task_model, :value)
+	assert_equal [1.0, 2.0], index.values.keys.sort
+	assert_equal [t0], index.unindexed.to_a
+    end
+
     def test_match_tag
         tag = TaskService.new_submodel
         tag.argument :id
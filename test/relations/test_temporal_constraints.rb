@@ -144,6 +144,29 @@ def test_disjoint_intervals_included_p
         assert !set.include?(13)
     end
 
+    def test_disjoint_intervals_include_range_p
+        set = EventStructure::DisjointIntervalSet.new
+        set.add(0, 10)
+        set.add(11, 12)
+        assert set.include_range?(1, 9)
+        assert set.include_range?(11, 12)
+        assert !set.include_range?(9, 11)
+        assert !set.include_range?(-1, 1)
+    end
+
+    def test_disjoint_intervals_merge
+        set = EventStructure::DisjointIntervalSet.new
+        set.add(0, 10)
+        set.add(11, 12)
+        other = EventStructure::DisjointIntervalSet.new
+        other.add(-5, -3)
+        other.add(9, 11)
+        other.add(13, 14)
+        set.merge(other)
+        assert_equal [[-5, -3], [0, 12], [13, 14]], set.intervals
+        assert_equal [[-5, -3], [9, 11], [13, 14]], other.intervals
+    end
+
     def test_add_temporal_constraints
         t1, t2 = prepare_plan :add => 2
         e1 = t1.start_event
@@ -293,5 +316,41 @@ def test_temporal_constraint_when_source_did_not_emit_yet
             end
         end
     end
-end
 
+    def test_edge_bounds_follow_the_intervals
+        t1, t2 = prepare_plan :add => 2
+        e1 = t1.start_event
+        e2 = t2.start_event
+
+        e1.add_temporal_constraint(e2, 2, 10)
+        assert_equal [2, 10], TemporalConstraints.edge_bounds(e1, e2)
+        e1.add_temporal_constraint(e2, 12, 13)
+        assert_equal [2, 13], TemporalConstraints.edge_bounds(e1, e2)
+    end
+
+    def test_emission_windows
+        t1, t2 = prepare_plan :add => 2, :model => Tasks::Simple
+        e1 = t1.start_event
+        e2 = t2.start_event
+
+        e1.add_temporal_constraint(e2, 2, 10)
+        assert !TemporalConstraints.emission_window(e2)
+        e1.emit
+        emission_time = e1.last.time.to_f
+        assert_equal [emission_time + 2, emission_time + 10], TemporalConstraints.emission_window(e2)
+    end
+
+    def test_emission_windows_follow_the_constraint_changes
+        t1, t2 = prepare_plan :add => 2, :model => Tasks::Simple
+        e1 = t1.start_event
+        e2 = t2.start_event
+
+        e1.add_temporal_constraint(e2, 2, 10)
+        e1.emit
+        emission_time = e1.last.time.to_f
+        e1.add_temporal_constraint(e2, 12, 13)
+        assert_equal [emission_time + 2, emission_time + 13], TemporalConstraints.emission_window(e2)
+        e1.remove_forward_temporal_constraint(e2)
+        assert !TemporalConstraints.emission_window(e2)
+    end
+end
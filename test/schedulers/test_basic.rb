@@ -31,6 +31,20 @@ def test_non_executable
         assert t1.running?
     end
 
+    def test_partially_instanciated_tasks_are_scheduled_once_their_arguments_are_set
+        @scheduler = Roby::Schedulers::Basic.new(false, plan)
+        model = Tasks::Simple.new_submodel { argument :arg }
+        t1 = prepare_plan :add => 1, :model => model
+
+        scheduler_initial_events
+        assert !t1.running?
+        assert !scheduler.state.pending_non_executable_tasks.empty?
+
+        t1.arguments[:arg] = 10
+        scheduler_initial_events
+        assert t1.running?
+    end
+
     def test_event_ordering
         @scheduler = Roby::Schedulers::Basic.new(false, plan)
         t1, t2 = prepare_plan :add => 2, :model => Tasks::Simple
@@ -83,7 +97,54 @@ def test_planned_by
         assert !t2.running?
         assert t3.running?
     end
-end
 
+    def test_verdicts_are_cached_until_the_relations_change
+        @scheduler = Roby::Schedulers::Basic.new(false, plan)
+        t1, t2 = prepare_plan :add => 2, :model => Tasks::Simple
+        t1.depends_on t2
+        checked = []
+        scheduler.singleton_class.class_eval do
+            define_method(:can_schedule?) do |task, *args|
+                checked << task
+                super(task, *args)
+            end
+        end
+
+        scheduler_initial_events
+        assert t1.running?
+        assert !t2.running?
+
+        checked.clear
+        scheduler.clear_reports
+        scheduler.initial_events
+        assert checked.empty?
+        assert !t2.running?
+        assert !scheduler.state.non_scheduled_tasks[t2].empty?
 
+        t1.remove_child t2
+        scheduler.initial_events
+        assert_equal [t2], checked
+        assert t2.running?
+    end
 
+    def test_children_verdicts_are_invalidated_when_their_parent_starts
+        @scheduler = Roby::Schedulers::Basic.new(true, plan)
+        t1, t2 = prepare_plan :add => 2, :model => Tasks::Simple
+        t1.depends_on t2
+        t1.executable = false
+
+        scheduler.initial_events
+        assert !t2.running?
+        t1.executable = true
+        t1.start!
+        scheduler.initial_events
+        assert t2.running?
+    end
+    def test_replaced_scheduler_is_removed_from_the_relation_listeners
+        @scheduler = Roby::Schedulers::Basic.new(false, plan)
+        engine.scheduler = scheduler
+        assert plan.relation_listeners.include?(scheduler)
+        engine.scheduler = Roby::Schedulers::Null.new
+        assert !plan.relation_listeners.include?(scheduler)
+    end
+end
@@ -159,6 +159,33 @@ def test_parent_waiting_for_child
         assert !scheduler.can_schedule?(t0, Time.now)
         assert scheduler.can_schedule?(t1, Time.now)
     end
+
+    def test_verdicts_expire_at_the_temporal_constraint_bounds
+        t1, t2 = prepare_plan :add => 2, :model => Tasks::Simple
+        t2.start_event.should_emit_after(t1.start_event, :min_t => 5, :max_t => 10)
+        t1.start!
+        start_time = t1.start_event.last.time
+
+        scheduler.update_can_schedule_cache
+        assert !scheduler.cached_can_schedule?(t2, start_time + 1)
+        assert !scheduler.cached_can_schedule?(t2, start_time + 4)
+        assert scheduler.cached_can_schedule?(t2, start_time + 6)
+    end
+
+    def test_verdicts_are_invalidated_by_the_emission_of_constraining_events
+        t1, t2, t3 = prepare_plan :add => 3, :model => Tasks::Simple
+        t2.should_start_after(t1.start_event)
+        t3.schedule_as(t2)
+
+        scheduler.update_can_schedule_cache
+        assert !scheduler.cached_can_schedule?(t2, Time.now)
+        assert !scheduler.cached_can_schedule?(t3, Time.now)
+
+        t1.start!
+        scheduler.update_can_schedule_cache
+        assert scheduler.cached_can_schedule?(t2, Time.now)
+        assert scheduler.cached_can_schedule?(t3, Time.now)
+    end
 end
 
 
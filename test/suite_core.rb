@@ -13,6 +13,7 @@
 end
 
 require './test/test_bgl'
+require './test/test_timer_queue'
 require './test/test_relations'
 require './test/test_event'
 require './test/test_exceptions'
@@ -5,6 +5,7 @@
 require './test/distributed/test_mixed_plan'
 require './test/distributed/test_plan_notifications'
 require './test/distributed/test_protocol'
+require './test/distributed/test_binary_format'
 require './test/distributed/test_query'
 require './test/distributed/test_remote_plan'
 require './test/distributed/test_transaction'
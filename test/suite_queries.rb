@@ -6,5 +6,6 @@
 require './test/queries/test_and_matcher'
 require './test/queries/test_not_matcher'
 require './test/queries/test_query'
+require './test/queries/test_bitmap'
 require './test/queries/test_task_event_generator_matcher'
 require './test/queries/test_localized_error_matcher'
@@ -195,6 +195,25 @@ def assert_components(expected, found)
 		     found.map { |c| c.sort_by { |e| e.object_id } }.to_set)
     end
 
+    def test_graph_roots_within
+	graph = Graph.new
+	v1, v2, v3, v4, v5, v6 = (1..6).map { Vertex.new }
+	# v1 -> v2 -> v3, v4 -> v3, v5 <-> v6
+	graph.link v1, v2, nil
+	graph.link v2, v3, nil
+	graph.link v4, v3, nil
+	graph.link v5, v6, nil
+	graph.link v6, v5, nil
+	outside = Vertex.new
+
+	assert_equal [v1, v4].to_value_set, graph.roots_within([v1, v3, v4].to_value_set)
+	assert_equal [v2].to_value_set, graph.roots_within([v2, v3].to_value_set)
+	assert_equal [v3, outside].to_value_set, graph.roots_within([v3, outside].to_value_set)
+	assert_equal [v5].to_value_set, graph.roots_within([v5].to_value_set)
+	assert_equal ValueSet.new, graph.roots_within([v5, v6].to_value_set)
+	assert_equal [v1].to_value_set, graph.roots_within([v1, v5, v6].to_value_set)
+    end
+
     def test_graph_components
 	graph = Graph.new
 
@@ -653,6 +672,398 @@ def test_difference
             assert_equal 2, graph.in_degree(vertex)
         end
     end
+
+    describe "#strongly_connected_components" do
+        it "should return the cycles as components" do
+            a, b, c, d = (1..4).map { vertex_m.new }
+            graph.link(a, b, nil)
+            graph.link(b, c, nil)
+            graph.link(c, a, nil)
+            graph.link(c, d, nil)
+            components = graph.strongly_connected_components
+            assert_equal [[a, b, c].to_set, [d].to_set].to_set, components.map(&:to_set).to_set
+        end
+        it "should not return the singleton components if include_singletons is false" do
+            a, b, c, d = (1..4).map { vertex_m.new }
+            graph.link(a, b, nil)
+            graph.link(b, a, nil)
+            graph.link(c, d, nil)
+            components = graph.strongly_connected_components(false)
+            assert_equal [[a, b].to_set], components.map(&:to_set)
+        end
+    end
+
+    describe "#find_cycle" do
+        it "should return nil if there are no cycles" do
+            a, b, c = (1..3).map { vertex_m.new }
+            graph.link(a, b, nil)
+            graph.link(b, c, nil)
+            graph.link(a, c, nil)
+            assert_nil graph.find_cycle([a].to_value_set)
+        end
+        it "should return the edges of a cycle reachable from the seeds" do
+            a, b, c, d = (1..4).map { vertex_m.new }
+            graph.link(a, b, nil)
+            graph.link(b, c, nil)
+            graph.link(c, d, nil)
+            graph.link(d, b, nil)
+            cycle = graph.find_cycle([a].to_value_set)
+            assert_equal [[b, c, graph], [c, d, graph], [d, b, graph]].to_set, cycle.to_set
+        end
+        it "should ignore the vertices that are not in the within set" do
+            a, b, c = (1..3).map { vertex_m.new }
+            graph.link(a, b, nil)
+            graph.link(b, c, nil)
+            graph.link(c, a, nil)
+            assert_nil graph.find_cycle([a].to_value_set, [a, b].to_value_set)
+        end
+        it "should find cycles spanning multiple graphs" do
+            other = BGL::Graph.new
+            a, b, c = (1..3).map { vertex_m.new }
+            graph.link(a, b, nil)
+            other.link(b, c, nil)
+            graph.link(c, a, nil)
+            assert_nil graph.find_cycle([a].to_value_set)
+            cycle = BGL::Graph.find_cycle([graph, other], [a].to_value_set)
+            assert_equal [[a, b, graph], [b, c, other], [c, a, graph]].to_set, cycle.to_set
+        end
+    end
+
+    describe "vertex flags" do
+        it "should be zero by default" do
+            assert_equal 0, vertex.vertex_flags
+        end
+        it "should allow to set and clear flags" do
+            vertex.set_vertex_flags(BGL::Vertex::RUNNING_FLAG | BGL::Vertex::FINISHED_FLAG)
+            assert vertex.vertex_flags?(BGL::Vertex::RUNNING_FLAG)
+            vertex.clear_vertex_flags(BGL::Vertex::RUNNING_FLAG)
+            assert_equal BGL::Vertex::FINISHED_FLAG, vertex.vertex_flags
+        end
+        it "should only change the flags selected by the mask in #update_vertex_flags" do
+            vertex.set_vertex_flags(BGL::Vertex::FINISHED_FLAG | BGL::Vertex::PENDING_FLAG)
+            vertex.update_vertex_flags(BGL::Vertex::PENDING_FLAG | BGL::Vertex::RUNNING_FLAG, BGL::Vertex::RUNNING_FLAG)
+            assert_equal BGL::Vertex::FINISHED_FLAG | BGL::Vertex::RUNNING_FLAG, vertex.vertex_flags
+        end
+        it "should be kept when the vertex is added and removed from graphs" do
+            vertex.set_vertex_flags(BGL::Vertex::FINISHED_FLAG)
+            graph.insert(vertex)
+            graph.remove(vertex)
+            assert_equal BGL::Vertex::FINISHED_FLAG, vertex.vertex_flags
+        end
+    end
+
+    describe ".roots" do
+        it "should return the vertices that have no parents in any of the graphs" do
+            other = BGL::Graph.new
+            a, b, c = (1..3).map { vertex_m.new }
+            graph.link(a, b, nil)
+            other.link(b, c, nil)
+            assert_equal [a].to_value_set, BGL::Graph.roots([graph, other], [a, b, c].to_value_set)
+        end
+        it "should ignore the parents that have one of the ignored flags set" do
+            a, b, c = (1..3).map { vertex_m.new }
+            graph.link(a, b, nil)
+            graph.link(c, b, nil)
+            a.set_vertex_flags(BGL::Vertex::FINISHED_FLAG)
+            assert_equal [a, c].to_value_set, BGL::Graph.roots([graph], [a, b, c].to_value_set, BGL::Vertex::FINISHED_FLAG)
+            c.set_vertex_flags(BGL::Vertex::FINISHED_FLAG)
+            assert_equal [a, b, c].to_value_set, BGL::Graph.roots([graph], [a, b, c].to_value_set, BGL::Vertex::FINISHED_FLAG)
+        end
+    end
+
+    describe "on graphs large enough to release the GVL" do
+        attr_reader :chain
+        before do
+            @chain = (1..300).map { vertex_m.new }
+            chain.each_cons(2) { |a, b| graph.link(a, b, nil) }
+        end
+
+        it "should sort them topologically" do
+            assert_equal chain, graph.topological_sort
+        end
+        it "should compute their components" do
+            assert_equal [chain.to_set], graph.components.map(&:to_set)
+        end
+        it "should compute their generated subgraphs" do
+            assert_equal [chain[1..-1].to_value_set], graph.generated_subgraphs([chain[1]].to_value_set)
+            assert_equal [chain[0, 2].to_value_set], graph.reverse.generated_subgraphs([chain[1]].to_value_set)
+        end
+        it "should check for reachability" do
+            assert_equal true, graph.reachable?(chain.first, chain.last)
+            assert_equal false, graph.reachable?(chain.last, chain.first)
+        end
+        it "should leave the graph modifiable if the traversing thread gets interrupted" do
+            10.times do
+                thread = Thread.new { loop { graph.topological_sort } }
+                Thread.pass
+                thread.raise Interrupt
+                assert_raises(Interrupt) { thread.join }
+            end
+            graph.unlink(chain[0], chain[1])
+            assert !graph.linked?(chain[0], chain[1])
+        end
+    end
+
+    describe ".reachable_vertices" do
+        attr_reader :other
+        before do
+            @other = BGL::Graph.new
+        end
+
+        it "should follow the edges of all the graphs" do
+            a, b, c, d = (1..4).map { vertex_m.new }
+            graph.link(a, b, nil)
+            other.link(b, c, nil)
+            graph.link(d, a, nil)
+            assert_equal [a, b, c].to_value_set, BGL::Graph.reachable_vertices([graph, other], [a].to_value_set)
+            assert_equal [d, a].to_value_set, BGL::Graph.reachable_vertices([graph, other], [a].to_value_set, BGL::Graph::REVERSE)
+            assert_equal [a, b, c, d].to_value_set, BGL::Graph.reachable_vertices([graph, other], [a].to_value_set, BGL::Graph::DIRECT | BGL::Graph::REVERSE)
+        end
+        it "should only continue from the vertices in within" do
+            a, b, c, d = (1..4).map { vertex_m.new }
+            graph.link(a, b, nil)
+            graph.link(b, c, nil)
+            other.link(c, d, nil)
+            assert_equal [a, c].to_value_set, BGL::Graph.reachable_vertices([graph, other], [a].to_value_set, BGL::Graph::DIRECT, [a, c].to_value_set)
+        end
+        it "should not continue from the vertices in known" do
+            a, b, c = (1..3).map { vertex_m.new }
+            graph.link(a, b, nil)
+            other.link(b, c, nil)
+            assert_equal [a].to_value_set, BGL::Graph.reachable_vertices([graph, other], [a].to_value_set, BGL::Graph::DIRECT, nil, [b].to_value_set)
+        end
+        it "should give the same result on multiple threads" do
+            begin
+                BGL.thread_count = 4
+                assert_equal 4, BGL.thread_count
+                vertices = (1..1000).map { vertex_m.new }
+                vertices.each_cons(2) { |a, b| graph.link(a, b, nil) }
+                seeds = vertices.values_at(*(0...1000).step(100)).to_value_set
+                assert_equal vertices.to_value_set, BGL::Graph.reachable_vertices([graph], seeds)
+            ensure
+                BGL.thread_count = 0
+            end
+        end
+        it "should not resize the thread pool while it is being used" do
+            vertices = (1..1000).map { vertex_m.new }
+            vertices.each_cons(2) { |a, b| graph.link(a, b, nil) }
+            seeds = [vertices.first].to_value_set
+            results = []
+            thread = Thread.new do
+                20.times { results << BGL::Graph.reachable_vertices([graph], seeds).size }
+            end
+            begin
+                while thread.alive?
+                    begin BGL.thread_count = (BGL.thread_count == 2 ? 3 : 2)
+                    rescue ThreadError
+                    end
+                    Thread.pass
+                end
+                thread.join
+                assert_equal [1000] * 20, results
+            ensure
+                BGL.thread_count = 0
+            end
+        end
+    end
+
+    describe "the journal" do
+        it "should not record anything by default" do
+            a, b = (1..2).map { vertex_m.new }
+            graph.link(a, b, nil)
+            assert !graph.journal_enabled?
+            assert_equal [], graph.drain_journal
+        end
+        it "should record the modifications with the current stamp" do
+            a, b = (1..2).map { vertex_m.new }
+            graph.enable_journal
+            BGL::Graph.journal_stamp = 42
+            graph.link(a, b, 1)
+            a[b, graph] = 2
+            graph.unlink(a, b)
+            graph.remove(a)
+            assert_equal [[BGL::Graph::JOURNAL_INSERT, 42, a, nil, nil],
+                [BGL::Graph::JOURNAL_INSERT, 42, b, nil, nil],
+                [BGL::Graph::JOURNAL_LINK, 42, a, b, 1],
+                [BGL::Graph::JOURNAL_UPDATE, 42, a, b, 2],
+                [BGL::Graph::JOURNAL_UNLINK, 42, a, b, nil],
+                [BGL::Graph::JOURNAL_REMOVE, 42, a, nil, nil]], graph.drain_journal
+            assert_equal [], graph.drain_journal
+        end
+        it "should drain the entries in batches" do
+            vertices = (1..3).map { vertex_m.new }
+            graph.enable_journal
+            vertices.each { |v| graph.insert(v) }
+            assert_equal vertices[0, 2], graph.drain_journal(2).map { |entry| entry[2] }
+            assert_equal vertices[2, 1], graph.drain_journal(2).map { |entry| entry[2] }
+        end
+        it "should drop the oldest entries when it is full" do
+            vertices = (1..3).map { vertex_m.new }
+            graph.enable_journal(2)
+            vertices.each { |v| graph.insert(v) }
+            assert_equal 1, graph.journal_dropped
+            assert_equal vertices[1, 2], graph.drain_journal.map { |entry| entry[2] }
+        end
+    end
+
+    describe "projections" do
+        attr_reader :projection, :ta, :tb
+        before do
+            @projection = BGL::Graph.new
+            graph.projection = projection
+            @ta, @tb = vertex_m.new, vertex_m.new
+        end
+        def owned_by(owner)
+            v = vertex_m.new
+            v.vertex_owner = owner
+            v
+        end
+
+        it "should count the edges that connect two owners" do
+            a1, a2, b = owned_by(ta), owned_by(ta), owned_by(tb)
+            graph.link(a1, b, nil)
+            graph.link(a2, b, nil)
+            assert_equal 2, projection.edge_multiplicity(ta, tb)
+            graph.unlink(a1, b)
+            assert projection.linked?(ta, tb)
+            assert_equal 1, projection.edge_multiplicity(ta, tb)
+            graph.unlink(a2, b)
+            assert !projection.linked?(ta, tb)
+            assert_equal 0, projection.edge_multiplicity(ta, tb)
+        end
+        it "should ignore the edges within the same owner or without owners" do
+            a1, a2 = owned_by(ta), owned_by(ta)
+            graph.link(a1, a2, nil)
+            graph.link(a2, vertex_m.new, nil)
+            assert projection.empty?
+        end
+        it "should update the projection and remove isolated owners when vertices are removed" do
+            a1, a2, b = owned_by(ta), owned_by(ta), owned_by(tb)
+            graph.link(a1, b, nil)
+            graph.link(a2, b, nil)
+            graph.remove(a1)
+            assert_equal 1, projection.edge_multiplicity(ta, tb)
+            graph.remove(b)
+            assert !projection.include?(tb)
+            graph.remove(a2)
+            assert !projection.include?(ta)
+        end
+        it "should update the projection when the graph is cleared" do
+            graph.link(owned_by(ta), owned_by(tb), nil)
+            graph.clear
+            assert projection.empty?
+        end
+        it "should project the existing edges when it is set" do
+            other = BGL::Graph.new
+            a, b = owned_by(ta), owned_by(tb)
+            other.link(a, b, nil)
+            projection = BGL::Graph.new
+            other.projection = projection
+            assert_same projection, other.projection
+            assert projection.linked?(ta, tb)
+        end
+        it "should refuse non-empty graphs and cycles" do
+            assert_raises(ArgumentError) { projection.projection = graph }
+            graph.insert(vertex_m.new)
+            assert_raises(ArgumentError) { BGL::Graph.new.projection = graph }
+        end
+    end
+
+    describe "hierarchies" do
+        attr_reader :parent, :root
+        before do
+            @parent, @root = BGL::Graph.new, BGL::Graph.new
+            graph.parent = parent
+            parent.parent = root
+        end
+
+        it "should add the edge in the levels that do not have it" do
+            a, b = vertex_m.new, vertex_m.new
+            parent.link(a, b, nil)
+            assert_equal [graph, root], graph.link_in_hierarchy(a, b, 42)
+            assert_equal 42, a[b, graph]
+            assert_equal nil, a[b, root]
+            assert_equal [], graph.link_in_hierarchy(a, b, 42)
+        end
+        it "should yield the new levels before adding the edge" do
+            a, b = vertex_m.new, vertex_m.new
+            assert_raises(ArgumentError) do
+                graph.link_in_hierarchy(a, b, nil) do |relations|
+                    assert_equal [graph, parent, root], relations
+                    raise ArgumentError
+                end
+            end
+            assert !root.linked?(a, b)
+        end
+        it "should check for cycles on the topmost DAG" do
+            a, b, c = vertex_m.new, vertex_m.new, vertex_m.new
+            parent.dag = true
+            parent.link(b, c, nil)
+            parent.link(c, a, nil)
+            assert_raises(BGL::CycleFoundError) { graph.link_in_hierarchy(a, b, nil) }
+            assert !graph.linked?(a, b)
+            root.link(c, b, nil)
+            assert_equal [graph, root], graph.link_in_hierarchy(b, c, nil)
+        end
+        it "should remove the edge from all the levels" do
+            a, b = vertex_m.new, vertex_m.new
+            graph.link_in_hierarchy(a, b, nil)
+            yielded = nil
+            assert_equal [graph, parent, root], graph.unlink_in_hierarchy(a, b) { |relations| yielded = relations }
+            assert_equal [graph, parent, root], yielded
+            assert !root.linked?(a, b)
+            assert_equal [], graph.unlink_in_hierarchy(a, b)
+        end
+        it "should copy the edges of a new subset in its parents" do
+            a, b = vertex_m.new, vertex_m.new
+            subset = BGL::Graph.new
+            subset.link(a, b, 42)
+            subset.parent = graph
+            assert_same graph, subset.parent
+            assert_equal 42, a[b, graph]
+            assert root.linked?(a, b)
+        end
+        it "should refuse cycles in the parent chain" do
+            assert_raises(ArgumentError) { root.parent = graph }
+        end
+    end
+
+    describe "#overlay_generated_subgraphs" do
+        it "should traverse the merged view of the base and its overlay" do
+            a, b, c, d, e = (1..5).map { vertex_m.new }
+            pc, pe, n = (1..3).map { vertex_m.new }
+            graph.link(a, b, nil)
+            graph.link(b, c, nil)
+            graph.link(c, d, nil)
+            graph.link(c, e, nil)
+            graph.link(pc, n, nil)
+            graph.insert(pe)
+            shadows = { c => pc, e => pe }
+
+            base_set, overlay_set = graph.overlay_generated_subgraphs([a].to_value_set, ValueSet.new, shadows)
+            assert_equal [a, b, d].to_value_set, base_set
+            assert_equal [pc, n].to_value_set, overlay_set
+
+            base_set, overlay_set = graph.overlay_generated_subgraphs(ValueSet.new, [pe].to_value_set, shadows)
+            assert_equal ValueSet.new, base_set
+            assert_equal [pe].to_value_set, overlay_set
+        end
+    end
+
+    describe "#set_edge_bounds" do
+        it "should store the delay bounds of an edge" do
+            a, b = (1..2).map { vertex_m.new }
+            graph.link(a, b, nil)
+            assert_equal [-Float::INFINITY, Float::INFINITY], graph.edge_bounds(a, b)
+            graph.set_edge_bounds(a, b, 1, 2)
+            assert_equal [1.0, 2.0], graph.edge_bounds(a, b)
+        end
+        it "should raise if the edge does not exist" do
+            a, b = (1..2).map { vertex_m.new }
+            graph.insert(a)
+            assert_raises(ArgumentError) { graph.set_edge_bounds(a, b, 1, 2) }
+        end
+    end
 end
 
 
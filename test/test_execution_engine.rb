@@ -198,6 +198,100 @@ def test_propagation_handlers_ignore_on_error
         engine.remove_propagation_handler(handler) if handler
     end
 
+    def test_profiler_measures_phases_and_propagation_handlers
+        engine.profiler.enabled = true
+        id = engine.add_propagation_handler { |plan| }
+        handler = engine.external_events_handlers.find { |h| h.id == id }
+        process_events
+        assert_equal 1, engine.profiler.handlers[handler.profile_key].count
+        assert engine.profiler.phases[:structure_check]
+        assert engine.profiler.phases[:garbage_collect]
+    ensure
+        engine.profiler.enabled = false
+        engine.remove_propagation_handler(id) if id
+    end
+
+    def test_profiler_does_not_measure_anything_if_disabled
+        id = engine.add_propagation_handler { |plan| }
+        process_events
+        assert engine.profiler.handlers.empty?
+        assert engine.profiler.phases.empty?
+    ensure
+        engine.remove_propagation_handler(id) if id
+    end
+
+    def test_profiler_attributes_overruns_to_the_slowest_handler
+        profiler = CycleProfiler.new
+        profiler.enabled = true
+        profiler.start_cycle
+        profiler.measure('fast') { }
+        profiler.measure('slow') { sleep 0.01 }
+        profiler.end_cycle(0.001)
+        assert_equal 1, profiler.overrun_count
+        assert_equal Hash['slow' => 1], profiler.overruns
+    end
+
+    def test_profiler_attributes_overruns_to_the_phase_time_outside_of_the_handlers
+        profiler = CycleProfiler.new
+        profiler.enabled = true
+        profiler.start_cycle
+        profiler.measure('fast') { }
+        sleep 0.01
+        profiler.timepoint(:structure_check)
+        profiler.end_cycle(0.001)
+        assert_equal Hash['phase structure_check' => 1], profiler.overruns
+    end
+
+    def test_profiler_accumulates_one_shot_handlers_together
+        engine.profiler.enabled = true
+        engine.once { }
+        engine.once { }
+        process_events
+        assert_equal 2, engine.profiler.handlers['one-shot handlers'].count
+        assert engine.profiler.handlers.keys.none? { |key| key =~ /#<Proc/ }
+    ensure
+        engine.profiler.enabled = false
+    end
+
+    def test_current_handler_is_set_while_calling_propagation_handlers
+        current = nil
+        id = engine.add_propagation_handler { |plan| current = engine.current_handler }
+        process_events
+        assert_equal id, current.id
+        assert_nil engine.current_handler
+    ensure
+        engine.remove_propagation_handler(id) if id
+    end
+
+    def test_current_handler_is_set_while_calling_event_commands_and_handlers
+        in_command, in_handler = nil
+        plan.add(ev = EventGenerator.new { |_| in_command = engine.current_handler; ev.emit })
+        ev.on { |_| in_handler = engine.current_handler }
+        ev.call
+        assert_equal ev, in_command
+        assert_equal ev, in_handler
+        assert_nil engine.current_handler
+    end
+
+    def test_sampling_profiler_attributes_samples_to_the_current_handler
+        plan.add(task = Tasks::Simple.new)
+        fake_engine = flexmock(thread: Thread.current, current_handler: task.start_event)
+        profiler = SamplingProfiler.new(fake_engine)
+        assert profiler.sample
+        stack, count = profiler.samples.first
+        assert_equal 1, count
+        assert_equal "#{Tasks::Simple}/start", stack.split(';').first
+    end
+
+    def test_profiler_histogram_percentiles
+        histogram = CycleProfiler::Histogram.new
+        (1..1000).each { |i| histogram.record(i / 1000.0) }
+        assert_equal 1000, histogram.count
+        assert_in_delta 0.5, histogram.percentile(50), 0.5 / 32
+        assert_in_delta 0.99, histogram.percentile(99), 0.99 / 32
+        assert_equal 1.0, histogram.percentile(100)
+    end
+
     def test_prepare_propagation
 	g1, g2 = EventGenerator.new(true), EventGenerator.new(true)
 	ev = Event.new(g2, 0, nil)
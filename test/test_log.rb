@@ -1,4 +1,6 @@
 require 'roby/test/distributed'
+require 'roby/log/file'
+require 'tmpdir'
 
 class TC_Log < Minitest::Test
     def teardown
@@ -112,5 +114,112 @@ def test_known_objects_management
 	    end
 	end
     end
-end
 
+    def test_chunk_writer
+        Dir.mktmpdir do |dir|
+            File.open(File.join(dir, "chunks"), 'w') do |io|
+                io.write("header")
+                writer = Log::ChunkWriter.new(io, 10)
+                assert_equal 6, writer.tell
+                writer.dump([1, :a, "b"])
+                writer.dump(:c)
+                # Nothing gets written before the flush interval
+                assert_equal 6, File.size(io.path)
+
+                invalid = Object.new
+                def invalid._dump(level); raise ArgumentError end
+                assert_raises(ArgumentError) { writer.dump(invalid) }
+
+                writer.flush
+                assert_equal File.size(io.path), writer.tell
+                writer.close
+                assert writer.closed?
+                assert_raises(IOError) { writer.dump(:d) }
+                assert !io.closed?
+            end
+
+            File.open(File.join(dir, "chunks")) do |io|
+                io.read(6)
+                assert_equal [1, :a, "b"], Log::Logfile.load_one_chunk(io)
+                assert_equal :c, Log::Logfile.load_one_chunk(io)
+                assert io.eof?
+            end
+        end
+    end
+
+    def test_chunk_writer_follower_is_written_after_its_leader
+        Dir.mktmpdir do |dir|
+            File.open(File.join(dir, "leader"), 'w') do |leader_io|
+                File.open(File.join(dir, "follower"), 'w') do |follower_io|
+                    leader   = Log::ChunkWriter.new(leader_io, 10)
+                    follower = Log::ChunkWriter.new(follower_io, nil, leader)
+                    assert_equal 10, follower.flush_interval
+                    leader.dump(:a)
+                    follower.dump(:b)
+                    follower.flush
+                    # The leader's chunk got queued first, it must be written
+                    # along with the follower's
+                    assert_equal leader.tell, File.size(leader_io.path)
+                    assert_equal follower.tell, File.size(follower_io.path)
+                    follower.close
+                    leader.dump(:c)
+                    leader.close
+                end
+            end
+            File.open(File.join(dir, "leader")) do |io|
+                assert_equal :a, Log::Logfile.load_one_chunk(io)
+                assert_equal :c, Log::Logfile.load_one_chunk(io)
+                assert io.eof?
+            end
+        end
+    end
+
+    def test_chunk_writer_is_unusable_in_a_forked_process
+        Dir.mktmpdir do |dir|
+            File.open(File.join(dir, "chunks"), 'w') do |io|
+                writer = Log::ChunkWriter.new(io, 10)
+                writer.dump(:a)
+                pid = fork do
+                    begin
+                        writer.dump(:b)
+                        exit! 1
+                    rescue IOError
+                    end
+                    writer.close
+                    exit! 0
+                end
+                Process.wait(pid)
+                assert $?.success?
+                writer.close
+            end
+            File.open(File.join(dir, "chunks")) do |io|
+                assert_equal :a, Log::Logfile.load_one_chunk(io)
+                assert io.eof?
+            end
+        end
+    end
+
+    def test_file_logger_index
+        Dir.mktmpdir do |dir|
+            basename = File.join(dir, "log")
+            logger = Log::FileLogger.new(basename, Hash.new)
+            3.times do |i|
+                logger.dump_method(:added_tasks, Time.now, [i])
+                logger.dump_method(:cycle_end, Time.now, [Hash[:cycle_index => i]])
+            end
+            logger.close
+
+            File.open("#{basename}-events.log") do |event_log|
+                File.open("#{basename}-index.log") do |index_log|
+                    3.times do |i|
+                        info = Log::Logfile.load_one_chunk(index_log)
+                        assert_equal i, info[:cycle_index]
+                        event_log.seek(info[:pos])
+                        cycle = Log::Logfile.load_one_chunk(event_log)
+                        assert_equal [:added_tasks, [i]], cycle.values_at(0, 3)
+                    end
+                end
+            end
+        end
+    end
+end
@@ -297,6 +297,7 @@ def test_event_relation_graph
             attr_accessor :task
             def initialize(task)
                 @task = task
+                self.vertex_owner = task
             end
             include Roby::DirectedRelationSupport
         end
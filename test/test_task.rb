@@ -76,6 +76,29 @@ def high_level_arg=(value)
                 assert_equal task.stop_event.last, task.last_event
             end
         end
+
+        describe "the status vertex flags" do
+            attr_reader :task
+            before do
+                plan.add(@task = Roby::Tasks::Simple.new)
+            end
+            it "marks a new task as pending" do
+                assert_equal BGL::Vertex::PENDING_FLAG, task.vertex_flags & Task::STATUS_FLAGS
+            end
+            it "marks a started task as running" do
+                task.start!
+                assert_equal BGL::Vertex::RUNNING_FLAG, task.vertex_flags & Task::STATUS_FLAGS
+            end
+            it "marks a stopped task as finished" do
+                task.start!
+                task.stop!
+                assert_equal BGL::Vertex::FINISHED_FLAG, task.vertex_flags & Task::STATUS_FLAGS
+            end
+            it "sets the status flags of a copy" do
+                task.start!
+                assert_equal BGL::Vertex::RUNNING_FLAG, task.dup.vertex_flags & Task::STATUS_FLAGS
+            end
+        end
     end
 end
 
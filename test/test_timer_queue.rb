@@ -0,0 +1,63 @@
+require 'roby/test/self'
+
+describe Roby::TimerQueue do
+    attr_reader :queue
+    before do
+        @queue = Roby::TimerQueue.new(1)
+    end
+
+    it "pops the entries in time order, and in insertion order for equal times" do
+        queue.push(3, :a, :a3)
+        queue.push(1, :b, :b1)
+        queue.push(2, :a, :a2)
+        queue.push(1, :c, :c1)
+        assert_equal 4, queue.size
+        assert_equal [:b1, :c1, :a2], queue.pop_until(2)
+        assert_equal [:a3], queue.to_a
+    end
+
+    it "only pops the entries strictly before the time in #pop_before" do
+        queue.push(1, :a, :a1)
+        queue.push(2, :a, :a2)
+        assert_equal [:a1], queue.pop_before(2)
+        assert_equal [:a2], queue.pop_until(2)
+        assert queue.empty?
+    end
+
+    it "accepts Time objects" do
+        t = Time.now
+        queue.push(t + 1, :a, :a1)
+        queue.push(t, :a, :a0)
+        assert_equal [:a0], queue.pop_until(t + 0.5)
+    end
+
+    it "uses the key index to add entries with #<<" do
+        queue << [1, :a, :data]
+        assert_equal 1, queue.delete_all_for(:a)
+        assert queue.empty?
+    end
+
+    it "removes the earliest entry of a key that is after a given time" do
+        queue.push(1, :a, :a1)
+        queue.push(3, :a, :a3)
+        queue.push(2, :a, :a2)
+        queue.push(2, :b, :b2)
+        assert queue.delete_first_for(:a, 1)
+        assert_equal [:a1, :b2, :a3], queue.pop_until(10)
+        assert !queue.delete_first_for(:a, 0)
+    end
+
+    it "removes all the entries of a key" do
+        100.times { |i| queue.push(i, i % 3, i) }
+        assert_equal 34, queue.delete_all_for(0)
+        assert_equal (0...100).find_all { |i| i % 3 != 0 }, queue.pop_until(100)
+    end
+
+    it "copies the queue in #dup" do
+        queue.push(1, :a, :a1)
+        copy = queue.dup
+        queue.clear
+        assert_equal [:a1], copy.pop_until(1)
+        assert_equal 0, copy.delete_all_for(:a)
+    end
+end